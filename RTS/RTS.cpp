@@ -11,6 +11,12 @@
 #include "shader_reader.h"
 #include "settings.h"
 #include "game.h"
+#include "unittransforms.h"
+#include "snapshot.h"
+#include "statestream.h"
+#include "bench.h"
+#include "pipeline.h"
+#include "startup.h"
 
 #undef main
 
@@ -21,27 +27,118 @@ const GLuint TRANSLATION_ATTRIB_LOC = 2;
 const GLuint NORMAL_ATTRIB_LOC = 3;
 const GLuint HEADING_ATTRIB_LOC = 4;
 const GLuint TINT_ATTRIB_LOC = 5;
+const GLuint TILT_ATTRIB_LOC = 6;
+const GLuint PART_ATTRIB_LOC = 7;
+const GLuint TURRET_DIRECTION_ATTRIB_LOC = 8;
+
+//the instance stream for res/shaders/transformed, sharing the vertex attributes above
+const GLuint HULL_LIGHT_ATTRIB_LOC = 2;
+const GLuint TURRET_LIGHT_ATTRIB_LOC = 4;
+const GLuint HULL_TRANSFORM_ATTRIB_LOC = 8; //a mat4, so four locations
+const GLuint TURRET_TRANSFORM_ATTRIB_LOC = 12;
+
+//which parts of a unit turn with the turret, matches the part attribute in shader.vs
+const GLfloat PART_HULL = 0.0f;
+const GLfloat PART_TURRET = 1.0f;
 
 GLuint genericQuadIndexData[] = { 0, 1, 2, 0, 2, 3 };
 
-struct Model {
-    GLuint* indices;
+struct MeshVertex {
+    GLfloat pos[3];
+    GLfloat normal[3];
+    GLfloat part;
+};
+
+//everything the shader needs to draw every part of one unit
+struct UnitInstance {
+    GLfloat translation[3];
+    GLfloat heading;
+    GLfloat turretDirection;
+    GLfloat tint[4];
+    GLfloat tilt[2];
+};
+
+//same layout as the GL_DRAW_INDIRECT_BUFFER commands
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+struct MeshPart {
+    GLuint firstIndex;
+    GLuint indexCount;
+};
+
+//a unit type, its parts sit next to each other in the merged buffers and share its instances
+struct UnitModel {
+    std::vector<MeshPart> parts;
+    GLint baseVertex;
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLuint firstInstance{ 0 };
+    GLuint instanceCount{ 0 };
+};
+
+// Every unit model's parts packed into one vertex and index buffer, drawn from a single
+// VAO and a single interleaved instance stream. With multi-draw indirect each part is
+// one command and the whole lot is a single draw call; without it each model is one
+// instanced draw, since its parts are contiguous in the index buffer.
+struct MergedMeshes {
+    std::vector<MeshVertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<UnitModel> models;
+
     GLuint VAO;
     GLuint VBO;
     GLuint EBO;
-    GLuint NAO;
-    GLuint TRANSLATION_VBO;
-    GLuint HEADINGS_VBO;
-    GLuint TINT_VBO;
+    GLuint INSTANCE_VBO;
+    GLuint INDIRECT_BUFFER;
     GLuint shaderProgramID;
+
+    bool multiDrawIndirect{ false };
+    //instances carry UnitTransforms built on the CPU rather than UnitInstances, for res/shaders/transformed
+    bool precomputedTransforms{ false };
+    std::vector<UnitInstance> instances;
+    std::vector<UnitTransform> transforms;
+    std::vector<DrawElementsIndirectCommand> commands;
 };
 
-Model turret;
-Model tank;
-Model gun;
+const int TANK_MODEL = 0;
+
+MergedMeshes unitMeshes;
 
+const GLuint PARTICLE_CORNER_ATTRIB_LOC = 1;
+const GLuint PARTICLE_CENTRE_ATTRIB_LOC = 2;
+const GLuint PARTICLE_SIZE_ATTRIB_LOC = 3;
+const GLuint PARTICLE_FADE_ATTRIB_LOC = 4;
+
+GLfloat particleQuadCorners[] = { -0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f };
+
+//one instanced quad draw per particle pool
+struct ParticleMesh {
+    GLuint VAO;
+    GLuint INSTANCE_VBO;
+    GLsizei instanceCount{ 0 };
+};
+
+GLuint particleQuadVBO;
+GLuint particleQuadEBO;
+GLuint particleShaderProgramId;
+ParticleMesh particleMeshes[PARTICLE_TYPE_COUNT];
+
+const int SHADER_PROGRAM_COUNT = 4; //unit, basic, particle and unit with precomputed transforms
+const char* const SHADER_FILES[SHADER_PROGRAM_COUNT][2] = {
+    { "res/shaders/shader.vs", "res/shaders/shader.fs" },
+    { "res/shaders/basic/shader.vs", "res/shaders/basic/shader.fs" },
+    { "res/shaders/particle/shader.vs", "res/shaders/particle/shader.fs" },
+    { "res/shaders/transformed/shader.vs", "res/shaders/shader.fs" },
+};
 GLuint shaderProgramId;
 GLuint basicShaderProgramId;
+GLuint transformedShaderProgramId;
 
 GLuint mousePointVAO;
 GLuint mousePointVBO;
@@ -69,99 +166,301 @@ glm::vec4 screenToRay(float mouseX, float mouseY, glm::mat4 projectionMatrix, gl
     return direction;
 }
 
-void loadMeshToVAO(aiMesh *mesh, Model *model) {
-    glGenVertexArrays(1, &model->VAO);
-    glBindVertexArray(model->VAO);
+//appends one assimp mesh as a part of the model being built, indices relative to the model's first vertex
+void addMeshPart(MergedMeshes* meshes, UnitModel* model, const aiMesh* mesh, GLfloat part) {
+    GLuint firstVertex = meshes->vertices.size() - model->baseVertex;
+
+    for (int i = 0; i < mesh->mNumVertices; i++) {
+        MeshVertex vertex;
+        vertex.pos[0] = mesh->mVertices[i].x;
+        vertex.pos[1] = mesh->mVertices[i].y;
+        vertex.pos[2] = mesh->mVertices[i].z;
+        vertex.normal[0] = mesh->mNormals[i].x;
+        vertex.normal[1] = mesh->mNormals[i].y;
+        vertex.normal[2] = mesh->mNormals[i].z;
+        vertex.part = part;
+        meshes->vertices.push_back(vertex);
+    }
 
-    int verticesSize = mesh->mNumVertices * 3 * sizeof(GLfloat);
+    MeshPart meshPart;
+    meshPart.firstIndex = meshes->indices.size();
+    for (int faceIdx = 0; faceIdx < mesh->mNumFaces; faceIdx++) {
+        aiFace* face = &(mesh->mFaces[faceIdx]);
+        for (int i = 0; i < face->mNumIndices; i++) {
+            meshes->indices.push_back(firstVertex + face->mIndices[i]);
+        }
+    }
+    meshPart.indexCount = meshes->indices.size() - meshPart.firstIndex;
 
-    glGenBuffers(1, &model->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->VBO);
-    glBufferData(GL_ARRAY_BUFFER, verticesSize, mesh->mVertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(POS_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(POS_ATTRIB_LOC);
+    model->parts.push_back(meshPart);
+    model->indexCount += meshPart.indexCount;
+}
+
+//meshParts gives the part of each of the scene's meshes, returns the new model's index
+int addUnitModel(MergedMeshes* meshes, const aiScene* scene, const std::vector<GLfloat>& meshParts) {
+    UnitModel model;
+    model.baseVertex = meshes->vertices.size();
+    model.firstIndex = meshes->indices.size();
+    model.indexCount = 0;
+
+    for (int i = 0; i < meshParts.size(); i++) {
+        addMeshPart(meshes, &model, scene->mMeshes[i], meshParts[i]);
+    }
+
+    meshes->models.push_back(model);
+    return meshes->models.size() - 1;
+}
 
-    glGenBuffers(1, &model->NAO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->NAO);
-    glBufferData(GL_ARRAY_BUFFER, verticesSize, mesh->mNormals, GL_STATIC_DRAW);
-    glVertexAttribPointer(NORMAL_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+//points the instance attributes at the instance stream, starting firstInstance instances in
+void bindUnitInstanceAttributes(MergedMeshes* meshes, GLuint firstInstance) {
+    glBindBuffer(GL_ARRAY_BUFFER, meshes->INSTANCE_VBO);
+
+    if (meshes->precomputedTransforms) {
+        GLsizei stride = sizeof(UnitTransform);
+        const char* base = (const char*)(firstInstance * sizeof(UnitTransform));
+        for (GLuint column = 0; column < 4; column++) {
+            glVertexAttribPointer(HULL_TRANSFORM_ATTRIB_LOC + column, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitTransform, hull) + column * 4 * sizeof(GLfloat));
+            glVertexAttribPointer(TURRET_TRANSFORM_ATTRIB_LOC + column, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitTransform, turret) + column * 4 * sizeof(GLfloat));
+        }
+        glVertexAttribPointer(HULL_LIGHT_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitTransform, hullLight));
+        glVertexAttribPointer(TURRET_LIGHT_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitTransform, turretLight));
+        glVertexAttribPointer(TINT_ATTRIB_LOC, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitTransform, tint));
+        return;
+    }
+
+    GLsizei stride = sizeof(UnitInstance);
+    const char* base = (const char*)(firstInstance * sizeof(UnitInstance));
+    glVertexAttribPointer(TRANSLATION_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitInstance, translation));
+    glVertexAttribPointer(HEADING_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitInstance, heading));
+    glVertexAttribPointer(TURRET_DIRECTION_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitInstance, turretDirection));
+    glVertexAttribPointer(TINT_ATTRIB_LOC, 4, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitInstance, tint));
+    glVertexAttribPointer(TILT_ATTRIB_LOC, 2, GL_FLOAT, GL_FALSE, stride, base + offsetof(UnitInstance, tilt));
+}
+
+void uploadMergedMeshes(MergedMeshes* meshes) {
+    meshes->multiDrawIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+
+    glGenVertexArrays(1, &meshes->VAO);
+    glBindVertexArray(meshes->VAO);
+
+    glGenBuffers(1, &meshes->VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, meshes->VBO);
+    glBufferData(GL_ARRAY_BUFFER, meshes->vertices.size() * sizeof(MeshVertex), meshes->vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(POS_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, pos));
+    glEnableVertexAttribArray(POS_ATTRIB_LOC);
+    glVertexAttribPointer(NORMAL_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
     glEnableVertexAttribArray(NORMAL_ATTRIB_LOC);
+    glVertexAttribPointer(PART_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, part));
+    glEnableVertexAttribArray(PART_ATTRIB_LOC);
+
+    glGenBuffers(1, &meshes->EBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshes->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshes->indices.size() * sizeof(GLuint), meshes->indices.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &meshes->INSTANCE_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, meshes->INSTANCE_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(UnitInstance), NULL, GL_STREAM_DRAW);
+    bindUnitInstanceAttributes(meshes, 0);
+    std::vector<GLuint> instanceAttributes = { TRANSLATION_ATTRIB_LOC, HEADING_ATTRIB_LOC, TURRET_DIRECTION_ATTRIB_LOC, TINT_ATTRIB_LOC, TILT_ATTRIB_LOC };
+    if (meshes->precomputedTransforms) {
+        instanceAttributes = { HULL_LIGHT_ATTRIB_LOC, TURRET_LIGHT_ATTRIB_LOC, TINT_ATTRIB_LOC };
+        for (GLuint column = 0; column < 4; column++) {
+            instanceAttributes.push_back(HULL_TRANSFORM_ATTRIB_LOC + column);
+            instanceAttributes.push_back(TURRET_TRANSFORM_ATTRIB_LOC + column);
+        }
+    }
+    for (GLuint location : instanceAttributes) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
 
-    int numIndices = mesh->mFaces[0].mNumIndices * mesh->mNumFaces;
-    model->indices = (GLuint*) malloc(sizeof(GLuint) * numIndices);
-    
-    for (int faceIdx = 0; faceIdx < mesh->mNumFaces; faceIdx++) {
-        aiFace* face = &(mesh->mFaces[faceIdx]);
-        for (int i = 0; i < face->mNumIndices; i++) {
-            model->indices[i + (faceIdx * 3)] = face->mIndices[i];
+    if (meshes->multiDrawIndirect) {
+        glGenBuffers(1, &meshes->INDIRECT_BUFFER);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+//interleaves the visible tanks into the instance stream and rebuilds the draw commands
+//viewProjection is only needed for precomputed transforms, which have it folded in
+void refreshUnitInstances(MergedMeshes* meshes, const TanksData& tanks, const glm::mat4& viewProjection) {
+    int count = tanks.headings.size();
+    const void* instanceData;
+    size_t instanceBytes;
+    if (meshes->precomputedTransforms) {
+        computeUnitTransforms(tanks, glm::value_ptr(viewProjection), &meshes->transforms);
+        instanceData = meshes->transforms.data();
+        instanceBytes = count * sizeof(UnitTransform);
+    }
+    else {
+        meshes->instances.resize(count);
+        for (int i = 0; i < count; i++) {
+            UnitInstance& instance = meshes->instances[i];
+            memcpy(instance.translation, &tanks.positions[3 * i], sizeof(instance.translation));
+            instance.heading = tanks.headings[i];
+            instance.turretDirection = tanks.turretDirections[i];
+            memcpy(instance.tint, &tanks.tint[4 * i], sizeof(instance.tint));
+            memcpy(instance.tilt, &tanks.tilts[2 * i], sizeof(instance.tilt));
+        }
+        instanceData = meshes->instances.data();
+        instanceBytes = count * sizeof(UnitInstance);
+    }
+
+    //tanks are the only unit type so far, other models would follow them in the stream
+    for (UnitModel& model : meshes->models) {
+        model.firstInstance = 0;
+        model.instanceCount = 0;
+    }
+    meshes->models[TANK_MODEL].instanceCount = count;
+
+    glBindBuffer(GL_ARRAY_BUFFER, meshes->INSTANCE_VBO);
+    //orphan last frame's storage rather than wait for the GPU to finish reading it
+    glBufferData(GL_ARRAY_BUFFER, instanceBytes, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instanceBytes, instanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    telemetryUploadedBytes += instanceBytes;
+
+    if (!meshes->multiDrawIndirect) {
+        return;
+    }
+
+    meshes->commands.clear();
+    for (const UnitModel& model : meshes->models) {
+        if (model.instanceCount == 0) {
+            continue;
+        }
+        for (const MeshPart& part : model.parts) {
+            DrawElementsIndirectCommand command;
+            command.count = part.indexCount;
+            command.instanceCount = model.instanceCount;
+            command.firstIndex = part.firstIndex;
+            command.baseVertex = model.baseVertex;
+            command.baseInstance = model.firstInstance;
+            meshes->commands.push_back(command);
         }
     }
 
-    glGenBuffers(1, &model->EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), model->indices, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &model->TRANSLATION_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->TRANSLATION_VBO);
-    GLfloat buffer[]{ -10.0f, 0.0f, 0.0f};
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3, buffer, GL_STATIC_DRAW);
-    glVertexAttribPointer(TRANSLATION_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
-    glEnableVertexAttribArray(TRANSLATION_ATTRIB_LOC);
-    glVertexAttribDivisor(TRANSLATION_ATTRIB_LOC, 1);
-
-    glGenBuffers(1, &model->HEADINGS_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->HEADINGS_VBO);
-    GLfloat headings_buffer[]{ 0.0 };
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat), headings_buffer, GL_STATIC_DRAW);
-    glVertexAttribPointer(HEADING_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(HEADING_ATTRIB_LOC);
-    glVertexAttribDivisor(HEADING_ATTRIB_LOC, 1);
-
-    glGenBuffers(1, &model->TINT_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, model->TINT_VBO);
-    GLfloat tint_buffer[]{ 1.0f, 1.0f, 1.0f, 1.0f };
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4, tint_buffer, GL_STATIC_DRAW);
-    glVertexAttribPointer(TINT_ATTRIB_LOC, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(TINT_ATTRIB_LOC);
-    glVertexAttribDivisor(TINT_ATTRIB_LOC, 1);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshes->INDIRECT_BUFFER);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, meshes->commands.size() * sizeof(DrawElementsIndirectCommand), meshes->commands.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    telemetryUploadedBytes += meshes->commands.size() * sizeof(DrawElementsIndirectCommand);
+}
+
+void drawUnitModels(MergedMeshes* meshes) {
+    glBindVertexArray(meshes->VAO);
+
+    if (meshes->multiDrawIndirect) {
+        if (!meshes->commands.empty()) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshes->INDIRECT_BUFFER);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, meshes->commands.size(), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+    }
+    else {
+        //without base instance support, each model's instances are found by moving the attribute pointers
+        for (const UnitModel& model : meshes->models) {
+            if (model.instanceCount == 0) {
+                continue;
+            }
+            bindUnitInstanceAttributes(meshes, model.firstInstance);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, model.indexCount, GL_UNSIGNED_INT,
+                (void*)(model.firstIndex * sizeof(GLuint)), model.instanceCount, model.baseVertex);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glBindVertexArray(0);
+}
+
+void initParticleMeshes() {
+    glGenBuffers(1, &particleQuadVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, particleQuadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(particleQuadCorners), particleQuadCorners, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &particleQuadEBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, particleQuadEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * sizeof(GLuint), genericQuadIndexData, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    GLsizei stride = sizeof(ParticleInstance);
+    for (ParticleMesh& mesh : particleMeshes) {
+        glGenVertexArrays(1, &mesh.VAO);
+        glBindVertexArray(mesh.VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, particleQuadVBO);
+        glVertexAttribPointer(PARTICLE_CORNER_ATTRIB_LOC, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+        glEnableVertexAttribArray(PARTICLE_CORNER_ATTRIB_LOC);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, particleQuadEBO);
+
+        glGenBuffers(1, &mesh.INSTANCE_VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.INSTANCE_VBO);
+        glBufferData(GL_ARRAY_BUFFER, stride, NULL, GL_STREAM_DRAW);
+        glVertexAttribPointer(PARTICLE_CENTRE_ATTRIB_LOC, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleInstance, position));
+        glVertexAttribPointer(PARTICLE_SIZE_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleInstance, size));
+        glVertexAttribPointer(PARTICLE_FADE_ATTRIB_LOC, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleInstance, fade));
+        GLuint instanceAttributes[] = { PARTICLE_CENTRE_ATTRIB_LOC, PARTICLE_SIZE_ATTRIB_LOC, PARTICLE_FADE_ATTRIB_LOC };
+        for (GLuint location : instanceAttributes) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+    }
 
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-template<typename T>
-void refreshBuffer(GLuint type, GLuint handle, vector<T> data, GLuint mode) {
-    glBindBuffer(type, handle);
-    glBufferData(type, sizeof(T) * data.size(), data.data(), mode);
-    glBindBuffer(type, 0);
+void refreshParticleMeshes(const RenderState* state) {
+    for (int t = 0; t < PARTICLE_TYPE_COUNT; t++) {
+        const std::vector<ParticleInstance>& instances = state->particles[t];
+        ParticleMesh& mesh = particleMeshes[t];
+        mesh.instanceCount = instances.size();
+        if (instances.empty()) {
+            continue;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.INSTANCE_VBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(ParticleInstance), instances.data());
+        telemetryUploadedBytes += instances.size() * sizeof(ParticleInstance);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//after everything opaque, particles are blended and don't write depth
+void drawParticles() {
+    glUseProgram(particleShaderProgramId);
+    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(modelMat));
+    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(viewMat));
+    glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(projMat));
+    glDepthMask(GL_FALSE);
+
+    for (int t = 0; t < PARTICLE_TYPE_COUNT; t++) {
+        ParticleMesh& mesh = particleMeshes[t];
+        if (mesh.instanceCount == 0) {
+            continue;
+        }
+        glUniform4fv(4, 1, PARTICLE_EMITTERS[t].colour);
+        glBindVertexArray(mesh.VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL, mesh.instanceCount);
+    }
+
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
 }
 
-void refreshBuffers(Game* game) {
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, gun.TRANSLATION_VBO, game->tanksData.positions, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, tank.TRANSLATION_VBO, game->tanksData.positions, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, turret.TRANSLATION_VBO, game->tanksData.positions, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, tank.HEADINGS_VBO, game->tanksData.headings, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, gun.HEADINGS_VBO, game->tanksData.headings, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, turret.HEADINGS_VBO, game->tanksData.headings, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, tank.TINT_VBO, game->tanksData.tint, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, turret.TINT_VBO, game->tanksData.tint, GL_STATIC_DRAW);
-    refreshBuffer<GLfloat>(GL_ARRAY_BUFFER, gun.TINT_VBO, game->tanksData.tint, GL_STATIC_DRAW);
+void refreshBuffers(const RenderState* state) {
+    refreshUnitInstances(&unitMeshes, state->tanks, projMat * viewMat * modelMat);
+    refreshParticleMeshes(state);
 
     glBindBuffer(GL_ARRAY_BUFFER, mousePointVBO);
-    float tempCoords[2];
-    tempCoords[0] = game->currentMouseGroundIntersection.x;
-    tempCoords[1] = game->currentMouseGroundIntersection.z;
-
-    //uncomment these lines to snap the mouse pointer to grid lines
-    //int tmpIdx = realCoordsToMapIndex(game, tempCoords[0], tempCoords[1]);
-    //mapIndexToRealCorrds(game, tmpIdx, tempCoords);
-    game->currentMouseGroundIntersection.x = tempCoords[0];
-    game->currentMouseGroundIntersection.z = tempCoords[1];
-    glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(GLfloat), glm::value_ptr(game->currentMouseGroundIntersection), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(GLfloat), glm::value_ptr(state->mouseGroundIntersection), GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     glBindBuffer(GL_ARRAY_BUFFER, selectionQuadVBO);
-    glBufferData(GL_ARRAY_BUFFER, 12 * sizeof(GLfloat), game->groundSelectionQuadVertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 12 * sizeof(GLfloat), state->groundSelectionQuadVertices, GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
@@ -170,10 +469,22 @@ void initGame(Game* game) {
         addTank(game, -30.0f + (i * 8.0f), 0.0f, 0.0f, 0.0f);
     }
 
+    //the computer opponent gets the same, across the map
+    if (game->settings.aiTeam >= 0) {
+        for (int i = 0; i < 10; i++) {
+            IndexReference tank = addTank(game, -30.0f + (i * 8.0f), 0.0f, 150.0f, 0.0f);
+            game->tanks[tank.index].team = game->settings.aiTeam;
+        }
+    }
+
     initFlowMap(game);
+
+    if (game->settings.terrainAmplitude > 0.0f) {
+        generateMapTerrain(game, game->settings.terrainAmplitude, 1);
+    }
 }
 
-void render(Game* game, Settings settings, const aiScene* scene) {
+void render(const RenderState* state, Settings settings) {
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -183,19 +494,15 @@ void render(Game* game, Settings settings, const aiScene* scene) {
 
     glPointSize(2.0f);
 
-    glUseProgram(tank.shaderProgramID);
-    glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(modelMat));
-    glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(viewMat));
-    glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(projMat));
-
-    glBindVertexArray(tank.VAO);
-    glDrawElementsInstanced(GL_TRIANGLES, scene->mMeshes[0]->mNumFaces * 3, GL_UNSIGNED_INT, NULL, game->tanks.size());
-
-    glBindVertexArray(turret.VAO);
-    glDrawElementsInstanced(GL_TRIANGLES, scene->mMeshes[1]->mNumFaces * 3, GL_UNSIGNED_INT, NULL, game->tanks.size());
+    glUseProgram(unitMeshes.shaderProgramID);
+    if (!unitMeshes.precomputedTransforms) {
+        glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(modelMat));
+        glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(viewMat));
+        glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(projMat));
+    }
 
-    glBindVertexArray(gun.VAO);
-    glDrawElementsInstanced(GL_TRIANGLES, scene->mMeshes[2]->mNumFaces * 3, GL_UNSIGNED_INT, NULL, game->tanks.size());
+    drawUnitModels(&unitMeshes);
+    drawParticles();
 
     glUseProgram(basicShaderProgramId);
     glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(modelMat));
@@ -207,7 +514,7 @@ void render(Game* game, Settings settings, const aiScene* scene) {
     glBindVertexArray(mousePointVAO);
     glDrawArrays(GL_POINTS, 0, 1);
 
-    if (game->primaryButtonDown) {
+    if (state->primaryButtonDown) {
         glBindVertexArray(selectionQuadVAO);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
     }
@@ -221,34 +528,61 @@ void render(Game* game, Settings settings, const aiScene* scene) {
     }
 }
 
-int main() {
-    Settings settings;
-    load_settings_file(&settings, "res\\settings");
-
-    glm::vec3 cameraPos = glm::vec3(settings.cameraPos.x, settings.cameraPos.y, settings.cameraPos.z);
-
-    projMat = glm::perspective<float>(45.0f, 1.0f, 1.0, 10000.0);
-    modelMat = glm::mat4(1.0f);
-    viewMat = glm::mat4(1.0f);
-
-    viewMat = glm::rotate(viewMat, (float)M_PI / 2.5f, glm::vec3(1.0f, 0.0f, 0.0f));
-    viewMat = glm::translate(viewMat, cameraPos * -1.0f);
-
-    Assimp::Importer importer;
-
-    const aiScene* scene = importer.ReadFile("res\\obj\\tank.obj", aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals);
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-telemetry") == 0) {
+        return runTelemetryReader(argc, argv);
+    }
 
-    if (scene == NULL) {
-        std::cout << "ERROR: " << importer.GetErrorString() << std::endl;
-        return -1;
+    if (createTelemetrySegment(&telemetry)) {
+        std::cout << "telemetry segment " << telemetry.name << std::endl;
     }
 
-    aiNode* rootNode = scene->mRootNode;
+    //the CPU side of loading runs on other threads while this one brings up the window,
+    //the loader is declared after what its jobs write to so it joins them before that goes
+    Settings settings;
+    Game game;
+    std::string shaderSources[SHADER_PROGRAM_COUNT][2];
+    StartupLoader loader;
+
+    StartupJob* settingsJob = startStartupJob(&loader, "settings", [&settings]() {
+        load_settings_file(&settings, "res\\settings");
+        return true;
+    });
+
+    //tank.obj is the hull, the turret and the gun, in that order
+    startStartupJob(&loader, "meshes", []() {
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile("res\\obj\\tank.obj", aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals);
+
+        if (scene == NULL) {
+            std::cout << "ERROR: " << importer.GetErrorString() << std::endl;
+            return false;
+        }
+        if (scene->mRootNode == NULL) {
+            std::cout << "root node is NULL for some reason ..." << std::endl;
+            return false;
+        }
 
-    if (rootNode == NULL) {
-        std::cout << "root node is NULL for some reason ..." << std::endl;
-        return -1;
-    }
+        addUnitModel(&unitMeshes, scene, { PART_HULL, PART_TURRET, PART_TURRET });
+        return true;
+    });
+
+    startStartupJob(&loader, "shaders", [&shaderSources]() {
+        bool ok = true;
+        for (int p = 0; p < SHADER_PROGRAM_COUNT; p++) {
+            for (int stage = 0; stage < 2; stage++) {
+                shaderSources[p][stage] = load_shader_file(SHADER_FILES[p][stage]);
+                if (shaderSources[p][stage].empty()) {
+                    std::cout << "ERROR: could not read " << SHADER_FILES[p][stage] << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    });
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cout << "ERROR Initialising SDL2: " << SDL_GetError() << std::endl;
@@ -258,6 +592,24 @@ int main() {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 
+    //the window's size and the map both come from the settings
+    waitForStartupJob(settingsJob);
+    startStartupJob(&loader, "map", [&game, &settings]() {
+        //TODO: move loading settings into initGame
+        game.settings = settings;
+        initGame(&game);
+        return true;
+    });
+
+    glm::vec3 cameraPos = glm::vec3(settings.cameraPos.x, settings.cameraPos.y, settings.cameraPos.z);
+
+    projMat = glm::perspective<float>(45.0f, 1.0f, 1.0, 10000.0);
+    modelMat = glm::mat4(1.0f);
+    viewMat = glm::mat4(1.0f);
+
+    viewMat = glm::rotate(viewMat, (float)M_PI / 2.5f, glm::vec3(1.0f, 0.0f, 0.0f));
+    viewMat = glm::translate(viewMat, cameraPos * -1.0f);
+
     window = SDL_CreateWindow("RTS game", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, settings.windowWidth, settings.windowHeight, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
     context = SDL_GL_CreateContext(window);
 
@@ -282,16 +634,22 @@ int main() {
         return -1;
     }
 
-    shaderProgramId = create_shader_program("res/shaders/shader.vs", "res/shaders/shader.fs");
-    basicShaderProgramId = create_shader_program("res/shaders/basic/shader.vs", "res/shaders/basic/shader.fs");
+    double windowReadyMs = startupMsSince(loader.start);
+    if (!finishStartupJobs(&loader)) {
+        return -1;
+    }
 
-    tank.shaderProgramID = shaderProgramId;
-    turret.shaderProgramID = shaderProgramId;
-    gun.shaderProgramID = shaderProgramId;
+    //everything GL in one batch, now that the jobs have handed over their results
+    auto uploadStart = StartupClock::now();
+    shaderProgramId = create_shader_program_from_source(shaderSources[0][0], shaderSources[0][1]);
+    basicShaderProgramId = create_shader_program_from_source(shaderSources[1][0], shaderSources[1][1]);
+    particleShaderProgramId = create_shader_program_from_source(shaderSources[2][0], shaderSources[2][1]);
+    transformedShaderProgramId = create_shader_program_from_source(shaderSources[3][0], shaderSources[3][1]);
 
-    loadMeshToVAO(scene->mMeshes[0], &tank);
-    loadMeshToVAO(scene->mMeshes[1], &turret);
-    loadMeshToVAO(scene->mMeshes[2], &gun);
+    unitMeshes.precomputedTransforms = settings.precomputedTransforms;
+    unitMeshes.shaderProgramID = settings.precomputedTransforms ? transformedShaderProgramId : shaderProgramId;
+    uploadMergedMeshes(&unitMeshes);
+    initParticleMeshes();
 
     bool quit = false;
     SDL_Event e;
@@ -299,11 +657,6 @@ int main() {
     GLfloat xRotation = 0.0f;
     lastFrame = SDL_GetTicks();
 
-    Game game;
-    initGame(&game);
-    //TODO: move loading settings into initGame
-    game.settings = settings;
-
     float mouseX{ 0.0f }, mouseY{ 0.0 };
 
     glGenVertexArrays(1, &mousePointVAO);
@@ -335,59 +688,99 @@ int main() {
 
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    double uploadMs = startupMsSince(uploadStart);
+    bool firstFrame = true;
 
-    while (!quit) {
+    Simulation simulation;
+    simulation.game = &game;
+    if (settings.threadedSimulation) {
+        startSimulation(&simulation, &game);
+    }
 
-        int timeNow = SDL_GetTicks();
+    FrameStats frameStats;
+    InputSender inputSender;
 
-        if (lastFrame == 0 || timeNow - lastFrame >= (1000 / 60)) {
-            lastFrame = timeNow;
-            tick(&game);
-            refreshBuffers(&game);
-            render(&game, settings, scene);
-        }
+    while (!quit) {
+        auto frameStart = PipelineClock::now();
 
         while (SDL_PollEvent(&e) != 0) {
+            InputCommand input;
+            bool send = true;
+
             if (e.type == SDL_QUIT) {
                 quit = true;
+                send = false;
             }
             else if (e.type == SDL_MOUSEMOTION) {
                 mouseX = (-1.0f + ((float)e.motion.x / (float)settings.windowWidth * 2.0f));
                 mouseY = (1.0f - ((float)e.motion.y / (float)settings.windowHeight * 2.0f));
-                
-                auto rayDirection = screenToRay(mouseX, mouseY, projMat, viewMat);
-                
-                rayGroundPlaneIntersection(rayDirection, cameraPos, &game.currentMouseGroundIntersection);
 
-                if (game.primaryButtonDown) {
-                    game.mouseDragData.drag = game.currentMouseGroundIntersection;
-                }
+                input.type = INPUT_MOUSE_RAY;
+                input.rayOrigin = cameraPos;
+                input.rayDirection = glm::vec3(screenToRay(mouseX, mouseY, projMat, viewMat));
+                queueMouseRay(&inputSender, input);
+                send = false;
             }
-            else if (e.type == SDL_MOUSEBUTTONDOWN) {
-                if (e.button.button == SDL_BUTTON_LEFT) {
-                    if (!game.primaryButtonDown) {
-                        //start dragging here
-                        game.primaryButtonDown = true;
-                        game.mouseDragData.origin = game.currentMouseGroundIntersection;
-                        game.mouseDragData.drag = game.currentMouseGroundIntersection;
-                        resetSelectionQuadVertices(&game);
-                    }
-                }
-                else if (e.button.button == SDL_BUTTON_RIGHT) {
-                    game.secondaryButtonClicked = true;
-                }
+            else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
+                input.type = INPUT_PRIMARY_DOWN;
             }
-            else if (e.type == SDL_MOUSEBUTTONUP) {
-                if (e.button.button == SDL_BUTTON_LEFT) {
-                    if (game.primaryButtonDown) {
-                        //stop dragging here
-                        game.primaryButtonDown = false;
-                    }
-                }
+            else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT) {
+                input.type = INPUT_SECONDARY_CLICK;
+            }
+            else if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
+                input.type = INPUT_PRIMARY_UP;
+            }
+            else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F5) {
+                input.type = INPUT_QUICKSAVE;
+            }
+            else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F9) {
+                input.type = INPUT_QUICKLOAD;
+            }
+            else {
+                send = false;
+            }
+
+            if (send) {
+                queueInput(&inputSender, input);
             }
         }
+        sendInputs(&inputSender, &simulation.inputs);
+
+        if (!settings.threadedSimulation) {
+            int timeNow = SDL_GetTicks();
+            if (lastFrame != 0 && timeNow - lastFrame < (1000 / 60)) {
+                continue;
+            }
+            lastFrame = timeNow;
+            simulationStep(&simulation);
+        }
+
+        //with vsync on, the swap in render() is what paces this loop
+        const RenderState* state = acquireRenderState(&simulation.renderStates);
+        auto renderStart = PipelineClock::now();
+        refreshBuffers(state);
+        render(state, settings);
+
+        if (firstFrame) {
+            firstFrame = false;
+            std::cout << "startup: first frame after " << startupMsSince(loader.start) << " ms (window and context ready at "
+                << windowReadyMs << " ms, GL uploads " << uploadMs << " ms)" << std::endl;
+        }
+
+        publishRenderTelemetry(std::chrono::duration_cast<std::chrono::microseconds>(PipelineClock::now() - frameStart).count());
+
+        FrameStats averages;
+        if (recordFrame(&frameStats, state, frameStart, renderStart, &averages)) {
+            char title[256];
+            snprintf(title, sizeof(title), "RTS game - %d fps, sim %.2f ms, render %.2f ms, frame %.2f ms, latency %.2f ms",
+                averages.frames, averages.simulationMs, averages.renderMs, averages.frameMs, averages.latencyMs);
+            SDL_SetWindowTitle(window, title);
+        }
     }
 
+    stopSimulation(&simulation);
+    closeTelemetrySegment(&telemetry);
+
     SDL_DestroyWindow(window);
     SDL_Quit();
 
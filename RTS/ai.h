@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+
+// Computer opponent for one team, driven by the influence maps.
+//
+// Every AI_DECISION_TICKS the AI picks a plan from its team's influence summary:
+// defend home if the enemy is pressing on it, attack the enemy's strongest cell if it
+// clearly outnumbers them, otherwise expand into the most valuable unclaimed ground. A
+// decision only reads summaries and totals, so its cost doesn't depend on the map.
+// Orders for a new plan go out to at most AI_ORDERS_PER_TICK tanks a tick.
+
+const int AI_DECISION_TICKS = 30;
+const int AI_ORDERS_PER_TICK = 64;
+const int AI_SCAN_PER_TICK = AI_ORDERS_PER_TICK * 8; //tanks looked at a tick while handing out orders
+const float AI_DEFEND_RATIO = 0.75f; //enemy influence at home, relative to our own there
+const float AI_ATTACK_RATIO = 1.25f; //our strength relative to everyone else's
+const float AI_MIN_UNIT_WEIGHT = 0.25f; //influence of a live unit, however damaged
+
+enum AiPlan {
+	AI_IDLE,
+	AI_DEFEND,
+	AI_ATTACK,
+	AI_EXPAND
+};
+
+struct AiStats {
+	double lastTickMs{ 0.0 };   //influence upkeep, decision and orders together
+	double worstTickMs{ 0.0 };
+	double totalMs{ 0.0 };
+	long long ticks{ 0 };
+	long long decisions{ 0 };
+	long long ordersIssued{ 0 };
+};
+
+struct AiOpponent {
+	AiPlan plan{ AI_IDLE };
+	int targetCell{ -1 };        //influence cell
+	int ticksUntilDecision{ 0 };
+	int orderCursor{ -1 };       //next tank to hand the plan to, -1 once everyone has it
+	AiStats stats;
+};
+
+const char* aiPlanName(AiPlan plan) {
+	switch (plan) {
+	case AI_DEFEND:
+		return "defend";
+	case AI_ATTACK:
+		return "attack";
+	case AI_EXPAND:
+		return "expand";
+	default:
+		return "idle";
+	}
+}
+
+void decideAiPlan(const InfluenceMaps* maps, int team, AiPlan* planOut, int* targetOut) {
+	const InfluenceSummary& summary = maps->summaries[team];
+	float strength = maps->teamStrength[team];
+
+	if (strength <= 0.0f || summary.homeCell == -1) {
+		*planOut = AI_IDLE;
+		*targetOut = -1;
+	}
+	else if (summary.homeThreat > summary.homeOwn * AI_DEFEND_RATIO) {
+		*planOut = AI_DEFEND;
+		*targetOut = summary.homeCell;
+	}
+	else if (summary.enemyPeakCell != -1 && strength > enemyStrength(maps, team) * AI_ATTACK_RATIO) {
+		*planOut = AI_ATTACK;
+		*targetOut = summary.enemyPeakCell;
+	}
+	else if (summary.expansionCell != -1) {
+		*planOut = AI_EXPAND;
+		*targetOut = summary.expansionCell;
+	}
+	else {
+		*planOut = AI_DEFEND;
+		*targetOut = summary.homeCell;
+	}
+}
+
+//returns true if the plan changed and needs handing out
+bool tickAiDecision(AiOpponent* ai, const InfluenceMaps* maps, int team) {
+	if (--ai->ticksUntilDecision > 0) {
+		return false;
+	}
+	ai->ticksUntilDecision = AI_DECISION_TICKS;
+	ai->stats.decisions++;
+
+	AiPlan plan;
+	int target;
+	decideAiPlan(maps, team, &plan, &target);
+	if (plan == ai->plan && target == ai->targetCell) {
+		return false;
+	}
+
+	ai->plan = plan;
+	ai->targetCell = target;
+	ai->orderCursor = plan == AI_IDLE ? -1 : 0;
+	return true;
+}
+
+void recordAiTick(AiOpponent* ai, double ms) {
+	ai->stats.lastTickMs = ms;
+	ai->stats.worstTickMs = ms > ai->stats.worstTickMs ? ms : ai->stats.worstTickMs;
+	ai->stats.totalMs += ms;
+	ai->stats.ticks++;
+}
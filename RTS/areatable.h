@@ -0,0 +1,260 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+
+// Rectangle queries over the flowCells: the total discomfort under a rectangle and
+// whether anything in it is occupied, for building placement and area effects.
+//
+// Both are answered from summed-area tables, where entry (x, y) holds the sum of every
+// cell below and to the left of it, so any rectangle is four loads. A single cell edit
+// would have to touch every entry above and to the right of it, so edits are queued
+// instead: queries add in the queued edits that fall inside the rectangle, and once
+// AREA_PENDING_LIMIT are queued (or at the end of a tick) the tables are rebuilt from
+// the lowest, leftmost edited cell onwards.
+//
+// A cell is occupied when it's impassable or reserved by a structure's footprint.
+// The occupancy bitmap keeps one bit per cell, so single cell tests don't need the
+// tables and a rebuild reads each row's occupancy a word at a time.
+//
+// Rectangles are in cells, half open: x0 <= x < x1, y0 <= y < y1.
+
+const int AREA_PENDING_LIMIT = 32;
+
+enum AreaOccupancy {
+	AREA_IMPASSABLE = 1,
+	AREA_RESERVED = 2
+};
+
+struct AreaEdit {
+	int x;
+	int y;
+	int discomfort; //change in discomfort
+	int occupied;   //-1, 0 or 1
+};
+
+struct AreaStats {
+	long long edits{ 0 };
+	long long rebuilds{ 0 };
+	long long rebuiltEntries{ 0 };
+	long long queries{ 0 };
+	double lastRebuildMs{ 0.0 };
+};
+
+struct AreaTables {
+	int width{ 0 };
+	int height{ 0 };
+	int stride{ 0 };           //width + 1, the tables have an extra zero row and column
+	int wordsPerRow{ 0 };
+
+	std::vector<int> discomfort;         //per cell, the values the tables are built from
+	std::vector<uint8_t> occupancy;      //per cell, AreaOccupancy flags
+	std::vector<uint64_t> occupiedBits;  //bit per cell, rows padded to whole words
+
+	std::vector<int64_t> discomfortSums;
+	std::vector<int32_t> occupiedSums;
+
+	//edits not yet folded into the tables, and the corner the rebuild has to start from
+	std::vector<AreaEdit> pending;
+	int dirtyX{ 0 };
+	int dirtyY{ 0 };
+
+	AreaStats stats;
+};
+
+bool areaCellOccupied(const AreaTables* tables, int x, int y) {
+	return (tables->occupiedBits[y * tables->wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+}
+
+void setAreaOccupiedBit(AreaTables* tables, int cell, bool occupied) {
+	int x = cell % tables->width;
+	int y = cell / tables->width;
+	uint64_t& word = tables->occupiedBits[y * tables->wordsPerRow + (x >> 6)];
+	uint64_t bit = (uint64_t)1 << (x & 63);
+	word = occupied ? word | bit : word & ~bit;
+}
+
+//recomputes every table entry with x > x0 and y > y0 (entries are offset by one from cells)
+void rebuildAreaTables(AreaTables* tables, int x0, int y0) {
+	auto start = std::chrono::high_resolution_clock::now();
+	int stride = tables->stride;
+
+	for (int y = y0; y < tables->height; y++) {
+		int64_t* sums = &tables->discomfortSums[(y + 1) * stride];
+		const int64_t* below = &tables->discomfortSums[y * stride];
+		int32_t* counts = &tables->occupiedSums[(y + 1) * stride];
+		const int32_t* countsBelow = &tables->occupiedSums[y * stride];
+		const int* row = &tables->discomfort[y * tables->width];
+		const uint64_t* bits = &tables->occupiedBits[y * tables->wordsPerRow];
+
+		//the row's running sums up to x0, from the entries left of the rebuild that are still good
+		int64_t rowSum = sums[x0] - below[x0];
+		int32_t rowCount = counts[x0] - countsBelow[x0];
+
+		int x = x0;
+		while (x < tables->width) {
+			uint64_t word = bits[x >> 6] >> (x & 63);
+			int end = ((x >> 6) + 1) << 6;
+			end = end < tables->width ? end : tables->width;
+			for (; x < end; x++, word >>= 1) {
+				rowSum += row[x];
+				rowCount += (int32_t)(word & 1);
+				sums[x + 1] = below[x + 1] + rowSum;
+				counts[x + 1] = countsBelow[x + 1] + rowCount;
+			}
+		}
+	}
+
+	tables->stats.rebuilds++;
+	tables->stats.rebuiltEntries += (long long)(tables->height - y0) * (tables->width - x0);
+	tables->stats.lastRebuildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//builds everything from discomfort values and reserved flags already in place
+void buildAreaTables(AreaTables* tables) {
+	std::fill(tables->occupiedBits.begin(), tables->occupiedBits.end(), 0);
+	for (int i = 0; i < tables->width * tables->height; i++) {
+		uint8_t flags = tables->occupancy[i] & AREA_RESERVED;
+		if (tables->discomfort[i] >= IMPASSABLE_DISCOMFORT) {
+			flags |= AREA_IMPASSABLE;
+		}
+		tables->occupancy[i] = flags;
+		setAreaOccupiedBit(tables, i, flags != 0);
+	}
+
+	tables->pending.clear();
+	rebuildAreaTables(tables, 0, 0);
+}
+
+void initAreaTables(AreaTables* tables, int width, int height) {
+	tables->width = width;
+	tables->height = height;
+	tables->stride = width + 1;
+	tables->wordsPerRow = (width + 63) / 64;
+
+	tables->discomfort.assign(width * height, 0);
+	tables->occupancy.assign(width * height, 0);
+	tables->occupiedBits.assign(tables->wordsPerRow * height, 0);
+	tables->discomfortSums.assign(tables->stride * (height + 1), 0);
+	tables->occupiedSums.assign(tables->stride * (height + 1), 0);
+	tables->pending.clear();
+	tables->stats = AreaStats();
+}
+
+//folds the queued edits into the tables
+void flushAreaTables(AreaTables* tables) {
+	if (tables->pending.empty()) {
+		return;
+	}
+	tables->pending.clear();
+	rebuildAreaTables(tables, tables->dirtyX, tables->dirtyY);
+}
+
+void queueAreaEdit(AreaTables* tables, int cell, int discomfortChange, int occupiedChange) {
+	if (discomfortChange == 0 && occupiedChange == 0) {
+		return;
+	}
+
+	int x = cell % tables->width;
+	int y = cell / tables->width;
+	if (tables->pending.empty()) {
+		tables->dirtyX = x;
+		tables->dirtyY = y;
+	}
+	else {
+		tables->dirtyX = x < tables->dirtyX ? x : tables->dirtyX;
+		tables->dirtyY = y < tables->dirtyY ? y : tables->dirtyY;
+	}
+
+	tables->pending.push_back(AreaEdit{ x, y, discomfortChange, occupiedChange });
+	tables->stats.edits++;
+	if (tables->pending.size() >= AREA_PENDING_LIMIT) {
+		flushAreaTables(tables);
+	}
+}
+
+void setAreaOccupancy(AreaTables* tables, int cell, uint8_t flags, int discomfortChange) {
+	bool was = tables->occupancy[cell] != 0;
+	bool is = flags != 0;
+	tables->occupancy[cell] = flags;
+	setAreaOccupiedBit(tables, cell, is);
+	queueAreaEdit(tables, cell, discomfortChange, (int)is - (int)was);
+}
+
+void setAreaDiscomfort(AreaTables* tables, int cell, int discomfort) {
+	int change = discomfort - tables->discomfort[cell];
+	tables->discomfort[cell] = discomfort;
+
+	uint8_t flags = tables->occupancy[cell] & AREA_RESERVED;
+	if (discomfort >= IMPASSABLE_DISCOMFORT) {
+		flags |= AREA_IMPASSABLE;
+	}
+	setAreaOccupancy(tables, cell, flags, change);
+}
+
+void setAreaReserved(AreaTables* tables, int cell, bool reserved) {
+	uint8_t flags = tables->occupancy[cell] & AREA_IMPASSABLE;
+	if (reserved) {
+		flags |= AREA_RESERVED;
+	}
+	setAreaOccupancy(tables, cell, flags, 0);
+}
+
+//clips the rectangle to the map, false if nothing is left of it
+bool clipAreaRect(const AreaTables* tables, int* x0, int* y0, int* x1, int* y1) {
+	*x0 = *x0 > 0 ? *x0 : 0;
+	*y0 = *y0 > 0 ? *y0 : 0;
+	*x1 = *x1 < tables->width ? *x1 : tables->width;
+	*y1 = *y1 < tables->height ? *y1 : tables->height;
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+bool areaEditInside(const AreaEdit& edit, int x0, int y0, int x1, int y1) {
+	return edit.x >= x0 && edit.x < x1 && edit.y >= y0 && edit.y < y1;
+}
+
+//total discomfort of the cells in the rectangle, the parts off the map count as nothing
+int64_t areaDiscomfortSum(AreaTables* tables, int x0, int y0, int x1, int y1) {
+	tables->stats.queries++;
+	if (!clipAreaRect(tables, &x0, &y0, &x1, &y1)) {
+		return 0;
+	}
+
+	const std::vector<int64_t>& sums = tables->discomfortSums;
+	int stride = tables->stride;
+	int64_t sum = sums[y1 * stride + x1] - sums[y0 * stride + x1] - sums[y1 * stride + x0] + sums[y0 * stride + x0];
+	for (const AreaEdit& edit : tables->pending) {
+		if (areaEditInside(edit, x0, y0, x1, y1)) {
+			sum += edit.discomfort;
+		}
+	}
+	return sum;
+}
+
+//how many cells in the rectangle are occupied, the parts off the map don't count
+int areaOccupiedCount(AreaTables* tables, int x0, int y0, int x1, int y1) {
+	tables->stats.queries++;
+	if (!clipAreaRect(tables, &x0, &y0, &x1, &y1)) {
+		return 0;
+	}
+
+	const std::vector<int32_t>& sums = tables->occupiedSums;
+	int stride = tables->stride;
+	int count = sums[y1 * stride + x1] - sums[y0 * stride + x1] - sums[y1 * stride + x0] + sums[y0 * stride + x0];
+	for (const AreaEdit& edit : tables->pending) {
+		if (areaEditInside(edit, x0, y0, x1, y1)) {
+			count += edit.occupied;
+		}
+	}
+	return count;
+}
+
+//true if the whole rectangle is on the map and nothing in it is occupied
+bool areaFree(AreaTables* tables, int x0, int y0, int x1, int y1) {
+	if (x0 < 0 || y0 < 0 || x1 > tables->width || y1 > tables->height || x0 >= x1 || y0 >= y1) {
+		return false;
+	}
+	return areaOccupiedCount(tables, x0, y0, x1, y1) == 0;
+}
@@ -0,0 +1,919 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
+
+#include "benchecs.h"
+
+// Headless benchmark scenarios, run with:
+//   RTS.exe -bench [-tanks N] [-map W H] [-ticks N] [-terrain amplitude] [-crowd] [-snapshot file] [-pathworkers N] [-ai team]
+// -crowd sends every tank to the middle of the map instead of to a random waypoint.
+// -pathworkers sets the path service's worker threads, 0 solves paths inline.
+// -ai hands a team to the computer opponent, its orders replace the random waypoints.
+// A scenario either spawns tanks with random waypoints over a fresh map, or starts
+// from a snapshot written by saveSnapshot so runs can be repeated from the same state.
+
+struct BenchmarkScenario {
+	int tankCount{ 1000 };
+	int flowMapWidth{ 300 };
+	int flowMapHeight{ 300 };
+	int ticks{ 100 };
+	float terrainAmplitude{ 0.0f };
+	bool crowd{ false };
+	const char* snapshotFile{ NULL };
+	int pathWorkers{ 2 };
+	int aiTeam{ -1 };
+};
+
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+double millisecondsSince(BenchmarkClock::time_point start) {
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+bool initBenchmarkScenario(Game* game, BenchmarkScenario scenario) {
+	game->settings.pathWorkerThreads = scenario.pathWorkers;
+	game->settings.aiTeam = scenario.aiTeam;
+
+	if (scenario.snapshotFile != NULL) {
+		return loadSnapshot(game, scenario.snapshotFile);
+	}
+
+	game->flowMapWidth = scenario.flowMapWidth;
+	game->flowMapHeight = scenario.flowMapHeight;
+	initFlowMap(game);
+	if (scenario.terrainAmplitude > 0.0f) {
+		generateMapTerrain(game, scenario.terrainAmplitude, 1);
+	}
+
+	float realMapWidth = game->flowCellSize * game->flowMapWidth;
+	float realMapHeight = game->flowCellSize * game->flowMapHeight;
+
+	srand(1);
+	for (int i = 0; i < scenario.tankCount; i++) {
+		float x = (float(rand()) / RAND_MAX - 0.5f) * realMapWidth;
+		float z = (float(rand()) / RAND_MAX - 0.5f) * realMapHeight;
+		IndexReference ref = addTank(game, x, 0.0f, z, 100);
+
+		Tank& tank = game->tanks[ref.index];
+		tank.team = i % 2;
+		tank.waypoint.point = glm::vec3((float(rand()) / RAND_MAX - 0.5f) * realMapWidth, 0.0f, (float(rand()) / RAND_MAX - 0.5f) * realMapHeight);
+		if (scenario.crowd) {
+			tank.waypoint.point = glm::vec3(0.0f);
+		}
+		tank.waypoint.set = true;
+	}
+
+	return true;
+}
+
+void benchmarkTicks(Game* game, int ticks) {
+	auto start = BenchmarkClock::now();
+	for (int i = 0; i < ticks; i++) {
+		tick(game);
+	}
+	double elapsed = millisecondsSince(start);
+
+	std::cout << "tick: " << ticks << " ticks, " << game->tanks.size() << " tanks, "
+		<< elapsed / ticks << " ms/tick" << std::endl;
+	std::cout << "  collision: " << game->collision.stats.lastUpdateMs << " ms, " << game->collision.stats.sweptPairs << " swept, "
+		<< game->collision.stats.candidatePairs << " candidate, " << game->collision.stats.overlappingPairs << " overlapping pairs (last tick)" << std::endl;
+	const MovementStats& movement = game->movement;
+	std::cout << "  movement: " << movement.moving << " moving, " << movement.replans << " replans (order "
+		<< movement.replansByReason[REPLAN_ORDER] << ", cell " << movement.replansByReason[REPLAN_CELL] << ", grid "
+		<< movement.replansByReason[REPLAN_GRID] << ", path " << movement.replansByReason[REPLAN_PATH] << ", stalled "
+		<< movement.replansByReason[REPLAN_STALLED] << ") last tick, "
+		<< (movement.totalMoving > 0 ? 100.0 * movement.totalReplans / movement.totalMoving : 0.0) << "% of moving tank ticks replanned" << std::endl;
+	std::cout << "  fog: " << game->fog.lastUpdateMs << " ms, " << game->fog.unitsRestamped << " tanks restamped (last tick)" << std::endl;
+	std::cout << "  particles: " << game->particles.stats.lastUpdateMs << " ms, " << game->particles.stats.live << " live, "
+		<< game->particles.stats.spawned << " spawned, " << game->particles.stats.dropped << " dropped over budget" << std::endl;
+	std::cout << "  ai: " << game->ai.stats.totalMs / game->ai.stats.ticks << " ms/tick, worst " << game->ai.stats.worstTickMs << " ms, "
+		<< game->influence.stats.refreshes << " influence refreshes of " << game->influence.width << "x" << game->influence.height << " ("
+		<< game->influence.stats.stepsLastTick << " rows/tick), " << game->influence.stats.unitsRestamped << " tanks restamped (last tick)";
+	if (game->settings.aiTeam >= 0) {
+		std::cout << ", " << game->ai.stats.decisions << " decisions, plan " << aiPlanName(game->ai.plan) << ", "
+			<< game->ai.stats.ordersIssued << " orders";
+	}
+	std::cout << std::endl;
+}
+
+bool anyTankWaitingForPath(Game* game) {
+	for (size_t i = 0; i < game->tankPaths.size(); i++) {
+		if (game->tankPaths[i].pending) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//orders every tank somewhere new in the same tick, then ticks until all of their paths are back
+void benchmarkPathBurst(Game* game, int workers, bool crowd) {
+	stopPathService(&game->pathService);
+	game->settings.pathWorkerThreads = workers;
+
+	float realMapWidth = game->flowCellSize * game->flowMapWidth;
+	float realMapHeight = game->flowCellSize * game->flowMapHeight;
+	game->tankPaths.resize(game->tanks.size());
+	srand(4);
+	for (int i = 0; i < game->tanks.size(); i++) {
+		Tank& tank = game->tanks[i];
+		tank.waypoint.point = glm::vec3((float(rand()) / RAND_MAX - 0.5f) * realMapWidth, 0.0f, (float(rand()) / RAND_MAX - 0.5f) * realMapHeight);
+		if (crowd) {
+			tank.waypoint.point = glm::vec3(0.0f);
+		}
+		tank.waypoint.set = !tank.index.deleted;
+		game->tankPaths[i].planned = false;
+	}
+
+	//first tick starts the workers, count from after that
+	PathServiceStats before = pathServiceStats(&game->pathService);
+	long long droppedBefore = game->pathService.droppedResults;
+
+	auto start = BenchmarkClock::now();
+	tick(game);
+	double firstTick = millisecondsSince(start);
+
+	int ticks = 1;
+	while (anyTankWaitingForPath(game) && ticks < 10000) {
+		tick(game);
+		ticks++;
+	}
+	double elapsed = millisecondsSince(start);
+
+	PathServiceStats after = pathServiceStats(&game->pathService);
+	long long started = after.started - before.started;
+	long long completed = after.completed - before.completed;
+
+	std::cout << "path burst, " << workers << " workers: order tick " << firstTick << " ms, all paths back after "
+		<< ticks << " ticks (" << elapsed << " ms)" << std::endl;
+	std::cout << "  " << after.submitted - before.submitted << " requests, " << after.deduplicated - before.deduplicated << " deduplicated, "
+		<< completed << " searches, " << completed * 1000.0 / elapsed << " searches/s, "
+		<< (started ? (after.queueMs - before.queueMs) / started : 0.0) << " ms average queue wait, "
+		<< (started ? (after.solveMs - before.solveMs) / started : 0.0) << " ms average solve, "
+		<< game->pathService.droppedResults - droppedBefore << " stale results dropped" << std::endl;
+}
+
+//rays from above the map towards random points on it, on a square heightmap of the given size
+void benchmarkTerrainPicking(int size, int rays) {
+	Terrain terrain;
+	initTerrain(&terrain, size, size, 2.0f);
+	generateTerrain(&terrain, 20.0f, 1);
+
+	float realSize = terrain.cellSize * size;
+	glm::vec3 cameraPos(0.0f, 100.0f, 0.0f);
+	std::vector<glm::vec3> directions(rays);
+	srand(2);
+	for (int i = 0; i < rays; i++) {
+		glm::vec3 target((float(rand()) / RAND_MAX - 0.5f) * realSize, 0.0f, (float(rand()) / RAND_MAX - 0.5f) * realSize);
+		directions[i] = glm::normalize(target - cameraPos);
+	}
+
+	int hits = 0;
+	auto start = BenchmarkClock::now();
+	for (int i = 0; i < rays; i++) {
+		glm::vec3 answer;
+		if (rayTerrainIntersection(&terrain, directions[i], cameraPos, &answer)) {
+			hits++;
+		}
+	}
+	double elapsed = millisecondsSince(start);
+
+	std::cout << "terrain picking " << size << "x" << size << ": " << elapsed * 1000.0 / rays << " us/ray, "
+		<< hits << "/" << rays << " hits" << std::endl;
+}
+
+enum BenchmarkPathCosts {
+	BENCHMARK_PATH_UNIFORM,   //no discomfort, every search is plain JPS
+	BENCHMARK_PATH_PATCHES,   //rectangles of even discomfort over about a quarter of the open ground
+	BENCHMARK_PATH_SCATTERED, //a quarter of the cells get random discomfort, nothing is uniform
+	BENCHMARK_PATH_TERRAIN    //discomfort from the slope of generated hills, as on a real map
+};
+
+const char* benchmarkPathCostsName(BenchmarkPathCosts costs) {
+	switch (costs) {
+	case BENCHMARK_PATH_PATCHES:
+		return "discomfort patches";
+	case BENCHMARK_PATH_SCATTERED:
+		return "scattered discomfort";
+	case BENCHMARK_PATH_TERRAIN:
+		return "terrain discomfort";
+	default:
+		return "uniform";
+	}
+}
+
+//square grid with random rectangular walls over about a fifth of it, with discomfort on
+//the rest of it as costs asks for
+void buildBenchmarkPathGrid(PathGrid* grid, int size, BenchmarkPathCosts costs) {
+	initPathGrid(grid, size, size);
+	srand(3);
+	int cellCount = size * size;
+	int blocked = 0;
+	while (blocked < cellCount / 5) {
+		int w = 1 + rand() % (size / 16 + 1);
+		int h = 1 + rand() % (size / 16 + 1);
+		int x0 = rand() % size;
+		int y0 = rand() % size;
+		for (int y = y0; y < y0 + h && y < size; y++) {
+			for (int x = x0; x < x0 + w && x < size; x++) {
+				if (grid->costs[y * size + x] != PATH_BLOCKED) {
+					setPathCellDiscomfort(grid, y * size + x, IMPASSABLE_DISCOMFORT);
+					blocked++;
+				}
+			}
+		}
+	}
+
+	if (costs == BENCHMARK_PATH_PATCHES) {
+		int weighted = 0;
+		while (weighted < cellCount / 5) {
+			int w = 1 + rand() % (size / 16 + 1);
+			int h = 1 + rand() % (size / 16 + 1);
+			int x0 = rand() % size;
+			int y0 = rand() % size;
+			int discomfort = 1 + rand() % 9;
+			for (int y = y0; y < y0 + h && y < size; y++) {
+				for (int x = x0; x < x0 + w && x < size; x++) {
+					if (grid->costs[y * size + x] == 0) {
+						setPathCellDiscomfort(grid, y * size + x, discomfort);
+						weighted++;
+					}
+				}
+			}
+		}
+	}
+	else if (costs == BENCHMARK_PATH_SCATTERED) {
+		for (int i = 0; i < cellCount; i++) {
+			if (grid->costs[i] != PATH_BLOCKED && rand() % 4 == 0) {
+				setPathCellDiscomfort(grid, i, 1 + rand() % 9);
+			}
+		}
+	}
+	else if (costs == BENCHMARK_PATH_TERRAIN) {
+		Terrain terrain;
+		initTerrain(&terrain, size, size, 2.0f);
+		generateTerrain(&terrain, 20.0f, 1);
+		for (int i = 0; i < cellCount; i++) {
+			if (grid->costs[i] != PATH_BLOCKED) {
+				setPathCellDiscomfort(grid, i, terrainSlopeDiscomfort(&terrain, i));
+			}
+		}
+	}
+}
+
+void benchmarkPathfinding(int size, int queries, BenchmarkPathCosts costs) {
+	PathGrid grid;
+	buildBenchmarkPathGrid(&grid, size, costs);
+
+	//only ask for routes that exist, a search for an unreachable cell floods the whole component
+	Connectivity connectivity;
+	std::vector<uint8_t> passable(grid.costs.size());
+	for (int i = 0; i < grid.costs.size(); i++) {
+		passable[i] = grid.costs[i] != PATH_BLOCKED;
+	}
+	buildConnectivity(&connectivity, size, size, passable);
+
+	std::vector<int> starts;
+	std::vector<int> goals;
+	while (starts.size() < queries) {
+		int start = rand() % (size * size);
+		int goal = rand() % (size * size);
+		if (start != goal && cellsConnected(&connectivity, start, goal)) {
+			starts.push_back(start);
+			goals.push_back(goal);
+		}
+	}
+
+	PathSearch search;
+	std::vector<int> cells;
+	//one query up front so the search arrays are grown before timing
+	findPath(&search, &grid, starts[0], goals[0], &cells);
+
+	long long expanded = 0;
+	int found = 0;
+	auto start = BenchmarkClock::now();
+	for (int i = 0; i < queries; i++) {
+		if (findPath(&search, &grid, starts[i], goals[i], &cells)) {
+			found++;
+		}
+		expanded += search.stats.expanded;
+	}
+	double elapsed = millisecondsSince(start);
+
+	std::cout << "pathfinding " << size << "x" << size << " " << benchmarkPathCostsName(costs) << ": "
+		<< queries * 1000.0 / elapsed << " queries/s, " << expanded / queries << " expanded/query, "
+		<< found << "/" << queries << " found" << std::endl;
+}
+
+// The connectivity index and the pathfinder have to agree on what is reachable, or
+// reachableWaypoint sends tanks at goals findPath can't get to. Scattered walls leave
+// plenty of one cell diagonal gaps, and half the checks come after incremental edits.
+void benchmarkConnectivityAgreement(int size, int queries, int edits) {
+	int cellCount = size * size;
+	PathGrid grid;
+	initPathGrid(&grid, size, size);
+	std::vector<uint8_t> passable(cellCount);
+	for (int i = 0; i < cellCount; i++) {
+		passable[i] = rand() % 100 >= 35;
+		setPathCellDiscomfort(&grid, i, passable[i] ? 0 : IMPASSABLE_DISCOMFORT);
+	}
+	Connectivity connectivity;
+	buildConnectivity(&connectivity, size, size, passable);
+
+	PathSearch search;
+	std::vector<int> cells;
+	int mismatches = 0;
+	int connected = 0;
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < queries; i++) {
+			int start = rand() % cellCount;
+			int goal = rand() % cellCount;
+			if (grid.costs[start] == PATH_BLOCKED || grid.costs[goal] == PATH_BLOCKED) {
+				continue;
+			}
+			bool reachable = cellsConnected(&connectivity, start, goal);
+			connected += reachable;
+			mismatches += reachable != findPath(&search, &grid, start, goal, &cells);
+		}
+
+		for (int i = 0; i < edits; i++) {
+			int cell = rand() % cellCount;
+			bool open = grid.costs[cell] == PATH_BLOCKED;
+			setPathCellDiscomfort(&grid, cell, open ? 0 : IMPASSABLE_DISCOMFORT);
+			setCellPassable(&connectivity, cell, open);
+		}
+	}
+
+	std::cout << "connectivity vs pathfinding " << size << "x" << size << ": " << connected << " connected pairs, "
+		<< mismatches << " mismatches" << std::endl;
+}
+
+void benchmarkSnapshot(Game* game, const char* filename, bool compress) {
+	auto start = BenchmarkClock::now();
+	bool saved = saveSnapshot(game, filename, compress);
+	double saveTime = millisecondsSince(start);
+
+	start = BenchmarkClock::now();
+	bool loaded = saved && loadSnapshot(game, filename);
+	double loadTime = millisecondsSince(start);
+
+	std::cout << "snapshot" << (compress ? " (lz4)" : "") << ": save " << saveTime << " ms, load " << loadTime << " ms"
+		<< (saved && loaded ? "" : " FAILED") << std::endl;
+
+	remove(filename);
+}
+
+//largest difference between a decoded frame and the game it was captured from, in world units
+float streamPositionError(Game* game, const StreamFrame* frame) {
+	float worst = 0.0f;
+	for (int i = 0; i < game->tanks.size(); i++) {
+		if (game->tanks[i].index.deleted) {
+			continue;
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			float error = fabsf(dequantiseStreamPosition(frame->units[i].position[axis]) - game->tanksData.positions[3 * i + axis]);
+			worst = std::max(worst, error);
+		}
+	}
+	return worst;
+}
+
+// Streams state to a loopback client while ticking. Acks come back ackDelay ticks late
+// and every dropEvery'th packet is lost (0 loses none), so baselines lag the way they
+// would over a network. Every frame the client rebuilds is checked against the frame
+// the server captured.
+void benchmarkStateStream(Game* game, int ticks, int ackDelay, int dropEvery) {
+	StreamEncoder encoder;
+	StreamDecoder decoder;
+	std::vector<uint8_t> packet;
+	std::deque<std::pair<int, uint32_t>> acks; //tick the ack arrives, sequence
+	int mismatches = 0;
+	int lost = 0;
+	float worstError = 0.0f;
+	double encodeMs = 0.0;
+	double decodeMs = 0.0;
+
+	for (int t = 0; t < ticks; t++) {
+		tick(game);
+
+		while (!acks.empty() && acks.front().first <= t) {
+			acknowledgeStreamFrame(&encoder, acks.front().second);
+			acks.pop_front();
+		}
+
+		auto start = BenchmarkClock::now();
+		const StreamFrame* sent = encodeStreamFrame(&encoder, game, &packet);
+		encodeMs += millisecondsSince(start);
+
+		if (dropEvery > 0 && t % dropEvery == dropEvery - 1) {
+			lost++;
+			continue;
+		}
+
+		start = BenchmarkClock::now();
+		const StreamFrame* received = decodeStreamFrame(&decoder, packet.data(), packet.size());
+		decodeMs += millisecondsSince(start);
+
+		if (received == NULL || !streamFramesEqual(sent, received)) {
+			mismatches++;
+			continue;
+		}
+		worstError = std::max(worstError, streamPositionError(game, received));
+		acks.push_back(std::make_pair(t + ackDelay, received->sequence));
+	}
+
+	double bytesPerTick = (double)encoder.stats.bytes / encoder.stats.packets;
+	double perThousand = game->tanks.empty() ? 0.0 : bytesPerTick * 1000.0 / game->tanks.size();
+	size_t rawBytes = game->tanks.size() * (3 + 1 + 1 + 4 + 2) * sizeof(float);
+
+	std::cout << "state stream (ack delay " << ackDelay << ", " << lost << " lost): " << bytesPerTick << " bytes/tick, "
+		<< perThousand << " bytes/tick per 1k units (raw TanksData " << rawBytes << "), "
+		<< encoder.stats.fullFrames << " full frames, "
+		<< (double)encoder.stats.unitsSent / encoder.stats.packets << " units sent/tick" << std::endl;
+	std::cout << "  encode " << encodeMs / ticks << " ms/tick, decode " << decodeMs / (ticks - lost) << " ms/tick, "
+		<< "worst position error " << worstError << ", " << mismatches << " mismatched frames" << std::endl;
+}
+
+struct BenchPosition { glm::vec3 value; };
+struct BenchVelocity { glm::vec3 value; };
+struct BenchHealth { int value; int regeneration; };
+struct BenchTeam { int value; };
+struct BenchWaypoint { glm::vec3 point; bool set; };
+
+//a unit laid out like Tank, hot and cold fields together
+struct BenchFatUnit {
+	glm::vec3 position;
+	glm::vec3 velocity;
+	int health;
+	int regeneration;
+	int team;
+	bool selected;
+	Waypoint waypoint;
+	glm::vec3 direction;
+	float padding[8];
+};
+
+//tanks and infantry move, buildings don't, every unit regenerates health
+void buildBenchmarkUnits(int units, EcsWorld* world, std::vector<BenchFatUnit>* fat) {
+	EcsMask tank = ecsMask<BenchPosition, BenchVelocity, BenchHealth, BenchTeam, BenchWaypoint>();
+	EcsMask infantry = ecsMask<BenchPosition, BenchVelocity, BenchHealth, BenchTeam>();
+	EcsMask building = ecsMask<BenchPosition, BenchHealth, BenchTeam>();
+	EcsMask types[] = { tank, infantry, tank, building };
+
+	srand(1);
+	for (int i = 0; i < units; i++) {
+		EcsMask type = types[i % 4];
+		EcsEntity entity = createEcsEntity(world, type);
+		glm::vec3 position(float(rand() % 600) - 300.0f, 0.0f, float(rand() % 600) - 300.0f);
+		glm::vec3 velocity = type == building ? glm::vec3(0.0f) : glm::vec3(0.1f, 0.0f, -0.05f);
+		getEcsComponent<BenchPosition>(world, entity)->value = position;
+		if (type != building) {
+			getEcsComponent<BenchVelocity>(world, entity)->value = velocity;
+		}
+		getEcsComponent<BenchHealth>(world, entity)->regeneration = 1;
+
+		if (fat != NULL) {
+			BenchFatUnit unit{};
+			unit.position = position;
+			unit.velocity = velocity;
+			unit.regeneration = 1;
+			fat->push_back(unit);
+		}
+	}
+}
+
+void gatherBenchmarkPositions(EcsWorld* world, std::vector<glm::vec3>* out) {
+	out->clear();
+	ecsEach<const BenchPosition>(world, [out](EcsEntity, const BenchPosition& p) { out->push_back(p.value); });
+}
+
+// Steps the same mixed units stored as fat structs, as an ECS on one thread and as an
+// ECS on worker threads. The move and regenerate systems touch different components so
+// they share a phase. The two ECS runs must end up with identical positions.
+void benchmarkEcs(int units, int steps, int workers) {
+	EcsWorld serial;
+	EcsWorld parallel;
+	std::vector<BenchFatUnit> fat;
+	buildBenchmarkUnits(units, &serial, &fat);
+	buildBenchmarkUnits(units, &parallel, NULL);
+
+	std::vector<EcsSystem> systems;
+	systems.push_back(makeEcsSystem<BenchPosition, const BenchVelocity>("move",
+		[](EcsEntity, BenchPosition& p, const BenchVelocity& v) { p.value += v.value; }));
+	systems.push_back(makeEcsSystem<BenchHealth>("regenerate",
+		[](EcsEntity, BenchHealth& h) { h.value = std::min(h.value + h.regeneration, 100); }));
+
+	auto start = BenchmarkClock::now();
+	for (int s = 0; s < steps; s++) {
+		for (BenchFatUnit& unit : fat) {
+			unit.position += unit.velocity;
+		}
+		for (BenchFatUnit& unit : fat) {
+			unit.health = std::min(unit.health + unit.regeneration, 100);
+		}
+	}
+	double fatMs = millisecondsSince(start);
+
+	start = BenchmarkClock::now();
+	for (int s = 0; s < steps; s++) {
+		runEcsSystems(&serial, systems, NULL);
+	}
+	double serialMs = millisecondsSince(start);
+
+	EcsJobs jobs;
+	startEcsJobs(&jobs, workers);
+	start = BenchmarkClock::now();
+	for (int s = 0; s < steps; s++) {
+		runEcsSystems(&parallel, systems, &jobs);
+	}
+	double parallelMs = millisecondsSince(start);
+	stopEcsJobs(&jobs);
+
+	std::vector<glm::vec3> serialPositions, parallelPositions;
+	gatherBenchmarkPositions(&serial, &serialPositions);
+	gatherBenchmarkPositions(&parallel, &parallelPositions);
+	bool consistent = serialPositions.size() == units && serialPositions == parallelPositions;
+
+	int chunks = 0;
+	for (EcsArchetype& archetype : serial.archetypes) {
+		chunks += (int)archetype.chunks.size();
+	}
+
+	double nsPerUnit = 1000000.0 / ((double)units * steps);
+	std::cout << "ecs: " << units << " units, " << serial.archetypes.size() << " archetypes, " << chunks << " chunks: "
+		<< "fat structs " << fatMs * nsPerUnit << " ns/unit, ecs " << serialMs * nsPerUnit << " ns/unit, "
+		<< workers << " workers " << parallelMs * nsPerUnit << " ns/unit"
+		<< (consistent ? "" : " FAILED") << std::endl;
+}
+
+// Keeps one dust pool full at count particles: every step updates it, compacts out the
+// dead and spawns replacements for them.
+void benchmarkParticles(int count, int steps) {
+	ParticleSystem particles;
+	ParticlePool* pool = &particles.pools[PARTICLE_DUST];
+	initParticlePool(pool, PARTICLE_DUST, count);
+	pool->spawnsLeft = count;
+	emitParticles(&particles, PARTICLE_DUST, 0.0f, 0.0f, 0.0f, count);
+
+	double updateMs = 0.0;
+	double compactMs = 0.0;
+	double spawnMs = 0.0;
+	long long retired = 0;
+	for (int s = 0; s < steps; s++) {
+		auto start = BenchmarkClock::now();
+		updateParticlePool(pool, PARTICLE_TICK_SECONDS);
+		updateMs += millisecondsSince(start);
+
+		start = BenchmarkClock::now();
+		int dead = compactParticlePool(pool);
+		compactMs += millisecondsSince(start);
+		retired += dead;
+
+		start = BenchmarkClock::now();
+		pool->spawnsLeft = dead;
+		emitParticles(&particles, PARTICLE_DUST, 0.0f, 0.0f, 0.0f, dead);
+		spawnMs += millisecondsSince(start);
+	}
+
+	double nsPerParticle = 1000000.0 / ((double)count * steps);
+	std::cout << "particles: " << count << " live, update " << updateMs * nsPerParticle << " ns/particle ("
+		<< updateMs / steps << " ms/step), compact " << compactMs * nsPerParticle << " ns/particle, "
+		<< retired / steps << " retired and respawned per step in " << spawnMs / steps << " ms" << std::endl;
+}
+
+// Placement ghost style queries: footprints of 2x2 to 16x16 cells at random, with a
+// cell edited every editEvery queries, answered by scanning the cells and by the area
+// tables. The two answers are compared for every query.
+void benchmarkAreaQueries(int size, int queries, int editEvery) {
+	AreaTables tables;
+	initAreaTables(&tables, size, size);
+	std::vector<int> discomfort(size * size);
+	std::vector<uint8_t> reserved(size * size, 0);
+	srand(5);
+	for (int i = 0; i < size * size; i++) {
+		discomfort[i] = rand() % 8 == 0 ? IMPASSABLE_DISCOMFORT : rand() % 10;
+		tables.discomfort[i] = discomfort[i];
+	}
+	buildAreaTables(&tables);
+
+	double scanMs = 0.0;
+	double tableMs = 0.0;
+	double editMs = 0.0; //including the rebuilds the edits set off
+	int edits = 0;
+	int mismatches = 0;
+	int free = 0;
+	for (int q = 0; q < queries; q++) {
+		if (editEvery > 0 && q % editEvery == 0) {
+			int cell = rand() % (size * size);
+			bool reserve = rand() % 2 == 0;
+			int value = rand() % (IMPASSABLE_DISCOMFORT + 1);
+
+			auto start = BenchmarkClock::now();
+			if (reserve) {
+				reserved[cell] = !reserved[cell];
+				setAreaReserved(&tables, cell, reserved[cell] != 0);
+			}
+			else {
+				discomfort[cell] = value;
+				setAreaDiscomfort(&tables, cell, value);
+			}
+			editMs += millisecondsSince(start);
+			edits++;
+		}
+
+		int w = 2 + rand() % 15;
+		int h = 2 + rand() % 15;
+		int x0 = rand() % (size - w);
+		int y0 = rand() % (size - h);
+
+		auto start = BenchmarkClock::now();
+		long long scanSum = 0;
+		int scanOccupied = 0;
+		for (int y = y0; y < y0 + h; y++) {
+			for (int x = x0; x < x0 + w; x++) {
+				int cell = y * size + x;
+				scanSum += discomfort[cell];
+				scanOccupied += (discomfort[cell] >= IMPASSABLE_DISCOMFORT || reserved[cell]) ? 1 : 0;
+			}
+		}
+		scanMs += millisecondsSince(start);
+
+		start = BenchmarkClock::now();
+		int64_t tableSum = areaDiscomfortSum(&tables, x0, y0, x0 + w, y0 + h);
+		bool tableFree = areaFree(&tables, x0, y0, x0 + w, y0 + h);
+		tableMs += millisecondsSince(start);
+
+		free += tableFree ? 1 : 0;
+		if (tableSum != scanSum || tableFree != (scanOccupied == 0)) {
+			mismatches++;
+		}
+	}
+
+	std::cout << "area queries: " << size << "x" << size << " map, " << queries << " queries, edit every " << editEvery
+		<< ": scan " << scanMs * 1000000.0 / queries << " ns/query, tables " << tableMs * 1000000.0 / queries << " ns/query, "
+		<< "edits " << (edits > 0 ? editMs * 1000.0 / edits : 0.0) << " us/edit with " << tables.stats.rebuilds << " rebuilds, " << free << " free, " << mismatches << " mismatches" << std::endl;
+}
+
+// The index math tickTank and the path following do per tank: the cell under the tank,
+// back to coords, the eight neighbours and the real position of the cell.
+template<typename Grid>
+int64_t gridIndexWork(const Grid* grid, const std::vector<GLfloat>& positions, int tanks, float shift) {
+	int64_t checksum = 0;
+	for (int i = 0; i < tanks; i++) {
+		int cell = gridRealToIndex(grid, positions[3 * i] + shift, positions[3 * i + 2] - shift);
+		if (cell == -1) {
+			continue;
+		}
+
+		int coords[2];
+		gridIndexToCoords(grid, cell, coords);
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				checksum += gridCoordsToIndex(grid, coords[0] + dx, coords[1] + dy);
+			}
+		}
+
+		float real[2];
+		gridIndexToReal(grid, cell, real);
+		checksum += (int64_t)(real[0] * 16.0f) + (int64_t)(real[1] * 16.0f);
+	}
+	return checksum;
+}
+
+//how the index math read Game before it went through a grid
+struct LegacyGrid {
+	const Game* game;
+};
+
+int gridRealToIndex(const LegacyGrid* legacy, float x, float y) {
+	const Game* game = legacy->game;
+	float realMapWidth = game->flowCellSize * game->flowMapWidth;
+	float realMapHeight = game->flowCellSize * game->flowMapHeight;
+	int xi = (x + realMapWidth / 2.0f) / game->flowCellSize;
+	int yi = (y + realMapHeight / 2.0f) / game->flowCellSize;
+	int index = game->flowMapWidth * yi + xi;
+	return index >= game->flowCells.size() || index < 0 ? -1 : index;
+}
+
+void gridIndexToCoords(const LegacyGrid* legacy, int index, int* coordsOut) {
+	coordsOut[0] = index % legacy->game->flowMapWidth;
+	coordsOut[1] = index / legacy->game->flowMapWidth;
+}
+
+int gridCoordsToIndex(const LegacyGrid* legacy, int x, int y) {
+	int index = legacy->game->flowMapWidth * y + x;
+	return index >= legacy->game->flowCells.size() || index < 0 ? -1 : index;
+}
+
+void gridIndexToReal(const LegacyGrid* legacy, int index, float* coordsOut) {
+	const Game* game = legacy->game;
+	float realMapWidth = game->flowCellSize * game->flowMapWidth;
+	float realMapHeight = game->flowCellSize * game->flowMapHeight;
+	coordsOut[0] = (float)(index % game->flowMapWidth) * game->flowCellSize - realMapWidth / 2.0f;
+	coordsOut[1] = (float)(index / game->flowMapWidth) * game->flowCellSize - realMapHeight / 2.0f;
+}
+
+template<typename Grid>
+double timeGridIndexWork(const Grid* grid, const std::vector<GLfloat>& positions, int tanks, int repeats, int64_t* checksumOut) {
+	auto start = BenchmarkClock::now();
+	int64_t checksum = 0;
+	for (int r = 0; r < repeats; r++) {
+		//moves the tanks a little each repeat, as ticks would, so the repeats can't be folded together
+		checksum += gridIndexWork(grid, positions, tanks, (float)(r % 16) * 0.125f);
+	}
+	*checksumOut = checksum;
+	return millisecondsSince(start) * 1000000.0 / ((double)tanks * repeats);
+}
+
+// The same per tank index math on the scenario's tank positions, through the old reads
+// of Game, the runtime grid Game now uses, and grids fixed at compile time: one the
+// size of the default 300x300 map and a power of two 512x512 one covering the same
+// area with half size cells.
+void benchmarkGridIndexMath(Game* game, int repeats) {
+	int tanks = (int)game->tanks.size();
+	LegacyGrid legacy{ game };
+	FixedGrid<300, 300, 2> fixed300;
+	FixedGrid<512, 512, 600, 512> fixed512;
+	RuntimeGrid runtime512;
+	initRuntimeGrid(&runtime512, 512, 512, 600.0f / 512.0f);
+
+	int64_t legacySum, runtimeSum, fixedSum, runtime512Sum, fixed512Sum;
+	double legacyNs = timeGridIndexWork(&legacy, game->tanksData.positions, tanks, repeats, &legacySum);
+	double runtimeNs = timeGridIndexWork(&game->grid, game->tanksData.positions, tanks, repeats, &runtimeSum);
+	double fixedNs = timeGridIndexWork(&fixed300, game->tanksData.positions, tanks, repeats, &fixedSum);
+	double runtime512Ns = timeGridIndexWork(&runtime512, game->tanksData.positions, tanks, repeats, &runtime512Sum);
+	double fixed512Ns = timeGridIndexWork(&fixed512, game->tanksData.positions, tanks, repeats, &fixed512Sum);
+
+	bool sameAnswers = legacySum == runtimeSum;
+	if (game->flowMapWidth == 300 && game->flowMapHeight == 300 && game->flowCellSize == 2.0f) {
+		sameAnswers = sameAnswers && legacySum == fixedSum;
+	}
+
+	std::cout << "grid index math: " << tanks << " tanks, ns/tank: legacy " << legacyNs << ", runtime " << runtimeNs
+		<< ", fixed 300x300 " << fixedNs << " | 512x512: runtime " << runtime512Ns << ", fixed " << fixed512Ns
+		<< (sameAnswers && runtime512Sum == fixed512Sum ? "" : " MISMATCH") << std::endl;
+}
+
+//a unit's transform built the way res/shaders/shader.vs builds it for every vertex
+glm::mat4 shaderUnitTransform(const TanksData& tanks, int i, bool turret, const glm::mat4& projectionViewModel, glm::vec3* lightOut) {
+	auto rotateY = [](float t) { return glm::mat4(cosf(t), 0.0f, sinf(t), 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, -sinf(t), 0.0f, cosf(t), 0.0f, 0.0f, 0.0f, 0.0f, 1.0f); };
+	auto rotateX = [](float t) { return glm::mat4(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, cosf(t), -sinf(t), 0.0f, 0.0f, sinf(t), cosf(t), 0.0f, 0.0f, 0.0f, 0.0f, 1.0f); };
+	auto rotateZ = [](float t) { return glm::mat4(cosf(t), sinf(t), 0.0f, 0.0f, -sinf(t), cosf(t), 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f); };
+
+	glm::mat4 translation(1.0f);
+	translation[3] = glm::vec4(tanks.positions[3 * i], tanks.positions[3 * i + 1], tanks.positions[3 * i + 2], 1.0f);
+	glm::mat4 rotation = rotateY(tanks.headings[i]);
+	if (turret) {
+		rotation = rotation * rotateY(tanks.turretDirections[i]);
+	}
+	rotation = rotation * rotateX(tanks.tilts[2 * i]) * rotateZ(tanks.tilts[2 * i + 1]) * rotateY((float)M_PI);
+
+	//what the shader dots the rotated normal with, as a direction in model space
+	glm::vec4 row2 = glm::vec4(rotation[0][2], rotation[1][2], rotation[2][2], 0.0f);
+	*lightOut = -glm::vec3(row2);
+	return projectionViewModel * translation * rotation;
+}
+
+// The per instance transforms for count tanks in random poses: built the way the shader
+// does (once per instance here, where the shader repeats it for every vertex), by the
+// scalar kernel and by the SSE2 kernel. The kernels are checked against the shader's
+// matrices, relative to the largest entry.
+void benchmarkUnitTransforms(int count, int frames) {
+	TanksData tanks;
+	srand(7);
+	for (int i = 0; i < count; i++) {
+		for (int k = 0; k < 3; k++) {
+			tanks.positions.push_back((float(rand()) / RAND_MAX - 0.5f) * 600.0f);
+		}
+		tanks.headings.push_back((float(rand()) / RAND_MAX - 0.5f) * 20.0f);
+		tanks.turretDirections.push_back((float(rand()) / RAND_MAX - 0.5f) * 6.0f);
+		tanks.tilts.push_back((float(rand()) / RAND_MAX - 0.5f) * 0.6f);
+		tanks.tilts.push_back((float(rand()) / RAND_MAX - 0.5f) * 0.6f);
+		for (int k = 0; k < 4; k++) {
+			tanks.tint.push_back(0.5f);
+		}
+	}
+
+	glm::mat4 projection = glm::perspective<float>(45.0f, 1.0f, 1.0, 10000.0);
+	glm::mat4 view = glm::translate(glm::rotate(glm::mat4(1.0f), (float)M_PI / 2.5f, glm::vec3(1.0f, 0.0f, 0.0f)), glm::vec3(0.0f, -100.0f, 0.0f));
+	glm::mat4 viewProjection = projection * view;
+
+	std::vector<glm::mat4> reference(2 * count);
+	std::vector<glm::vec3> referenceLights(2 * count);
+	auto start = BenchmarkClock::now();
+	for (int f = 0; f < frames; f++) {
+		for (int i = 0; i < count; i++) {
+			reference[2 * i] = shaderUnitTransform(tanks, i, false, viewProjection, &referenceLights[2 * i]);
+			reference[2 * i + 1] = shaderUnitTransform(tanks, i, true, viewProjection, &referenceLights[2 * i + 1]);
+		}
+	}
+	double shaderMs = millisecondsSince(start);
+
+	std::vector<UnitTransform> scalar(count);
+	start = BenchmarkClock::now();
+	for (int f = 0; f < frames; f++) {
+		for (int i = 0; i < count; i++) {
+			computeUnitTransform(tanks, i, glm::value_ptr(viewProjection), &scalar[i]);
+		}
+	}
+	double scalarMs = millisecondsSince(start);
+
+	std::vector<UnitTransform> batched;
+	start = BenchmarkClock::now();
+	for (int f = 0; f < frames; f++) {
+		computeUnitTransforms(tanks, glm::value_ptr(viewProjection), &batched);
+	}
+	double batchedMs = millisecondsSince(start);
+
+	float largest = 0.0f;
+	float worst = 0.0f;
+	for (int i = 0; i < count; i++) {
+		for (int part = 0; part < 2; part++) {
+			const float* expected = glm::value_ptr(reference[2 * i + part]);
+			const float* kernels[2] = { part ? scalar[i].turret : scalar[i].hull, part ? batched[i].turret : batched[i].hull };
+			const float* lights[2] = { part ? scalar[i].turretLight : scalar[i].hullLight, part ? batched[i].turretLight : batched[i].hullLight };
+			for (int k = 0; k < 2; k++) {
+				for (int e = 0; e < 16; e++) {
+					largest = fmaxf(largest, fabsf(expected[e]));
+					worst = fmaxf(worst, fabsf(kernels[k][e] - expected[e]));
+				}
+				for (int e = 0; e < 3; e++) {
+					worst = fmaxf(worst, fabsf(lights[k][e] - referenceLights[2 * i + part][e]));
+				}
+			}
+		}
+	}
+
+	double nsPerUnit = 1000000.0 / ((double)count * frames);
+	std::cout << "unit transforms: " << count << " units, shader style " << shaderMs * nsPerUnit << " ns/unit, scalar kernel "
+		<< scalarMs * nsPerUnit << " ns/unit, batched kernel " << batchedMs * nsPerUnit << " ns/unit ("
+		<< batchedMs / frames << " ms/frame), worst error " << worst / largest << " of the largest entry" << std::endl;
+}
+
+int runBenchmarks(int argc, char* argv[]) {
+	BenchmarkScenario scenario;
+
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-tanks") == 0 && i + 1 < argc) {
+			scenario.tankCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-map") == 0 && i + 2 < argc) {
+			scenario.flowMapWidth = atoi(argv[++i]);
+			scenario.flowMapHeight = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-ticks") == 0 && i + 1 < argc) {
+			scenario.ticks = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-terrain") == 0 && i + 1 < argc) {
+			scenario.terrainAmplitude = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-crowd") == 0) {
+			scenario.crowd = true;
+		}
+		else if (strcmp(argv[i], "-snapshot") == 0 && i + 1 < argc) {
+			scenario.snapshotFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "-pathworkers") == 0 && i + 1 < argc) {
+			scenario.pathWorkers = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-ai") == 0 && i + 1 < argc) {
+			scenario.aiTeam = atoi(argv[++i]);
+		}
+	}
+
+	Game game;
+	if (!initBenchmarkScenario(&game, scenario)) {
+		return -1;
+	}
+
+	std::cout << "scenario: " << game.tanks.size() << " tanks, " << game.flowMapWidth << "x" << game.flowMapHeight << " map" << std::endl;
+
+	benchmarkSnapshot(&game, "bench.snapshot", false);
+	benchmarkSnapshot(&game, "bench.snapshot", true);
+	benchmarkTicks(&game, scenario.ticks);
+	benchmarkGridIndexMath(&game, 1000);
+	benchmarkUnitTransforms(10000, 100);
+	benchmarkStateStream(&game, scenario.ticks, 0, 0);
+	benchmarkStateStream(&game, scenario.ticks, 3, 10);
+	benchmarkPathBurst(&game, 0, scenario.crowd);
+	benchmarkPathBurst(&game, scenario.pathWorkers, scenario.crowd);
+	benchmarkEcs(100000, 100, 3);
+	benchmarkParticles(1000000, 100);
+	benchmarkAreaQueries(300, 100000, 8);
+	benchmarkAreaQueries(2048, 100000, 8);
+	benchmarkTerrainPicking(512, 10000);
+	benchmarkTerrainPicking(4096, 10000);
+	benchmarkConnectivityAgreement(64, 2000, 500);
+	benchmarkPathfinding(300, 1000, BENCHMARK_PATH_UNIFORM);
+	benchmarkPathfinding(300, 1000, BENCHMARK_PATH_PATCHES);
+	benchmarkPathfinding(300, 1000, BENCHMARK_PATH_SCATTERED);
+	benchmarkPathfinding(300, 1000, BENCHMARK_PATH_TERRAIN);
+	benchmarkPathfinding(2048, 100, BENCHMARK_PATH_UNIFORM);
+	benchmarkPathfinding(2048, 100, BENCHMARK_PATH_PATCHES);
+	benchmarkPathfinding(2048, 100, BENCHMARK_PATH_SCATTERED);
+	benchmarkPathfinding(2048, 100, BENCHMARK_PATH_TERRAIN);
+
+	return 0;
+}
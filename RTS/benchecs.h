@@ -0,0 +1,541 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+// Archetype storage, measured by benchmarkEcs against a fat unit struct.
+//
+// This is benchmark code, not part of Game. Tanks stay in Tank/TanksData because
+// snapshots, state streaming, collision, fog, the path service and the renderer all
+// index them by slot. There is no second unit type to put in here yet. When one
+// arrives, this moves next to game.h's other modules.
+//
+// Every entity with the same set of components lives in the same archetype. An
+// archetype stores its entities in chunks of ECS_CHUNK_BYTES. Each component is an array
+// inside the chunk (structure of arrays) starting on an ECS_CHUNK_ALIGNMENT boundary,
+// so columns never share a cache line and can be loaded with aligned SIMD. Rows stay
+// packed: a removed entity is replaced by the archetype's last one. A query walks only
+// the chunks of archetypes that have every component it asks for. Iterating infantry
+// positions therefore never touches a building, and never loads a component the loop
+// doesn't use.
+//
+// Components are plain structs (trivially copyable). They get an id the first time
+// they are used, so the first use should happen on one thread, before any systems run.
+//
+// Systems are per-row functions over a component list, made with makeEcsSystem.
+// A const component is read and a non-const one is written. runEcsSystems puts systems
+// in phases: a system joins the current phase unless it writes something that a system
+// already in the phase touches, or touches something one of them writes. The chunks of
+// every system in a phase are shared out between the workers. Entities must not be
+// created, destroyed or change components while systems run.
+
+const size_t ECS_CHUNK_BYTES = 16 * 1024;
+const size_t ECS_CHUNK_ALIGNMENT = 64;
+const int ECS_MAX_COMPONENTS = 64;
+
+typedef uint64_t EcsMask;
+
+struct EcsEntity {
+	uint32_t index;
+	uint32_t generation;
+};
+
+struct EcsComponentInfo {
+	size_t size;
+	size_t alignment;
+};
+
+std::vector<EcsComponentInfo>& ecsComponentInfos() {
+	static std::vector<EcsComponentInfo> infos;
+	return infos;
+}
+
+template<typename T>
+int registerEcsComponent() {
+	static_assert(std::is_trivially_copyable<T>::value, "ECS components are copied as bytes");
+	std::vector<EcsComponentInfo>& infos = ecsComponentInfos();
+	if (infos.size() == ECS_MAX_COMPONENTS) {
+		std::cout << "ERROR: more than " << ECS_MAX_COMPONENTS << " ECS component types" << std::endl;
+		std::abort();
+	}
+	infos.push_back({ sizeof(T), alignof(T) });
+	return (int)infos.size() - 1;
+}
+
+template<typename T>
+int ecsComponentId() {
+	static int id = registerEcsComponent<T>();
+	return id;
+}
+
+//strips const first so a component read and written in different places has one id
+template<typename T>
+int ecsId() {
+	return ecsComponentId<typename std::remove_const<T>::type>();
+}
+
+template<typename... Ts>
+EcsMask ecsMask() {
+	EcsMask mask = 0;
+	int ids[] = { 0, ecsId<Ts>()... };
+	for (int i = 1; i < sizeof(ids) / sizeof(ids[0]); i++) {
+		mask |= (EcsMask)1 << ids[i];
+	}
+	return mask;
+}
+
+//the components out of Ts that are not const
+template<typename... Ts>
+EcsMask ecsWriteMask() {
+	EcsMask mask = 0;
+	int ids[] = { 0, ecsId<Ts>()... };
+	bool written[] = { false, !std::is_const<Ts>::value... };
+	for (int i = 1; i < sizeof(ids) / sizeof(ids[0]); i++) {
+		if (written[i]) {
+			mask |= (EcsMask)1 << ids[i];
+		}
+	}
+	return mask;
+}
+
+struct EcsChunk {
+	std::unique_ptr<uint8_t[]> storage;
+	uint8_t* data;   //storage rounded up to ECS_CHUNK_ALIGNMENT
+	int count{ 0 };
+
+	EcsEntity* entities() {
+		return (EcsEntity*)data;
+	}
+};
+
+struct EcsArchetype {
+	EcsMask mask;
+	std::vector<int> components;
+	size_t offsets[ECS_MAX_COMPONENTS]; //by component id, only those in mask are meaningful
+	int capacity;
+	std::vector<std::unique_ptr<EcsChunk>> chunks; //every chunk but the last is full
+};
+
+struct EcsRecord {
+	int archetype{ -1 };
+	int chunk;
+	int row;
+	uint32_t generation{ 0 };
+	bool alive{ false };
+};
+
+struct EcsWorld {
+	std::vector<EcsArchetype> archetypes;
+	std::unordered_map<EcsMask, int> archetypeByMask;
+	std::vector<EcsRecord> records;
+	std::vector<uint32_t> freeRecords;
+};
+
+size_t alignEcsOffset(size_t offset, size_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+//lays out a chunk of capacity rows, returns its size in bytes
+size_t layoutEcsChunk(EcsArchetype* archetype, int capacity) {
+	std::vector<EcsComponentInfo>& infos = ecsComponentInfos();
+	size_t offset = capacity * sizeof(EcsEntity);
+	for (int id : archetype->components) {
+		offset = alignEcsOffset(offset, std::max(infos[id].alignment, ECS_CHUNK_ALIGNMENT));
+		archetype->offsets[id] = offset;
+		offset += capacity * infos[id].size;
+	}
+	return offset;
+}
+
+int findOrCreateEcsArchetype(EcsWorld* world, EcsMask mask) {
+	auto it = world->archetypeByMask.find(mask);
+	if (it != world->archetypeByMask.end()) {
+		return it->second;
+	}
+
+	EcsArchetype archetype;
+	archetype.mask = mask;
+	size_t rowBytes = sizeof(EcsEntity);
+	for (int id = 0; id < ECS_MAX_COMPONENTS; id++) {
+		if (mask & ((EcsMask)1 << id)) {
+			archetype.components.push_back(id);
+			rowBytes += ecsComponentInfos()[id].size;
+		}
+	}
+
+	//start from the unpadded estimate and back off until alignment padding fits too
+	archetype.capacity = (int)std::max<size_t>(1, ECS_CHUNK_BYTES / rowBytes);
+	while (archetype.capacity > 1 && layoutEcsChunk(&archetype, archetype.capacity) > ECS_CHUNK_BYTES) {
+		archetype.capacity--;
+	}
+	layoutEcsChunk(&archetype, archetype.capacity);
+
+	world->archetypes.push_back(std::move(archetype));
+	int index = (int)world->archetypes.size() - 1;
+	world->archetypeByMask[mask] = index;
+	return index;
+}
+
+void* ecsComponentAt(EcsArchetype* archetype, EcsChunk* chunk, int id, int row) {
+	return chunk->data + archetype->offsets[id] + row * ecsComponentInfos()[id].size;
+}
+
+//appends a zeroed row to the archetype, returns its chunk and row
+void allocateEcsRow(EcsArchetype* archetype, EcsEntity entity, int* chunkOut, int* rowOut) {
+	if (archetype->chunks.empty() || archetype->chunks.back()->count == archetype->capacity) {
+		std::unique_ptr<EcsChunk> chunk(new EcsChunk());
+		chunk->storage.reset(new uint8_t[ECS_CHUNK_BYTES + ECS_CHUNK_ALIGNMENT]);
+		chunk->data = (uint8_t*)alignEcsOffset((size_t)chunk->storage.get(), ECS_CHUNK_ALIGNMENT);
+		archetype->chunks.push_back(std::move(chunk));
+	}
+
+	EcsChunk* chunk = archetype->chunks.back().get();
+	int row = chunk->count++;
+	chunk->entities()[row] = entity;
+	for (int id : archetype->components) {
+		memset(ecsComponentAt(archetype, chunk, id, row), 0, ecsComponentInfos()[id].size);
+	}
+
+	*chunkOut = (int)archetype->chunks.size() - 1;
+	*rowOut = row;
+}
+
+//fills the hole at (chunk, row) with the archetype's last row, keeping the chunks packed
+void removeEcsRow(EcsWorld* world, EcsArchetype* archetype, int chunkIndex, int row) {
+	int lastChunkIndex = (int)archetype->chunks.size() - 1;
+	EcsChunk* lastChunk = archetype->chunks[lastChunkIndex].get();
+	int lastRow = lastChunk->count - 1;
+
+	if (chunkIndex != lastChunkIndex || row != lastRow) {
+		EcsChunk* chunk = archetype->chunks[chunkIndex].get();
+		EcsEntity moved = lastChunk->entities()[lastRow];
+		chunk->entities()[row] = moved;
+		for (int id : archetype->components) {
+			memcpy(ecsComponentAt(archetype, chunk, id, row), ecsComponentAt(archetype, lastChunk, id, lastRow), ecsComponentInfos()[id].size);
+		}
+		world->records[moved.index].chunk = chunkIndex;
+		world->records[moved.index].row = row;
+	}
+
+	lastChunk->count--;
+	if (lastChunk->count == 0) {
+		archetype->chunks.pop_back();
+	}
+}
+
+bool validEcsEntity(EcsWorld* world, EcsEntity entity) {
+	return entity.index < world->records.size() && world->records[entity.index].alive &&
+		world->records[entity.index].generation == entity.generation;
+}
+
+//creates an entity with every component in mask, zeroed
+EcsEntity createEcsEntity(EcsWorld* world, EcsMask mask) {
+	uint32_t index;
+	if (!world->freeRecords.empty()) {
+		index = world->freeRecords.back();
+		world->freeRecords.pop_back();
+	}
+	else {
+		index = (uint32_t)world->records.size();
+		world->records.push_back(EcsRecord());
+	}
+
+	EcsRecord& record = world->records[index];
+	record.generation++;
+	record.alive = true;
+	record.archetype = findOrCreateEcsArchetype(world, mask);
+
+	EcsEntity entity{ index, record.generation };
+	allocateEcsRow(&world->archetypes[record.archetype], entity, &record.chunk, &record.row);
+	return entity;
+}
+
+void destroyEcsEntity(EcsWorld* world, EcsEntity entity) {
+	if (!validEcsEntity(world, entity)) {
+		return;
+	}
+
+	EcsRecord& record = world->records[entity.index];
+	removeEcsRow(world, &world->archetypes[record.archetype], record.chunk, record.row);
+	record.alive = false;
+	record.archetype = -1;
+	world->freeRecords.push_back(entity.index);
+}
+
+//moves an entity to the archetype for mask, keeping the components both have
+void setEcsEntityMask(EcsWorld* world, EcsEntity entity, EcsMask mask) {
+	if (!validEcsEntity(world, entity) || world->archetypes[world->records[entity.index].archetype].mask == mask) {
+		return;
+	}
+
+	//find the target first, creating it can move the archetypes vector
+	int target = findOrCreateEcsArchetype(world, mask);
+	EcsRecord& record = world->records[entity.index];
+	EcsArchetype* from = &world->archetypes[record.archetype];
+	EcsArchetype* to = &world->archetypes[target];
+
+	int chunk, row;
+	allocateEcsRow(to, entity, &chunk, &row);
+	for (int id : to->components) {
+		if (from->mask & ((EcsMask)1 << id)) {
+			memcpy(ecsComponentAt(to, to->chunks[chunk].get(), id, row),
+				ecsComponentAt(from, from->chunks[record.chunk].get(), id, record.row), ecsComponentInfos()[id].size);
+		}
+	}
+
+	removeEcsRow(world, from, record.chunk, record.row);
+	record.archetype = target;
+	record.chunk = chunk;
+	record.row = row;
+}
+
+//NULL if the entity is gone or doesn't have a T
+template<typename T>
+T* getEcsComponent(EcsWorld* world, EcsEntity entity) {
+	if (!validEcsEntity(world, entity)) {
+		return NULL;
+	}
+
+	EcsRecord& record = world->records[entity.index];
+	EcsArchetype* archetype = &world->archetypes[record.archetype];
+	int id = ecsId<T>();
+	if (!(archetype->mask & ((EcsMask)1 << id))) {
+		return NULL;
+	}
+	return (T*)ecsComponentAt(archetype, archetype->chunks[record.chunk].get(), id, record.row);
+}
+
+template<typename T>
+void addEcsComponent(EcsWorld* world, EcsEntity entity, const T& value) {
+	if (!validEcsEntity(world, entity)) {
+		return;
+	}
+	setEcsEntityMask(world, entity, world->archetypes[world->records[entity.index].archetype].mask | ecsMask<T>());
+	*getEcsComponent<T>(world, entity) = value;
+}
+
+template<typename T>
+void removeEcsComponent(EcsWorld* world, EcsEntity entity) {
+	if (!validEcsEntity(world, entity)) {
+		return;
+	}
+	setEcsEntityMask(world, entity, world->archetypes[world->records[entity.index].archetype].mask & ~ecsMask<T>());
+}
+
+// Queries
+
+template<typename T>
+T* ecsColumn(EcsArchetype* archetype, EcsChunk* chunk) {
+	return (T*)(chunk->data + archetype->offsets[ecsId<T>()]);
+}
+
+template<typename... Ts, typename F>
+void ecsEachRow(int count, const EcsEntity* entities, F& fn, Ts*... columns) {
+	for (int row = 0; row < count; row++) {
+		fn(entities[row], columns[row]...);
+	}
+}
+
+template<typename... Ts, typename F>
+void ecsEachInChunk(EcsArchetype* archetype, EcsChunk* chunk, F& fn) {
+	ecsEachRow<Ts...>(chunk->count, chunk->entities(), fn, ecsColumn<Ts>(archetype, chunk)...);
+}
+
+//calls fn(EcsEntity, Ts&...) for every entity with all of Ts
+template<typename... Ts, typename F>
+void ecsEach(EcsWorld* world, F fn) {
+	EcsMask mask = ecsMask<Ts...>();
+	for (EcsArchetype& archetype : world->archetypes) {
+		if ((archetype.mask & mask) != mask) {
+			continue;
+		}
+		for (auto& chunk : archetype.chunks) {
+			ecsEachInChunk<Ts...>(&archetype, chunk.get(), fn);
+		}
+	}
+}
+
+int ecsCount(EcsWorld* world, EcsMask mask) {
+	int count = 0;
+	for (EcsArchetype& archetype : world->archetypes) {
+		if ((archetype.mask & mask) == mask) {
+			for (auto& chunk : archetype.chunks) {
+				count += chunk->count;
+			}
+		}
+	}
+	return count;
+}
+
+// Systems
+
+struct EcsSystem {
+	const char* name;
+	EcsMask required; //every component the system touches
+	EcsMask writes;
+	std::function<void(EcsArchetype*, EcsChunk*)> runChunk;
+};
+
+//fn(EcsEntity, Ts&...) may run for different chunks on different threads at once
+template<typename... Ts, typename F>
+EcsSystem makeEcsSystem(const char* name, F fn) {
+	EcsSystem system;
+	system.name = name;
+	system.required = ecsMask<Ts...>();
+	system.writes = ecsWriteMask<Ts...>();
+	system.runChunk = [fn](EcsArchetype* archetype, EcsChunk* chunk) {
+		F local = fn;
+		ecsEachInChunk<Ts...>(archetype, chunk, local);
+	};
+	return system;
+}
+
+bool ecsSystemsConflict(const EcsSystem& a, const EcsSystem& b) {
+	return (a.writes & b.required) != 0 || (b.writes & a.required) != 0;
+}
+
+//splits systems, in order, into phases of systems that can run at the same time
+std::vector<std::vector<int>> buildEcsSchedule(const std::vector<EcsSystem>& systems) {
+	std::vector<std::vector<int>> phases;
+	for (int i = 0; i < systems.size(); i++) {
+		bool fits = !phases.empty();
+		for (int j : (phases.empty() ? std::vector<int>() : phases.back())) {
+			if (ecsSystemsConflict(systems[i], systems[j])) {
+				fits = false;
+				break;
+			}
+		}
+		if (!fits) {
+			phases.push_back(std::vector<int>());
+		}
+		phases.back().push_back(i);
+	}
+	return phases;
+}
+
+struct EcsWorkItem {
+	const EcsSystem* system;
+	EcsArchetype* archetype;
+	EcsChunk* chunk;
+};
+
+// Worker threads that share out the chunks of a phase, the calling thread works too.
+struct EcsJobs;
+void stopEcsJobs(EcsJobs* jobs);
+
+struct EcsJobs {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool stopping{ false };
+	uint64_t batch{ 0 };
+	int busy{ 0 };  //workers inside a batch, items is only changed while this is 0
+	std::vector<EcsWorkItem> items;
+	std::atomic<int> next{ 0 };
+
+	~EcsJobs() {
+		stopEcsJobs(this);
+	}
+};
+
+void drainEcsJobs(EcsJobs* jobs) {
+	int count = (int)jobs->items.size();
+	for (int i = jobs->next.fetch_add(1); i < count; i = jobs->next.fetch_add(1)) {
+		const EcsWorkItem& item = jobs->items[i];
+		item.system->runChunk(item.archetype, item.chunk);
+	}
+}
+
+void ecsWorker(EcsJobs* jobs) {
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(jobs->mutex);
+	while (true) {
+		jobs->wake.wait(lock, [&] { return jobs->stopping || jobs->batch != seen; });
+		if (jobs->stopping) {
+			return;
+		}
+		seen = jobs->batch;
+		jobs->busy++;
+		lock.unlock();
+
+		drainEcsJobs(jobs);
+
+		lock.lock();
+		if (--jobs->busy == 0) {
+			jobs->done.notify_all();
+		}
+	}
+}
+
+void startEcsJobs(EcsJobs* jobs, int workerCount) {
+	jobs->stopping = false;
+	for (int i = 0; i < workerCount; i++) {
+		jobs->workers.push_back(std::thread(ecsWorker, jobs));
+	}
+}
+
+void stopEcsJobs(EcsJobs* jobs) {
+	{
+		std::lock_guard<std::mutex> lock(jobs->mutex);
+		jobs->stopping = true;
+	}
+	jobs->wake.notify_all();
+	for (size_t i = 0; i < jobs->workers.size(); i++) {
+		jobs->workers[i].join();
+	}
+	jobs->workers.clear();
+}
+
+//jobs may be NULL to run everything on the calling thread
+void runEcsSystems(EcsWorld* world, const std::vector<EcsSystem>& systems, EcsJobs* jobs) {
+	std::vector<std::vector<int>> phases = buildEcsSchedule(systems);
+
+	for (const std::vector<int>& phase : phases) {
+		std::vector<EcsWorkItem> items;
+		for (int s : phase) {
+			const EcsSystem& system = systems[s];
+			for (EcsArchetype& archetype : world->archetypes) {
+				if ((archetype.mask & system.required) != system.required) {
+					continue;
+				}
+				for (auto& chunk : archetype.chunks) {
+					items.push_back({ &system, &archetype, chunk.get() });
+				}
+			}
+		}
+
+		if (jobs == NULL || jobs->workers.empty()) {
+			for (const EcsWorkItem& item : items) {
+				item.system->runChunk(item.archetype, item.chunk);
+			}
+			continue;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(jobs->mutex);
+			//a worker can still be finding out the last batch was already drained
+			jobs->done.wait(lock, [jobs] { return jobs->busy == 0; });
+			jobs->items.swap(items);
+			jobs->next = 0;
+			jobs->batch++;
+		}
+		jobs->wake.notify_all();
+
+		drainEcsJobs(jobs);
+
+		std::unique_lock<std::mutex> lock(jobs->mutex);
+		jobs->done.wait(lock, [jobs] { return jobs->busy == 0; });
+	}
+}
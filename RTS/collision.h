@@ -0,0 +1,217 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Tank vs tank collision, every tank is a circle of the same radius on the x/z plane.
+//
+// Broadphase is sort and sweep along x, inside bands of z one diameter tall so a crowd
+// spread along z doesn't all land in the same sweep. Units are sorted by (band, x); the
+// order is kept from the last tick and fixed up with an insertion sort, which is close
+// to linear because tanks only move a little between ticks. New units are appended to
+// the end and sorted in with the rest; when there's no order to keep (the first tick,
+// units gone, or more than COLLISION_APPEND_LIMIT new ones at once) it's built from
+// scratch with a full sort instead. Each unit is swept against the rest of its band and
+// the overlapping x window of the band above it.
+//
+// Narrowphase pushes overlapping pairs apart by half the penetration each, repeated for
+// COLLISION_ITERATIONS over the pairs found this tick.
+
+const int COLLISION_ITERATIONS = 4;
+const int COLLISION_INACTIVE_BAND = 0x7fffffff;
+const int COLLISION_APPEND_LIMIT = 64; //more new units than this at once and the order is rebuilt
+
+struct CollisionStats {
+	int sweptPairs{ 0 };      //pairs whose x extents overlapped in neighbouring bands
+	int candidatePairs{ 0 };  //...and whose z extents did too
+	int overlappingPairs{ 0 };
+	double lastUpdateMs{ 0.0 };
+};
+
+struct Collision {
+	std::vector<uint8_t> active; //filled in by the caller, inactive units are ignored
+	std::vector<int> order;      //unit indices sorted by (band, x), kept between ticks, clear it when the units are replaced
+
+	//scratch, in sorted order
+	std::vector<int> bands;
+	std::vector<float> xs;
+	std::vector<float> zs;
+	std::vector<int> pairs;      //pairs of slots into xs/zs
+
+	CollisionStats stats;
+};
+
+bool collisionSlotBefore(int bandA, float xA, int bandB, float xB) {
+	return bandA < bandB || (bandA == bandB && xA < xB);
+}
+
+//copies each unit's band and position into its slot in order
+void fillCollisionSlots(Collision* col, const float* positions, int count, float bandHeight) {
+	for (int k = 0; k < count; k++) {
+		int unit = col->order[k];
+		col->xs[k] = positions[3 * unit];
+		col->zs[k] = positions[3 * unit + 2];
+		col->bands[k] = col->active[unit] ? (int)floor(col->zs[k] / bandHeight) : COLLISION_INACTIVE_BAND;
+	}
+}
+
+//brings order back into (band, x) order, inactive units sort to the end
+void sortCollisionOrder(Collision* col, const float* positions, int count, float bandHeight) {
+	bool rebuild = col->order.size() > count || count - (int)col->order.size() > COLLISION_APPEND_LIMIT;
+	if (rebuild) {
+		col->order.clear();
+	}
+	for (int i = col->order.size(); i < count; i++) {
+		col->order.push_back(i);
+	}
+
+	col->bands.resize(count);
+	col->xs.resize(count);
+	col->zs.resize(count);
+	fillCollisionSlots(col, positions, count, bandHeight);
+
+	if (rebuild) {
+		//order is still index order here, so the slots double as per unit keys
+		const int* bands = col->bands.data();
+		const float* xs = col->xs.data();
+		std::sort(col->order.begin(), col->order.end(), [bands, xs](int a, int b) {
+			return collisionSlotBefore(bands[a], xs[a], bands[b], xs[b]);
+		});
+		fillCollisionSlots(col, positions, count, bandHeight);
+		return;
+	}
+
+	for (int k = 1; k < count; k++) {
+		int band = col->bands[k];
+		float x = col->xs[k];
+		float z = col->zs[k];
+		int unit = col->order[k];
+		int j = k - 1;
+		while (j >= 0 && collisionSlotBefore(band, x, col->bands[j], col->xs[j])) {
+			col->bands[j + 1] = col->bands[j];
+			col->xs[j + 1] = col->xs[j];
+			col->zs[j + 1] = col->zs[j];
+			col->order[j + 1] = col->order[j];
+			j--;
+		}
+		col->bands[j + 1] = band;
+		col->xs[j + 1] = x;
+		col->zs[j + 1] = z;
+		col->order[j + 1] = unit;
+	}
+}
+
+void testCollisionPair(Collision* col, int a, int b, float diameter) {
+	col->stats.sweptPairs++;
+	float dz = col->zs[b] - col->zs[a];
+	if (dz > diameter || dz < -diameter) {
+		return;
+	}
+
+	col->stats.candidatePairs++;
+	float dx = col->xs[b] - col->xs[a];
+	if (dx * dx + dz * dz < diameter * diameter) {
+		col->pairs.push_back(a);
+		col->pairs.push_back(b);
+	}
+}
+
+void sweepCollisionPairs(Collision* col, int count, float radius) {
+	float diameter = 2.0f * radius;
+	const int* bands = col->bands.data();
+	const float* xs = col->xs.data();
+
+	col->pairs.clear();
+	col->stats.sweptPairs = 0;
+	col->stats.candidatePairs = 0;
+
+	int bandStart = 0;
+	while (bandStart < count && bands[bandStart] != COLLISION_INACTIVE_BAND) {
+		int band = bands[bandStart];
+		int bandEnd = bandStart;
+		while (bandEnd < count && bands[bandEnd] == band) {
+			bandEnd++;
+		}
+
+		//the band above, if it is directly above
+		int nextStart = bandEnd;
+		int nextEnd = bandEnd;
+		if (nextStart < count && bands[nextStart] == band + 1) {
+			while (nextEnd < count && bands[nextEnd] == band + 1) {
+				nextEnd++;
+			}
+		}
+
+		int windowStart = nextStart;
+		for (int a = bandStart; a < bandEnd; a++) {
+			for (int b = a + 1; b < bandEnd && xs[b] <= xs[a] + diameter; b++) {
+				testCollisionPair(col, a, b, diameter);
+			}
+
+			//xs[a] only grows, so the start of the window in the band above only moves forwards
+			while (windowStart < nextEnd && xs[windowStart] < xs[a] - diameter) {
+				windowStart++;
+			}
+			for (int b = windowStart; b < nextEnd && xs[b] <= xs[a] + diameter; b++) {
+				testCollisionPair(col, a, b, diameter);
+			}
+		}
+
+		bandStart = bandEnd;
+	}
+
+	col->stats.overlappingPairs = (int)col->pairs.size() / 2;
+}
+
+void relaxCollisionPairs(Collision* col, float radius) {
+	float diameter = 2.0f * radius;
+	float* xs = col->xs.data();
+	float* zs = col->zs.data();
+
+	for (int iteration = 0; iteration < COLLISION_ITERATIONS; iteration++) {
+		for (size_t p = 0; p < col->pairs.size(); p += 2) {
+			int a = col->pairs[p];
+			int b = col->pairs[p + 1];
+			float dx = xs[b] - xs[a];
+			float dz = zs[b] - zs[a];
+			float distanceSquared = dx * dx + dz * dz;
+			if (distanceSquared >= diameter * diameter) {
+				continue;
+			}
+
+			float distance = sqrt(distanceSquared);
+			float nx = 1.0f;
+			float nz = 0.0f;
+			if (distance > 1e-6f) {
+				nx = dx / distance;
+				nz = dz / distance;
+			}
+
+			float push = (diameter - distance) * 0.5f;
+			xs[a] -= nx * push;
+			zs[a] -= nz * push;
+			xs[b] += nx * push;
+			zs[b] += nz * push;
+		}
+	}
+}
+
+//positions is x, y, z per unit
+void resolveCollisions(Collision* col, float* positions, int count, float radius) {
+	sortCollisionOrder(col, positions, count, 2.0f * radius);
+	sweepCollisionPairs(col, count, radius);
+
+	if (col->pairs.empty()) {
+		return;
+	}
+
+	relaxCollisionPairs(col, radius);
+
+	for (int k = 0; k < count && col->bands[k] != COLLISION_INACTIVE_BAND; k++) {
+		int unit = col->order[k];
+		positions[3 * unit] = col->xs[k];
+		positions[3 * unit + 2] = col->zs[k];
+	}
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Connected components of the passable flowCells, as the pathfinder moves between them.
+//
+// The pathfinder only steps diagonally when both cells it would cut past are passable,
+// and then the diagonal cell is already reachable through either of them, so its
+// components are exactly the 4-connected ones. Joining diagonals here as well would
+// call two sides of a one cell diagonal wall connected when no path crosses it.
+//
+// Built with a union-find pass over the grid. Opening a cell just unions it with its
+// passable neighbours; blocking one can split its component, so only that component is
+// flooded again from the blocked cell's neighbours. Parents are kept pointing (almost)
+// straight at their root so "can a unit in cell a reach cell b" is a couple of loads.
+
+const int IMPASSABLE_DISCOMFORT = 20;
+const int NO_COMPONENT = -1;
+
+struct Connectivity {
+	int width{ 0 };
+	int height{ 0 };
+	std::vector<uint8_t> passable;
+	std::vector<int> parent;
+	std::vector<int> componentSizes; //only meaningful at roots
+
+	//generation stamps for the re-flood after a cell is blocked, so they never need clearing
+	std::vector<uint32_t> visited;
+	uint32_t visitGeneration{ 0 };
+	std::vector<int> floodQueue;
+};
+
+int findComponent(Connectivity* conn, int cell) {
+	if (cell < 0 || !conn->passable[cell]) {
+		return NO_COMPONENT;
+	}
+
+	//path halving
+	while (conn->parent[cell] != cell) {
+		conn->parent[cell] = conn->parent[conn->parent[cell]];
+		cell = conn->parent[cell];
+	}
+	return cell;
+}
+
+void unionComponents(Connectivity* conn, int a, int b) {
+	int rootA = findComponent(conn, a);
+	int rootB = findComponent(conn, b);
+	if (rootA == rootB || rootA == NO_COMPONENT || rootB == NO_COMPONENT) {
+		return;
+	}
+
+	if (conn->componentSizes[rootA] < conn->componentSizes[rootB]) {
+		int tmp = rootA;
+		rootA = rootB;
+		rootB = tmp;
+	}
+	conn->parent[rootB] = rootA;
+	conn->componentSizes[rootA] += conn->componentSizes[rootB];
+}
+
+//fills neighboursOut with the in-bounds 4-connected neighbours of cell, returns how many
+int connectivityNeighbours(const Connectivity* conn, int cell, int* neighboursOut) {
+	int x = cell % conn->width;
+	int y = cell / conn->width;
+	int count = 0;
+	if (x > 0) {
+		neighboursOut[count++] = cell - 1;
+	}
+	if (x < conn->width - 1) {
+		neighboursOut[count++] = cell + 1;
+	}
+	if (y > 0) {
+		neighboursOut[count++] = cell - conn->width;
+	}
+	if (y < conn->height - 1) {
+		neighboursOut[count++] = cell + conn->width;
+	}
+	return count;
+}
+
+//full labelling pass, passable has one entry per cell
+void buildConnectivity(Connectivity* conn, int width, int height, const std::vector<uint8_t>& passable) {
+	int cellCount = width * height;
+	conn->width = width;
+	conn->height = height;
+	conn->passable = passable;
+	conn->parent.resize(cellCount);
+	conn->componentSizes.assign(cellCount, 1);
+	conn->visited.assign(cellCount, 0);
+	conn->visitGeneration = 0;
+
+	for (int i = 0; i < cellCount; i++) {
+		conn->parent[i] = i;
+	}
+
+	//scanning forwards, each cell only needs to join the neighbours already visited
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int cell = y * width + x;
+			if (!passable[cell]) {
+				continue;
+			}
+			if (x > 0) {
+				unionComponents(conn, cell, cell - 1);
+			}
+			if (y > 0) {
+				unionComponents(conn, cell, cell - width);
+			}
+		}
+	}
+
+	//flatten so queries are a single hop
+	for (int i = 0; i < cellCount; i++) {
+		findComponent(conn, i);
+	}
+}
+
+//relabels everything reachable from start, which becomes the new root
+void floodComponent(Connectivity* conn, int start) {
+	conn->floodQueue.clear();
+	conn->floodQueue.push_back(start);
+	conn->visited[start] = conn->visitGeneration;
+	conn->componentSizes[start] = 0;
+
+	int neighbours[4];
+	for (size_t head = 0; head < conn->floodQueue.size(); head++) {
+		int cell = conn->floodQueue[head];
+		conn->parent[cell] = start;
+		conn->componentSizes[start]++;
+
+		int count = connectivityNeighbours(conn, cell, neighbours);
+		for (int i = 0; i < count; i++) {
+			int n = neighbours[i];
+			if (conn->passable[n] && conn->visited[n] != conn->visitGeneration) {
+				conn->visited[n] = conn->visitGeneration;
+				conn->floodQueue.push_back(n);
+			}
+		}
+	}
+}
+
+void setCellPassable(Connectivity* conn, int cell, bool passable) {
+	if ((conn->passable[cell] != 0) == passable) {
+		return;
+	}
+
+	int neighbours[4];
+	int count = connectivityNeighbours(conn, cell, neighbours);
+
+	if (passable) {
+		conn->passable[cell] = 1;
+		conn->parent[cell] = cell;
+		conn->componentSizes[cell] = 1;
+		for (int i = 0; i < count; i++) {
+			unionComponents(conn, cell, neighbours[i]);
+		}
+		return;
+	}
+
+	//the cell may have been holding its component together, so give each side its own root
+	conn->passable[cell] = 0;
+	conn->parent[cell] = cell;
+	conn->visitGeneration++;
+	for (int i = 0; i < count; i++) {
+		int n = neighbours[i];
+		if (conn->passable[n] && conn->visited[n] != conn->visitGeneration) {
+			floodComponent(conn, n);
+		}
+	}
+}
+
+bool cellsConnected(Connectivity* conn, int a, int b) {
+	int component = findComponent(conn, a);
+	return component != NO_COMPONENT && component == findComponent(conn, b);
+}
+
+//nearest cell to target (by ring, then straight-line distance) that a unit in from can reach,
+//searching out to maxRadius cells, returns -1 if there isn't one
+int nearestConnectedCell(Connectivity* conn, int from, int target, int maxRadius) {
+	int component = findComponent(conn, from);
+	if (component == NO_COMPONENT || target < 0) {
+		return -1;
+	}
+	if (findComponent(conn, target) == component) {
+		return target;
+	}
+
+	int tx = target % conn->width;
+	int ty = target / conn->width;
+
+	for (int r = 1; r <= maxRadius; r++) {
+		int best = -1;
+		int bestDistance = 0;
+		for (int dy = -r; dy <= r; dy++) {
+			int y = ty + dy;
+			if (y < 0 || y >= conn->height) {
+				continue;
+			}
+			//whole rows at the top and bottom of the ring, only the two ends in between
+			int step = (dy == -r || dy == r) ? 1 : 2 * r;
+			for (int dx = -r; dx <= r; dx += step) {
+				int x = tx + dx;
+				if (x < 0 || x >= conn->width) {
+					continue;
+				}
+				int cell = y * conn->width + x;
+				int distance = dx * dx + dy * dy;
+				if (findComponent(conn, cell) == component && (best == -1 || distance < bestDistance)) {
+					best = cell;
+					bestDistance = distance;
+				}
+			}
+		}
+		if (best != -1) {
+			return best;
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include "simd.h"
+
+// Per-team fog of war on the flowCells grid.
+//
+// Each unit stamps a disc of sight around the cell it is in. Stamps are reference
+// counted per cell, so a unit only has to remove its old stamp and add a new one when it
+// crosses into another cell; everything else is left alone. The visible/explored masks
+// are bit-packed, one bit per cell, and rebuilt only for the words a stamp touched.
+
+const int FOG_MAX_TEAMS = 4;
+const int FOG_NOT_STAMPED = -1;
+
+struct TeamVisibility {
+	std::vector<uint32_t> sightCounts; //rowStride counts per row, padding is always 0
+	std::vector<uint64_t> visible;
+	std::vector<uint64_t> explored;
+};
+
+struct FogOfWar {
+	int width{ 0 };
+	int height{ 0 };
+	int rowStride{ 0 };
+	int rowWords{ 0 };
+	TeamVisibility teams[FOG_MAX_TEAMS];
+
+	//what each unit currently has stamped, indexed like game->tanks
+	std::vector<int> stampedCells;
+	std::vector<int> stampedTeams;
+	std::vector<int> stampedRadii;
+
+	//sightDiscs[radius][dy + radius] is the half width of that row of the disc
+	std::vector<std::vector<int>> sightDiscs;
+
+	//cost of the last update
+	int unitsRestamped{ 0 };
+	double lastUpdateMs{ 0.0 };
+};
+
+void initFog(FogOfWar* fog, int width, int height) {
+	fog->width = width;
+	fog->height = height;
+	fog->rowWords = (width + 63) / 64;
+	fog->rowStride = fog->rowWords * 64;
+
+	for (int t = 0; t < FOG_MAX_TEAMS; t++) {
+		fog->teams[t].sightCounts.assign((size_t)fog->rowStride * height, 0);
+		fog->teams[t].visible.assign((size_t)fog->rowWords * height, 0);
+		fog->teams[t].explored.assign((size_t)fog->rowWords * height, 0);
+	}
+
+	fog->stampedCells.clear();
+	fog->stampedTeams.clear();
+	fog->stampedRadii.clear();
+}
+
+const std::vector<int>& getSightDisc(FogOfWar* fog, int radius) {
+	if (radius >= (int)fog->sightDiscs.size()) {
+		fog->sightDiscs.resize(radius + 1);
+	}
+
+	std::vector<int>& disc = fog->sightDiscs[radius];
+	if (disc.empty()) {
+		disc.resize(2 * radius + 1);
+		for (int dy = -radius; dy <= radius; dy++) {
+			disc[dy + radius] = (int)sqrt((float)(radius * radius - dy * dy));
+		}
+	}
+	return disc;
+}
+
+void addToSightRow(uint32_t* row, int x0, int x1, int delta) {
+	int x = x0;
+#ifdef RTS_SSE2
+	__m128i deltas = _mm_set1_epi32(delta);
+	for (; x + 4 <= x1 + 1; x += 4) {
+		__m128i counts = _mm_loadu_si128((const __m128i*)(row + x));
+		_mm_storeu_si128((__m128i*)(row + x), _mm_add_epi32(counts, deltas));
+	}
+#endif
+	for (; x <= x1; x++) {
+		row[x] = (uint32_t)(row[x] + delta);
+	}
+}
+
+//one bit per non-zero count, for the 64 counts covered by a mask word
+uint64_t sightCountsToBits(const uint32_t* counts) {
+	uint64_t bits = 0;
+#ifdef RTS_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (int k = 0; k < 4; k++) {
+		const __m128i* block = (const __m128i*)(counts + k * 16);
+		//compare results are all ones or zeros, so the saturating packs keep them intact
+		__m128i lo = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(block), zero), _mm_cmpeq_epi32(_mm_loadu_si128(block + 1), zero));
+		__m128i hi = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(block + 2), zero), _mm_cmpeq_epi32(_mm_loadu_si128(block + 3), zero));
+		uint64_t unseen = (uint64_t)_mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+		bits |= (~unseen & 0xffff) << (k * 16);
+	}
+#else
+	for (int k = 0; k < 64; k++) {
+		if (counts[k] != 0) {
+			bits |= uint64_t(1) << k;
+		}
+	}
+#endif
+	return bits;
+}
+
+void stampSight(FogOfWar* fog, int team, int cellIndex, int radius, int delta) {
+	TeamVisibility& vis = fog->teams[team];
+	const std::vector<int>& disc = getSightDisc(fog, radius);
+	int cx = cellIndex % fog->width;
+	int cy = cellIndex / fog->width;
+
+	for (int dy = -radius; dy <= radius; dy++) {
+		int y = cy + dy;
+		if (y < 0 || y >= fog->height) {
+			continue;
+		}
+
+		int halfWidth = disc[dy + radius];
+		int x0 = cx - halfWidth < 0 ? 0 : cx - halfWidth;
+		int x1 = cx + halfWidth >= fog->width ? fog->width - 1 : cx + halfWidth;
+
+		uint32_t* row = &vis.sightCounts[(size_t)y * fog->rowStride];
+		addToSightRow(row, x0, x1, delta);
+
+		//only the words this span touched can have changed
+		for (int w = x0 / 64; w <= x1 / 64; w++) {
+			size_t word = (size_t)y * fog->rowWords + w;
+			vis.visible[word] = sightCountsToBits(row + w * 64);
+			vis.explored[word] |= vis.visible[word];
+		}
+	}
+}
+
+//restamps a unit if it moved to another cell (or team or sight radius), cellIndex -1 removes it
+bool updateFogUnit(FogOfWar* fog, int unit, int team, int cellIndex, int radius) {
+	if (unit >= (int)fog->stampedCells.size()) {
+		fog->stampedCells.resize(unit + 1, FOG_NOT_STAMPED);
+		fog->stampedTeams.resize(unit + 1, 0);
+		fog->stampedRadii.resize(unit + 1, 0);
+	}
+
+	if (team < 0 || team >= FOG_MAX_TEAMS) {
+		cellIndex = FOG_NOT_STAMPED;
+	}
+	if (fog->stampedCells[unit] == cellIndex && fog->stampedTeams[unit] == team && fog->stampedRadii[unit] == radius) {
+		return false;
+	}
+
+	if (fog->stampedCells[unit] != FOG_NOT_STAMPED) {
+		stampSight(fog, fog->stampedTeams[unit], fog->stampedCells[unit], fog->stampedRadii[unit], -1);
+	}
+
+	if (cellIndex != FOG_NOT_STAMPED) {
+		stampSight(fog, team, cellIndex, radius, 1);
+	}
+
+	fog->stampedCells[unit] = cellIndex;
+	fog->stampedTeams[unit] = team;
+	fog->stampedRadii[unit] = radius;
+	return true;
+}
+
+bool fogCellBit(const std::vector<uint64_t>& mask, const FogOfWar* fog, int cellIndex) {
+	if (cellIndex < 0 || cellIndex >= fog->width * fog->height) {
+		return false;
+	}
+	int x = cellIndex % fog->width;
+	int y = cellIndex / fog->width;
+	return (mask[(size_t)y * fog->rowWords + x / 64] >> (x % 64)) & 1;
+}
+
+bool isCellVisible(const FogOfWar* fog, int team, int cellIndex) {
+	if (team < 0 || team >= FOG_MAX_TEAMS) {
+		return false;
+	}
+	return fogCellBit(fog->teams[team].visible, fog, cellIndex);
+}
+
+bool isCellExplored(const FogOfWar* fog, int team, int cellIndex) {
+	if (team < 0 || team >= FOG_MAX_TEAMS) {
+		return false;
+	}
+	return fogCellBit(fog->teams[team].explored, fog, cellIndex);
+}
@@ -3,6 +3,20 @@
 #include <vector>
 #include <glm.hpp>
 #include <cstdlib>
+#include <chrono>
+
+#include "grid.h"
+#include "fog.h"
+#include "terrain.h"
+#include "connectivity.h"
+#include "areatable.h"
+#include "collision.h"
+#include "pathfinding.h"
+#include "pathservice.h"
+#include "influence.h"
+#include "ai.h"
+#include "particles.h"
+#include "telemetry.h"
 
 struct IndexReference;
 struct Index;
@@ -26,6 +40,7 @@ float getFScoreForGidPoint(Game* game, int currentCellIndex, int neighbourCellIn
 int mapCoordsToMapIndex(Game* game, int x, int y);
 void mapIndexToMapCoords(Game* game, int mapIndex, int* coordsOut);
 void mapIndexToRealCorrds(Game* game, int mapIndex, float* coordsOut);
+void rebuildNavigation(Game* game);
 
 struct flowCell {
 	//float density{ 0.0f };
@@ -62,6 +77,74 @@ struct Waypoint {
 	bool set{ false };
 };
 
+//the cells a tank is driving through to reach its waypoint,
+//kept outside of Tank so that Tank stays plain data for snapshots
+struct TankPath {
+	std::vector<int> cells;
+	int next{ 0 };
+	bool planned{ false };
+	bool found{ false };
+
+	//waiting on the path service for the path from requestStart to requestGoal,
+	//results carrying any ticket but the latest are stale
+	bool pending{ false };
+	uint32_t ticket{ 0 };
+	int requestStart{ -1 };
+	int requestGoal{ -1 };
+
+	//what the tank is committed to driving at, see tickTank. Kept until the tank changes
+	//cell, gets a new order, the grid is edited, its path comes back or it stops getting closer
+	bool committed{ false };
+	bool waiting{ false };           //committed to holding still for the path service
+	int committedCell{ -1 };
+	glm::vec3 committedWaypoint;
+	glm::vec3 target;                //the point it's heading for
+	uint32_t navigationVersion{ 0 };
+	float closestSq{ 0.0f };         //to target, since committing
+	int stalledTicks{ 0 };
+};
+
+//why a tank's steering was worked out again
+enum ReplanReason {
+	REPLAN_ORDER = 0,  //first move, or a new waypoint
+	REPLAN_CELL,       //crossed into another cell
+	REPLAN_GRID,       //the navigation grid was edited
+	REPLAN_PATH,       //the path it was waiting on came back
+	REPLAN_STALLED,    //pushed off course, no closer to its target for STALL_TICKS
+	REPLAN_REASON_COUNT
+};
+
+const int STALL_TICKS = 30;
+
+struct MovementStats {
+	int moving{ 0 };    //last tick
+	int replans{ 0 };   //last tick
+	int replansByReason[REPLAN_REASON_COUNT]{};
+	long long totalMoving{ 0 };
+	long long totalReplans{ 0 };
+};
+
+enum PathProgress {
+	PATH_FOLLOWING,   //there is a point to drive towards
+	PATH_WAITING,     //the path service hasn't answered yet
+	PATH_UNREACHABLE
+};
+
+//how far along its path a tank can be pushed and still pick it up again
+const int PATH_LOOKAHEAD = 4;
+
+const int TANK_EXPLOSION_PARTICLES = 48;
+
+//where one move order sends the tanks of each connected component, so the search for the
+//nearest reachable cell runs once per component rather than once per tank
+struct OrderRedirects {
+	glm::vec3 point{ 0.0f };
+	uint32_t navigationVersion{ 0 };
+	std::vector<int> components;
+	std::vector<glm::vec3> waypoints;
+	std::vector<uint8_t> reachable;
+};
+
 // Tank game data
 struct Tank {
 	Index index;
@@ -70,6 +153,7 @@ struct Tank {
 	float speed{0.1};
 	bool selected{ false };
 	Waypoint waypoint;
+	int team{ 0 };
 };
 
 // All Tanks Rendering Data (buffers)
@@ -78,6 +162,7 @@ struct TanksData {
 	std::vector<float> headings;
 	std::vector<float> turretDirections;
 	std::vector<float> tint;
+	std::vector<float> tilts; //pitch, roll from the terrain under each tank
 };
 
 struct Game {
@@ -102,6 +187,26 @@ struct Game {
 	int flowMapWidth{ 300 };
 	int flowMapHeight{ 300 };
 	float flowCellSize{ 2.0f };
+	RuntimeGrid grid; //index math for the sizes above, set up by initFlowMap
+	FogOfWar fog;
+	Terrain terrain;
+	Connectivity connectivity;
+	AreaTables areaTables; //rectangle sums of discomfort and occupancy
+	Collision collision;
+	PathGrid pathGrid;
+	bool pathGridDirty{ true }; //edited since it was last handed to the path service
+	bool pathGridRebuilt{ true }; //...as a whole, rather than just pathGridEdits
+	std::vector<int> pathGridEdits; //cells edited since it was last handed over
+	uint32_t navigationVersion{ 0 }; //bumped on every edit, so steering knows to look again
+	PathService pathService;
+	std::vector<std::shared_ptr<PathJob>> pathResults; //scratch for tickPathService
+	std::vector<TankPath> tankPaths; //one per tank
+	int playerTeam{ 0 };
+	InfluenceMaps influence;
+	AiOpponent ai; //plays settings.aiTeam
+	OrderRedirects aiRedirects; //for the plan the AI is handing out, which can take several ticks
+	ParticleSystem particles;
+	MovementStats movement;
 };
 
 float getFScoreForGidPoint(Game *game, int currentCellIndex, int neighbourCellIndex, int waypointCellIndex) {
@@ -200,6 +305,8 @@ vector<int> getNeighbourCellIndexes(Game* game, int cellIndex) {
 }
 
 void initFlowMap(Game *game) {
+	initRuntimeGrid(&game->grid, game->flowMapWidth, game->flowMapHeight, game->flowCellSize);
+
 	for (int h = 0; h < game->flowMapHeight; h++) {
 		for (int w = 0; w < game->flowMapWidth; w++) {
 			flowCell cell;
@@ -208,61 +315,361 @@ void initFlowMap(Game *game) {
 			game->flowCells.push_back(cell);
 		}
 	}
+
+	initFog(&game->fog, game->flowMapWidth, game->flowMapHeight);
+	initInfluence(&game->influence, game->flowMapWidth, game->flowMapHeight);
+	initAreaTables(&game->areaTables, game->flowMapWidth, game->flowMapHeight);
+	initTerrain(&game->terrain, game->flowMapWidth, game->flowMapHeight, game->flowCellSize);
+	rebuildNavigation(game);
 }
 
-int mapCoordsToMapIndex(Game* game, int x, int y) {
-	int index = game->flowMapWidth * y + x;
+//an influence cell is worth the fraction of its flow cells tanks can drive through
+void updateInfluenceValue(Game* game, int influenceCell) {
+	InfluenceMaps& maps = game->influence;
+	int x0 = (influenceCell % maps.width) * INFLUENCE_CELL_SIZE;
+	int y0 = (influenceCell / maps.width) * INFLUENCE_CELL_SIZE;
+	int passable = 0;
+	int cells = 0;
+
+	for (int y = y0; y < y0 + INFLUENCE_CELL_SIZE && y < game->flowMapHeight; y++) {
+		for (int x = x0; x < x0 + INFLUENCE_CELL_SIZE && x < game->flowMapWidth; x++) {
+			passable += game->connectivity.passable[y * game->flowMapWidth + x] ? 1 : 0;
+			cells++;
+		}
+	}
+	setInfluenceValue(&maps, influenceCell, cells > 0 ? (float)passable / cells : 0.0f);
+}
 
-	if (index < 0) {
-		return -1;
+//rebuilds the connectivity index, the pathfinding grid and the area tables from the flowCells' discomfort
+void rebuildNavigation(Game* game) {
+	std::vector<uint8_t> passable(game->flowCells.size());
+	initPathGrid(&game->pathGrid, game->flowMapWidth, game->flowMapHeight);
+	for (int i = 0; i < game->flowCells.size(); i++) {
+		passable[i] = game->flowCells[i].discomfort < IMPASSABLE_DISCOMFORT;
+		setPathCellDiscomfort(&game->pathGrid, i, game->flowCells[i].discomfort);
+		game->areaTables.discomfort[i] = game->flowCells[i].discomfort;
 	}
-	else if (index >= game->flowCells.size()) {
-		return -1;
+	buildConnectivity(&game->connectivity, game->flowMapWidth, game->flowMapHeight, passable);
+	buildAreaTables(&game->areaTables);
+	game->pathGridDirty = true;
+	game->pathGridRebuilt = true;
+	game->pathGridEdits.clear();
+	game->navigationVersion++;
+
+	for (int i = 0; i < game->influence.value.size(); i++) {
+		updateInfluenceValue(game, i);
 	}
+}
 
-	return index;
+//edit cell costs through here so the connectivity index and pathfinding grid stay up to date
+void setCellDiscomfort(Game* game, int cellIndex, int discomfort) {
+	game->flowCells[cellIndex].discomfort = discomfort;
+	setCellPassable(&game->connectivity, cellIndex, discomfort < IMPASSABLE_DISCOMFORT);
+	setPathCellDiscomfort(&game->pathGrid, cellIndex, discomfort);
+	setAreaDiscomfort(&game->areaTables, cellIndex, discomfort);
+	game->pathGridDirty = true;
+	if (!game->pathGridRebuilt) {
+		game->pathGridEdits.push_back(cellIndex);
+	}
+	game->navigationVersion++;
+	updateInfluenceValue(game, influenceCellOfFlowCell(&game->influence, cellIndex));
 }
 
-void mapIndexToMapCoords(Game* game, int mapIndex, int *coordsOut) {
-	int xi = mapIndex % game->flowMapWidth;
-	int yi = mapIndex / game->flowMapWidth;
+//where a move order to point should send a unit in cell from: point itself if it can get
+//there, otherwise the nearest cell it can reach. false if it can't reach anywhere near it
+bool redirectWaypoint(Game* game, int from, glm::vec3 point, glm::vec3* out) {
+	//orders off the edge of the map are pulled back onto it
+	float halfWidth = game->flowCellSize * game->flowMapWidth / 2.0f;
+	float halfHeight = game->flowCellSize * game->flowMapHeight / 2.0f;
+	glm::vec3 clamped = point;
+	clamped.x = glm::clamp(point.x, -halfWidth, halfWidth - 0.001f);
+	clamped.z = glm::clamp(point.z, -halfHeight, halfHeight - 0.001f);
+
+	int target = realCoordsToMapIndex(game, clamped.x, clamped.z);
+	int maxRadius = game->flowMapWidth > game->flowMapHeight ? game->flowMapWidth : game->flowMapHeight;
+	int cellIndex = nearestConnectedCell(&game->connectivity, from, target, maxRadius);
+
+	if (cellIndex == -1) {
+		return false;
+	}
+	if (cellIndex == target) {
+		*out = clamped;
+		return true;
+	}
+
+	float cellCoords[2];
+	mapIndexToRealCorrds(game, cellIndex, cellCoords);
+	out->x = cellCoords[0] + game->flowCellSize / 2.0f;
+	out->z = cellCoords[1] + game->flowCellSize / 2.0f;
+	out->y = terrainHeightAt(&game->terrain, out->x, out->z);
+	return true;
+}
+
+//starts an order to point, keeping what was already worked out if it's the same order on the same map
+void beginOrderRedirects(Game* game, OrderRedirects* redirects, glm::vec3 point) {
+	if (redirects->point == point && redirects->navigationVersion == game->navigationVersion) {
+		return;
+	}
+	redirects->point = point;
+	redirects->navigationVersion = game->navigationVersion;
+	redirects->components.clear();
+	redirects->waypoints.clear();
+	redirects->reachable.clear();
+}
+
+//where the order in redirects should send a tank, see redirectWaypoint
+bool reachableWaypoint(Game* game, OrderRedirects* redirects, int tankIndex, glm::vec3* out) {
+	int from = realCoordsToMapIndex(game, game->tanksData.positions[3 * tankIndex], game->tanksData.positions[3 * tankIndex + 2]);
 
-	coordsOut[0] = xi;
-	coordsOut[1] = yi;
+	//a tank already stuck somewhere impassable keeps the old behaviour and just heads for the point
+	if (from == -1 || !game->connectivity.passable[from]) {
+		*out = redirects->point;
+		return true;
+	}
+
+	int component = findComponent(&game->connectivity, from);
+	for (int k = 0; k < redirects->components.size(); k++) {
+		if (redirects->components[k] == component) {
+			*out = redirects->waypoints[k];
+			return redirects->reachable[k] != 0;
+		}
+	}
+
+	bool reachable = redirectWaypoint(game, from, redirects->point, out);
+	redirects->components.push_back(component);
+	redirects->waypoints.push_back(*out);
+	redirects->reachable.push_back(reachable);
+	return reachable;
+}
+
+//fills the terrain with hills and feeds each cell's slope into its discomfort
+void generateMapTerrain(Game* game, float amplitude, uint32_t seed) {
+	generateTerrain(&game->terrain, amplitude, seed);
+
+	for (int i = 0; i < game->flowCells.size(); i++) {
+		game->flowCells[i].discomfort = terrainSlopeDiscomfort(&game->terrain, i);
+	}
+	rebuildNavigation(game);
+}
+
+int mapCoordsToMapIndex(Game* game, int x, int y) {
+	return gridCoordsToIndex(&game->grid, x, y);
+}
+
+void mapIndexToMapCoords(Game* game, int mapIndex, int *coordsOut) {
+	gridIndexToCoords(&game->grid, mapIndex, coordsOut);
 }
 
 int realCoordsToMapIndex(Game *game, float x, float y) {
+	return gridRealToIndex(&game->grid, x, y);
+}
 
-	//calculate real size of map
+//the cell a footprint of width x height cells is placed from when centred on a real x/z point,
+//so a ghost snaps to the grid the same way whatever its size
+void footprintOrigin(Game* game, float x, float y, int width, int height, int* coordsOut) {
 	float realMapWidth = game->flowCellSize * game->flowMapWidth;
 	float realMapHeight = game->flowCellSize * game->flowMapHeight;
 
-	//transform coordinates so that 0,0 is at the "bottom left", not in the middle
-	x += realMapWidth / 2.0f;
-	y += realMapHeight / 2.0f;
+	coordsOut[0] = (int)floorf((x + realMapWidth / 2.0f) / game->flowCellSize - width / 2.0f + 0.5f);
+	coordsOut[1] = (int)floorf((y + realMapHeight / 2.0f) / game->flowCellSize - height / 2.0f + 0.5f);
+}
 
-	int xi = x / game->flowCellSize;
-	int yi = y / game->flowCellSize;
+//can a width x height cell footprint centred on the real x/z point go there
+bool footprintFree(Game* game, float x, float y, int width, int height) {
+	int origin[2];
+	footprintOrigin(game, x, y, width, height, origin);
+	return areaFree(&game->areaTables, origin[0], origin[1], origin[0] + width, origin[1] + height);
+}
 
-	int index = game->flowMapWidth * yi + xi;
+//total discomfort under a width x height cell footprint centred on the real x/z point
+int64_t footprintDiscomfort(Game* game, float x, float y, int width, int height) {
+	int origin[2];
+	footprintOrigin(game, x, y, width, height, origin);
+	return areaDiscomfortSum(&game->areaTables, origin[0], origin[1], origin[0] + width, origin[1] + height);
+}
 
-	if (index >= game->flowCells.size() || index < 0) {
-		return -1;
+//marks a width x height cell footprint centred on the real x/z point as taken (or frees it
+//again), e.g. when a structure is placed or destroyed. Cells off the map are skipped
+void reserveFootprint(Game* game, float x, float y, int width, int height, bool reserved) {
+	int origin[2];
+	footprintOrigin(game, x, y, width, height, origin);
+	for (int cy = origin[1]; cy < origin[1] + height; cy++) {
+		for (int cx = origin[0]; cx < origin[0] + width; cx++) {
+			int cellIndex = mapCoordsToMapIndex(game, cx, cy);
+			if (cx >= 0 && cx < game->flowMapWidth && cellIndex != -1) {
+				setAreaReserved(&game->areaTables, cellIndex, reserved);
+			}
+		}
 	}
-
-	return index;
 }
 
 void mapIndexToRealCorrds(Game* game, int mapIndex, float* coordsOut) {
-	int xi = mapIndex % game->flowMapWidth;
-	int yi = mapIndex / game->flowMapWidth;
+	gridIndexToReal(&game->grid, mapIndex, coordsOut);
+}
 
-	//calculate real size of map
-	float realMapWidth = game->flowCellSize * game->flowMapWidth;
-	float realMapHeight = game->flowCellSize * game->flowMapHeight;
+//pushes overlapping tanks apart, tankRadius from res/settings
+void tickCollisions(Game* game) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Collision& collision = game->collision;
+	collision.active.resize(game->tanks.size());
+	for (int i = 0; i < game->tanks.size(); i++) {
+		collision.active[i] = !game->tanks[i].index.deleted;
+	}
 
-	coordsOut[0] = (float)xi * game->flowCellSize - realMapWidth / 2.0f;
-	coordsOut[1] = (float)yi * game->flowCellSize - realMapHeight / 2.0f;
+	resolveCollisions(&collision, game->tanksData.positions.data(), game->tanks.size(), game->settings.tankRadius);
+
+	collision.stats.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//restamps sight for the tanks that changed cell since the last tick
+void tickFog(Game* game) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int sightRadius = (int)ceil(game->settings.tankSightRadius / game->flowCellSize);
+	int restamped = 0;
+
+	for (int i = 0; i < game->tanks.size(); i++) {
+		Tank& tank = game->tanks[i];
+		int cellIndex = FOG_NOT_STAMPED;
+		if (!tank.index.deleted) {
+			cellIndex = realCoordsToMapIndex(game, game->tanksData.positions[3 * i], game->tanksData.positions[3 * i + 2]);
+		}
+
+		if (updateFogUnit(&game->fog, i, tank.team, cellIndex, sightRadius)) {
+			restamped++;
+		}
+	}
+
+	game->fog.unitsRestamped = restamped;
+	game->fog.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//what a live tank adds to its team's influence: its health, but never so little that a
+//damaged (or health 0) tank stops counting
+float tankInfluenceWeight(const Tank& tank) {
+	float weight = tank.health / 100.0f;
+	return weight > AI_MIN_UNIT_WEIGHT ? weight : AI_MIN_UNIT_WEIGHT;
+}
+
+//restamps influence for tanks that changed influence cell, then hands the AI's plan out
+void tickAi(Game* game) {
+	auto start = std::chrono::high_resolution_clock::now();
+	InfluenceMaps& maps = game->influence;
+
+	int restamped = 0;
+	for (int i = 0; i < game->tanks.size(); i++) {
+		Tank& tank = game->tanks[i];
+		int cell = INFLUENCE_NOT_STAMPED;
+		if (!tank.index.deleted) {
+			int flowCell = realCoordsToMapIndex(game, game->tanksData.positions[3 * i], game->tanksData.positions[3 * i + 2]);
+			cell = flowCell == -1 ? INFLUENCE_NOT_STAMPED : influenceCellOfFlowCell(&maps, flowCell);
+		}
+		if (updateInfluenceUnit(&maps, i, tank.team, cell, tankInfluenceWeight(tank))) {
+			restamped++;
+		}
+	}
+	maps.stats.unitsRestamped = restamped;
+
+	advanceInfluenceRefresh(&maps);
+
+	int team = game->settings.aiTeam;
+	AiOpponent& ai = game->ai;
+	if (team >= 0 && team < INFLUENCE_TEAMS) {
+		tickAiDecision(&ai, &maps, team);
+
+		if (ai.orderCursor >= 0) {
+			int centre = influenceCellCentre(&maps, ai.targetCell, game->flowMapHeight);
+			float coords[2];
+			mapIndexToRealCorrds(game, centre, coords);
+			glm::vec3 point(coords[0] + game->flowCellSize / 2.0f, 0.0f, coords[1] + game->flowCellSize / 2.0f);
+			point.y = terrainHeightAt(&game->terrain, point.x, point.z);
+			beginOrderRedirects(game, &game->aiRedirects, point);
+
+			int orders = 0;
+			int scanned = 0;
+			while (ai.orderCursor < game->tanks.size() && orders < AI_ORDERS_PER_TICK && scanned < AI_SCAN_PER_TICK) {
+				int i = ai.orderCursor++;
+				scanned++;
+				if (game->tanks[i].index.deleted || game->tanks[i].team != team) {
+					continue;
+				}
+
+				glm::vec3 waypoint;
+				if (reachableWaypoint(game, &game->aiRedirects, i, &waypoint)) {
+					game->tanks[i].waypoint.point = waypoint;
+					game->tanks[i].waypoint.set = true;
+					game->tankPaths[i].planned = false;
+					orders++;
+				}
+			}
+			ai.stats.ordersIssued += orders;
+			if (ai.orderCursor >= game->tanks.size()) {
+				ai.orderCursor = -1;
+			}
+		}
+	}
+
+	recordAiTick(&ai, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+}
+
+//moves the particles on and kicks up dust behind the tanks that are driving
+void tickParticles(Game* game) {
+	ParticleSystem& particles = game->particles;
+	if (particles.pools[0].capacity == 0) {
+		initParticles(&particles);
+	}
+
+	updateParticles(&particles, PARTICLE_TICK_SECONDS);
+
+	//start where the budget ran out last tick, so every tank gets its turn
+	int count = (int)game->tanks.size();
+	int k = 0;
+	for (; k < count && particles.pools[PARTICLE_DUST].spawnsLeft > 0; k++) {
+		int i = (particles.dustCursor + k) % count;
+		Tank& tank = game->tanks[i];
+		if (tank.index.deleted || !tank.waypoint.set) {
+			continue;
+		}
+		emitParticles(&particles, PARTICLE_DUST, game->tanksData.positions[3 * i] - tank.direction.x,
+			game->tanksData.positions[3 * i + 1], game->tanksData.positions[3 * i + 2] - tank.direction.z, 1);
+	}
+	particles.dustCursor = count > 0 ? (particles.dustCursor + k) % count : 0;
+}
+
+//a team always sees its own tanks, anyone else's only when they are in a visible cell
+bool tankVisibleToTeam(Game* game, int tankIndex, int team) {
+	Tank& tank = game->tanks[tankIndex];
+	if (tank.index.deleted) {
+		return false;
+	}
+	if (tank.team == team) {
+		return true;
+	}
+
+	int cellIndex = realCoordsToMapIndex(game, game->tanksData.positions[3 * tankIndex], game->tanksData.positions[3 * tankIndex + 2]);
+	return isCellVisible(&game->fog, team, cellIndex);
+}
+
+//copies the render data of the tanks a team can see into out, reusing its storage
+void gatherVisibleTanks(Game* game, int team, TanksData* out) {
+	out->positions.clear();
+	out->headings.clear();
+	out->turretDirections.clear();
+	out->tint.clear();
+	out->tilts.clear();
+
+	for (int i = 0; i < game->tanks.size(); i++) {
+		if (!tankVisibleToTeam(game, i, team)) {
+			continue;
+		}
+
+		out->positions.insert(out->positions.end(), &game->tanksData.positions[3 * i], &game->tanksData.positions[3 * i] + 3);
+		out->headings.push_back(game->tanksData.headings[i]);
+		out->turretDirections.push_back(game->tanksData.turretDirections[i]);
+		out->tint.insert(out->tint.end(), &game->tanksData.tint[4 * i], &game->tanksData.tint[4 * i] + 4);
+		out->tilts.insert(out->tilts.end(), &game->tanksData.tilts[2 * i], &game->tanksData.tilts[2 * i] + 2);
+	}
 }
 
 bool validTankRef(IndexReference tankRef, Game* game) {
@@ -273,60 +680,253 @@ bool validTankRef(IndexReference tankRef, Game* game) {
 	return true;
 }
 
-void tickTank(IndexReference tankRef, Game *game) {
-	
-	if (!validTankRef(tankRef, game)) {
-		std::cout << "invalid tank reference" << std::endl;
-		return;
+//takes the tank off any search it is waiting on
+void cancelTankPath(Game* game, int tankIndex) {
+	TankPath& path = game->tankPaths[tankIndex];
+	if (path.pending) {
+		cancelPathRequest(&game->pathService, tankIndex, path.requestStart, path.requestGoal);
+		path.pending = false;
 	}
+}
 
-	glm::vec3 pos(1.0f);
-	pos.x = game->tanksData.positions[3 * tankRef.index];
-	pos.y = game->tanksData.positions[3 * tankRef.index + 1];
-	pos.z = game->tanksData.positions[3 * tankRef.index + 2];
+//asks the path service for a path, replacing any request the tank already had
+void requestTankPath(Game* game, int tankIndex, int start, int goal) {
+	cancelTankPath(game, tankIndex);
+
+	TankPath& path = game->tankPaths[tankIndex];
+	path.ticket++;
+	path.pending = true;
+	path.planned = true;
+	path.found = false;
+	path.requestStart = start;
+	path.requestGoal = goal;
+
+	PathWaiter waiter{ tankIndex, game->tanks[tankIndex].index.generation, path.ticket };
+	submitPathRequest(&game->pathService, waiter, start, goal);
+}
 
+//starts the workers on first use, hands them the latest grid and takes in finished paths
+void tickPathService(Game* game) {
+	PathService& service = game->pathService;
+	if (!service.started) {
+		startPathService(&service, game->settings.pathWorkerThreads);
+	}
+	if (game->pathGridDirty) {
+		publishPathGrid(&service, game->pathGrid, game->pathGridRebuilt ? NULL : &game->pathGridEdits);
+		game->pathGridDirty = false;
+		game->pathGridRebuilt = false;
+		game->pathGridEdits.clear();
+	}
+
+	collectPathResults(&service, &game->pathResults);
+	for (size_t j = 0; j < game->pathResults.size(); j++) {
+		const PathJob& job = *game->pathResults[j];
+		for (size_t w = 0; w < job.waiters.size(); w++) {
+			const PathWaiter& waiter = job.waiters[w];
+
+			//the tank was deleted, its slot reused, or it was given another order since
+			if (waiter.unit >= game->tanks.size() || waiter.unit >= game->tankPaths.size() ||
+				!validTankRef(IndexReference{ waiter.generation, waiter.unit }, game) ||
+				!game->tankPaths[waiter.unit].pending || game->tankPaths[waiter.unit].ticket != waiter.ticket) {
+				service.droppedResults++;
+				continue;
+			}
+
+			TankPath& path = game->tankPaths[waiter.unit];
+			path.pending = false;
+			path.found = job.found;
+			path.cells = job.cells;
+			path.next = 0;
+		}
+	}
+	game->pathResults.clear();
+}
+
+//asks for a path to the tank's waypoint if it doesn't have one (or has been pushed off it),
+//and when it has one gives the point to drive towards next
+PathProgress nextPathPoint(Game* game, IndexReference tankRef, int currentCellIndex, glm::vec3* out) {
 	Tank& tank = game->tanks[tankRef.index];
+	TankPath& path = game->tankPaths[tankRef.index];
+	int width = game->flowMapWidth;
+
+	if (path.planned && !path.pending && path.found) {
+		for (int k = path.next; k < path.cells.size() && k < path.next + PATH_LOOKAHEAD; k++) {
+			if (path.cells[k] == currentCellIndex) {
+				path.next = k + 1;
+				break;
+			}
+		}
 
-	if (tank.waypoint.set) {
-		if (glm::length(pos - tank.waypoint.point) < 1) {
-			tank.waypoint.set = false;
-		} else {
+		if (path.next < path.cells.size()) {
+			int next = path.cells[path.next];
+			int dx = abs(next % width - currentCellIndex % width);
+			int dy = abs(next / width - currentCellIndex / width);
+			if (dx > 1 || dy > 1 || game->pathGrid.costs[next] == PATH_BLOCKED) {
+				path.planned = false;
+			}
+		}
+	}
+
+	if (!path.planned) {
+		int goal = realCoordsToMapIndex(game, tank.waypoint.point.x, tank.waypoint.point.z);
+		requestTankPath(game, tankRef.index, currentCellIndex, goal);
+	}
 
-			int currentTankCellIndex = realCoordsToMapIndex(game, pos.x, pos.z);
-			float realCurrentCellCoords[2];
-			mapIndexToRealCorrds(game, currentTankCellIndex, realCurrentCellCoords);
+	if (path.pending) {
+		return PATH_WAITING;
+	}
+	if (!path.found) {
+		return PATH_UNREACHABLE;
+	}
+
+	//past the last cell we're in the waypoint's cell, head for the point itself
+	if (path.next >= path.cells.size()) {
+		*out = tank.waypoint.point;
+		return PATH_FOLLOWING;
+	}
 
-			int cellIndex = getBestNeighbouringCellIndex(game, tankRef, tank.waypoint);
+	float cellCoords[2];
+	mapIndexToRealCorrds(game, path.cells[path.next], cellCoords);
+	*out = glm::vec3(cellCoords[0] + game->flowCellSize / 2.0f, 0.0f, cellCoords[1] + game->flowCellSize / 2.0f);
+	return PATH_FOLLOWING;
+}
+
+//on the x/z plane only: tanks ride the terrain, so their y is the ground height under
+//them whatever y the point they're heading for was given
+float groundDistanceSq(const float* position, glm::vec3 point) {
+	float dx = position[0] - point.x;
+	float dz = position[2] - point.z;
+	return dx * dx + dz * dz;
+}
+
+//what, if anything, means the tank has to work out its steering again this tick
+int steeringEvent(Game* game, int tankIndex, int currentCellIndex) {
+	Tank& tank = game->tanks[tankIndex];
+	TankPath& path = game->tankPaths[tankIndex];
+
+	if (!path.committed || !path.planned || tank.waypoint.point != path.committedWaypoint) {
+		return REPLAN_ORDER;
+	}
+	if (path.navigationVersion != game->navigationVersion) {
+		return REPLAN_GRID;
+	}
+	if (path.waiting) {
+		return path.pending ? -1 : REPLAN_PATH;
+	}
+	if (currentCellIndex != path.committedCell) {
+		return REPLAN_CELL;
+	}
 
-			float nextWaypointCoords[2];
-			mapIndexToRealCorrds(game, cellIndex, nextWaypointCoords);
+	float distanceSq = groundDistanceSq(&game->tanksData.positions[3 * tankIndex], path.target);
+	if (distanceSq < path.closestSq) {
+		path.closestSq = distanceSq;
+		path.stalledTicks = 0;
+	}
+	else if (++path.stalledTicks >= STALL_TICKS) {
+		return REPLAN_STALLED;
+	}
+	return -1;
+}
 
-			
-			float newHeading = -1.0f * atan2(nextWaypointCoords[0] - realCurrentCellCoords[0], nextWaypointCoords[1] - realCurrentCellCoords[1]);
+//picks the point to head for and commits the tank's heading and direction to it
+void steerTank(IndexReference tankRef, Game* game, int currentTankCellIndex) {
+	Tank& tank = game->tanks[tankRef.index];
+	TankPath& path = game->tankPaths[tankRef.index];
+	const float* position = &game->tanksData.positions[3 * tankRef.index];
+
+	float newHeading;
+	glm::vec3 nextPoint;
+	PathProgress progress = nextPathPoint(game, tankRef, currentTankCellIndex, &nextPoint);
+
+	path.committed = true;
+	path.committedCell = currentTankCellIndex;
+	path.committedWaypoint = tank.waypoint.point;
+	path.navigationVersion = game->navigationVersion;
+	path.stalledTicks = 0;
+	path.waiting = progress == PATH_WAITING;
+	if (path.waiting) {
+		//hold still until the path comes back
+		return;
+	}
 
-			game->tanksData.headings[tankRef.index] = newHeading;
+	if (progress == PATH_FOLLOWING) {
+		newHeading = -1.0f * atan2(nextPoint.x - position[0], nextPoint.z - position[2]);
+		path.target = nextPoint;
+	}
+	else {
+		//no path (off the map, or walled in), fall back to stepping towards the waypoint
+		float realCurrentCellCoords[2];
+		mapIndexToRealCorrds(game, currentTankCellIndex, realCurrentCellCoords);
 
-			glm::vec4 newDirection =
-				glm::vec4(glm::vec3(0.0f, 0.0f, 1.0f), 1.0f) *
-				glm::rotate(
-					glm::mat4(1.0),
-					game->tanksData.headings[tankRef.index],
-					glm::vec3(0.0f, 1.0f, 0.0f)
-				);
+		int cellIndex = getBestNeighbouringCellIndex(game, tankRef, tank.waypoint);
 
-			newDirection = glm::normalize(newDirection) * tank.speed;
+		float nextWaypointCoords[2];
+		mapIndexToRealCorrds(game, cellIndex, nextWaypointCoords);
 
-			tank.direction.x = newDirection.x;
-			tank.direction.y = newDirection.y;
-			tank.direction.z = newDirection.z;
+		newHeading = -1.0f * atan2(nextWaypointCoords[0] - realCurrentCellCoords[0], nextWaypointCoords[1] - realCurrentCellCoords[1]);
+		path.target = tank.waypoint.point;
+	}
+	path.closestSq = groundDistanceSq(position, path.target);
 
-			//advance the tank by the new direction * speed
-			game->tanksData.positions[3 * tankRef.index] += tank.direction.x;
-			game->tanksData.positions[3 * tankRef.index + 1] += tank.direction.y;
-			game->tanksData.positions[3 * tankRef.index + 2] += tank.direction.z;
-		}
+	game->tanksData.headings[tankRef.index] = newHeading;
 
+	glm::vec4 newDirection =
+		glm::vec4(glm::vec3(0.0f, 0.0f, 1.0f), 1.0f) *
+		glm::rotate(
+			glm::mat4(1.0),
+			game->tanksData.headings[tankRef.index],
+			glm::vec3(0.0f, 1.0f, 0.0f)
+		);
+
+	newDirection = glm::normalize(newDirection) * tank.speed;
+
+	tank.direction.x = newDirection.x;
+	tank.direction.y = newDirection.y;
+	tank.direction.z = newDirection.z;
+}
+
+// Tanks steer on events rather than every tick: a moving tank holds the heading it
+// committed to and only looks again when steeringEvent says something has changed.
+// Driving straight at a fixed point keeps the same bearing, so in between there's
+// nothing to recompute.
+void tickTank(IndexReference tankRef, Game *game) {
+	
+	if (!validTankRef(tankRef, game)) {
+		std::cout << "invalid tank reference" << std::endl;
+		return;
+	}
+
+	Tank& tank = game->tanks[tankRef.index];
+
+	//idle tanks don't steer at all
+	if (!tank.waypoint.set) {
+		return;
 	}
+
+	float* position = &game->tanksData.positions[3 * tankRef.index];
+	if (groundDistanceSq(position, tank.waypoint.point) < 1.0f) {
+		tank.waypoint.set = false;
+		game->tankPaths[tankRef.index].committed = false;
+		return;
+	}
+
+	game->movement.moving++;
+	int currentTankCellIndex = realCoordsToMapIndex(game, position[0], position[2]);
+	int reason = steeringEvent(game, tankRef.index, currentTankCellIndex);
+	if (reason != -1) {
+		game->movement.replans++;
+		game->movement.replansByReason[reason]++;
+		steerTank(tankRef, game, currentTankCellIndex);
+	}
+
+	if (game->tankPaths[tankRef.index].waiting) {
+		return;
+	}
+
+	//advance the tank by the committed direction * speed
+	position[0] += tank.direction.x;
+	position[1] += tank.direction.y;
+	position[2] += tank.direction.z;
 }
 
 //assumes a and b have lie on the x,z ground plane (have y coord of zero)
@@ -385,17 +985,41 @@ void resetSelectionQuadVertices(Game* game) {
 }
 
 void tick(Game* game) {
-	
+	auto start = std::chrono::high_resolution_clock::now();
+
 	//if we are dragging, then update the drag square data
 	if (game->primaryButtonDown) {
 		makeQuad(game->mouseDragData.origin, game->mouseDragData.drag, game->groundSelectionQuadVertices);
 	}
 
 	int tanksSelected = 0;
+	int liveTanks = 0;
+
+	//tanks added since the last tick (or a freshly loaded snapshot) start without a path
+	if (game->tankPaths.size() != game->tanks.size()) {
+		game->tankPaths.resize(game->tanks.size());
+	}
+
+	tickPathService(game);
+
+	game->movement.moving = 0;
+	game->movement.replans = 0;
+	for (int r = 0; r < REPLAN_REASON_COUNT; r++) {
+		game->movement.replansByReason[r] = 0;
+	}
+
+	//a right click orders every selected tank to the same point
+	OrderRedirects orderRedirects;
+	beginOrderRedirects(game, &orderRedirects, game->currentMouseGroundIntersection);
 
 	for (int i=0; i < game->tanks.size(); i++) {
 		Tank* tank = &game->tanks[i];
 
+		if (tank->index.deleted) {
+			continue;
+		}
+		liveTanks++;
+
 		tickTank(IndexReference{ tank->index.generation, i }, game);
 
 		if (game->primaryButtonDown) {
@@ -423,12 +1047,37 @@ void tick(Game* game) {
 				tank->selected = false;
 			}
 		} else if (game->secondaryButtonClicked && tank->selected) {
-			game->tanks[i].waypoint.point = game->currentMouseGroundIntersection;
-			game->tanks[i].waypoint.set = true;
+			//orders into places the tank can't reach are redirected (or dropped) up front,
+			//rather than leaving it to hunt for a way in forever
+			glm::vec3 waypoint;
+			if (reachableWaypoint(game, &orderRedirects, i, &waypoint)) {
+				game->tanks[i].waypoint.point = waypoint;
+				game->tanks[i].waypoint.set = true;
+				game->tankPaths[i].planned = false;
+			}
 		}
 	}
 
 	game->secondaryButtonClicked = false;
+	game->movement.totalMoving += game->movement.moving;
+	game->movement.totalReplans += game->movement.replans;
+
+	tickCollisions(game);
+
+	//tanks move in x/z, their height and tilt come from the ground they ended up on
+	sampleTerrainBatch(&game->terrain, game->tanksData.positions.data(), game->tanksData.headings.data(), game->tanksData.tilts.data(), game->tanks.size());
+
+	tickFog(game);
+	flushAreaTables(&game->areaTables);
+	tickAi(game);
+	tickParticles(game);
+
+	if (telemetry.segment != NULL) {
+		int pathsPending;
+		long long pathsCompleted;
+		pathServiceTelemetryCounts(&game->pathService, &pathsPending, &pathsCompleted);
+		publishSimulationTelemetry(telemetryMicroseconds(start), liveTanks, pathsPending, pathsCompleted, game->particles.stats.live);
+	}
 }
 
 IndexReference addTank(Game* game, float x, float y, float z, int health) {
@@ -441,9 +1090,13 @@ IndexReference addTank(Game* game, float x, float y, float z, int health) {
 		if (tank.index.deleted) {
 			newIndex = i;
 			tank.index.deleted = false;
-			generation = tank.index.generation++;
+			//references to the tank that used to be here must stop validating
+			generation = ++tank.index.generation;
 			tank.health = health;
 			tankCreated = true;
+			if (i < game->tankPaths.size()) {
+				game->tankPaths[i] = TankPath();
+			}
 			break;
 		}
 	}
@@ -455,6 +1108,11 @@ IndexReference addTank(Game* game, float x, float y, float z, int health) {
 	reference.index = newIndex;
 	reference.generation = generation;
 
+	//sit on the ground when there is terrain to sit on
+	if (!game->terrain.heights.empty()) {
+		y = terrainHeightAt(&game->terrain, x, z);
+	}
+
 	float heading = glm::radians(float(rand() % 360));
 	//float heading = 0.0f;
 	float turredDirection = 0.0f;
@@ -468,28 +1126,54 @@ IndexReference addTank(Game* game, float x, float y, float z, int health) {
 
 		game->tanksData.positions.push_back(x);
 		game->tanksData.positions.push_back(y);
-		game->tanksData.positions.push_back(0.0f);
+		game->tanksData.positions.push_back(z);
 		game->tanksData.headings.push_back(heading);
 		game->tanksData.turretDirections.push_back(turredDirection);
 		game->tanksData.tint.push_back(DEFAULT_COLOR.x);
 		game->tanksData.tint.push_back(DEFAULT_COLOR.y);
 		game->tanksData.tint.push_back(DEFAULT_COLOR.z);
 		game->tanksData.tint.push_back(DEFAULT_COLOR.w);
+		game->tanksData.tilts.push_back(0.0f);
+		game->tanksData.tilts.push_back(0.0f);
 	} else {
-		game->tanksData.positions[reference.index] = x;
-		game->tanksData.positions[reference.index + 1] = y;
-		game->tanksData.positions[reference.index + 2] = 0.0f;
+		game->tanksData.positions[reference.index * 3] = x;
+		game->tanksData.positions[reference.index * 3 + 1] = y;
+		game->tanksData.positions[reference.index * 3 + 2] = z;
 		game->tanksData.headings[reference.index] = heading;
 		game->tanksData.turretDirections[reference.index] = turredDirection;
 		game->tanksData.tint[reference.index * 4] = DEFAULT_COLOR.x;
 		game->tanksData.tint[reference.index * 4 + 1] = DEFAULT_COLOR.y;
 		game->tanksData.tint[reference.index * 4 + 2] = DEFAULT_COLOR.z;
 		game->tanksData.tint[reference.index * 4 + 3] = DEFAULT_COLOR.w;
+		game->tanksData.tilts[reference.index * 2] = 0.0f;
+		game->tanksData.tilts[reference.index * 2 + 1] = 0.0f;
 	}
 
 	return reference;
 }
 
+//frees the tank's slot for addTank to reuse, false if tankRef was already stale
+bool removeTank(Game* game, IndexReference tankRef) {
+	if (!validTankRef(tankRef, game)) {
+		return false;
+	}
+
+	int i = tankRef.index;
+	emitParticles(&game->particles, PARTICLE_EXPLOSION, game->tanksData.positions[3 * i], game->tanksData.positions[3 * i + 1],
+		game->tanksData.positions[3 * i + 2], TANK_EXPLOSION_PARTICLES);
+
+	Tank& tank = game->tanks[tankRef.index];
+	tank.index.deleted = true;
+	tank.selected = false;
+	tank.waypoint.set = false;
+
+	if (tankRef.index < game->tankPaths.size()) {
+		cancelTankPath(game, tankRef.index);
+		game->tankPaths[tankRef.index] = TankPath();
+	}
+	return true;
+}
+
 bool XZPointWithinRect(glm::vec3 p1, glm::vec3 r1, glm::vec3 r2) {
 	
 	bool hit = false;
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+
+// Index math for the flow grid: map coords <-> cell index <-> real x/z.
+//
+// The same functions work on two kinds of grid. FixedGrid has its dimensions and cell
+// size as template arguments, so a power of two width turns the divide and modulo into
+// a shift and a mask, any other width into a multiply by a constant, and the cell size
+// into a constant reciprocal. RuntimeGrid has them as plain fields for maps whose size
+// is only known once they're loaded, which is what Game uses. It still swaps the divide
+// for a shift when its width happens to be a power of two, and always multiplies by a
+// reciprocal of the cell size worked out once up front.
+//
+// A cell size that isn't a power of two can put a point exactly on a cell edge into the
+// neighbouring cell compared with dividing by it, since the reciprocal is rounded.
+//
+// Cell sizes for FixedGrid are a fraction, CellSizeNumerator / CellSizeDenominator,
+// since templates can't take floats.
+
+//log2 of value if it's a power of two, otherwise -1
+constexpr int gridShift(int value, int shift = 0) {
+	return value <= 0 ? -1
+		: value == 1 ? shift
+		: (value & 1) ? -1
+		: gridShift(value >> 1, shift + 1);
+}
+
+template<int Width, int Height, int CellSizeNumerator, int CellSizeDenominator = 1>
+struct FixedGrid {
+	static constexpr int width = Width;
+	static constexpr int height = Height;
+	static constexpr int widthShift = gridShift(Width);
+	static constexpr float cellSize = (float)CellSizeNumerator / CellSizeDenominator;
+	static constexpr float inverseCellSize = (float)CellSizeDenominator / CellSizeNumerator;
+	static constexpr float halfRealWidth = cellSize * Width / 2.0f;
+	static constexpr float halfRealHeight = cellSize * Height / 2.0f;
+};
+
+template<int W, int H, int N, int D> constexpr int FixedGrid<W, H, N, D>::width;
+template<int W, int H, int N, int D> constexpr int FixedGrid<W, H, N, D>::height;
+template<int W, int H, int N, int D> constexpr int FixedGrid<W, H, N, D>::widthShift;
+template<int W, int H, int N, int D> constexpr float FixedGrid<W, H, N, D>::cellSize;
+template<int W, int H, int N, int D> constexpr float FixedGrid<W, H, N, D>::inverseCellSize;
+template<int W, int H, int N, int D> constexpr float FixedGrid<W, H, N, D>::halfRealWidth;
+template<int W, int H, int N, int D> constexpr float FixedGrid<W, H, N, D>::halfRealHeight;
+
+struct RuntimeGrid {
+	int width{ 0 };
+	int height{ 0 };
+	int widthShift{ -1 };
+	float cellSize{ 1.0f };
+	float inverseCellSize{ 1.0f };
+	float halfRealWidth{ 0.0f };
+	float halfRealHeight{ 0.0f };
+};
+
+void initRuntimeGrid(RuntimeGrid* grid, int width, int height, float cellSize) {
+	grid->width = width;
+	grid->height = height;
+	grid->widthShift = gridShift(width);
+	grid->cellSize = cellSize;
+	grid->inverseCellSize = 1.0f / cellSize;
+	grid->halfRealWidth = cellSize * width / 2.0f;
+	grid->halfRealHeight = cellSize * height / 2.0f;
+}
+
+//-1 if the index is off the grid. Like mapCoordsToMapIndex, x isn't checked on its own,
+//so x past either edge lands on the row above or below
+template<typename Grid>
+inline int gridCoordsToIndex(const Grid* grid, int x, int y) {
+	int index = grid->width * y + x;
+	if (index < 0 || index >= grid->width * grid->height) {
+		return -1;
+	}
+	return index;
+}
+
+//index must be on the grid
+template<typename Grid>
+inline void gridIndexToCoords(const Grid* grid, int index, int* coordsOut) {
+	if (grid->widthShift >= 0) {
+		coordsOut[0] = index & (grid->width - 1);
+		coordsOut[1] = index >> grid->widthShift;
+	}
+	else {
+		coordsOut[0] = index % grid->width;
+		coordsOut[1] = index / grid->width;
+	}
+}
+
+//the cell under a real x/z point, with 0,0 in the middle of the map. -1 if it's off the grid
+template<typename Grid>
+inline int gridRealToIndex(const Grid* grid, float x, float y) {
+	int xi = (int)((x + grid->halfRealWidth) * grid->inverseCellSize);
+	int yi = (int)((y + grid->halfRealHeight) * grid->inverseCellSize);
+	return gridCoordsToIndex(grid, xi, yi);
+}
+
+//real x/z of a cell's bottom left corner
+template<typename Grid>
+inline void gridIndexToReal(const Grid* grid, int index, float* coordsOut) {
+	int coords[2];
+	gridIndexToCoords(grid, index, coords);
+	coordsOut[0] = (float)coords[0] * grid->cellSize - grid->halfRealWidth;
+	coordsOut[1] = (float)coords[1] * grid->cellSize - grid->halfRealHeight;
+}
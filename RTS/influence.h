@@ -0,0 +1,322 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "simd.h"
+
+// Coarse influence maps for the AI, one cell per INFLUENCE_CELL_SIZE x INFLUENCE_CELL_SIZE
+// flow cells.
+//
+// Every unit stamps its weight into the presence of its team at the coarse cell it is in.
+// Like the fog, a stamp is only taken out and put back when the unit changes cell or
+// weight. Presence keeps all INFLUENCE_TEAMS teams of a cell next to each other, so one
+// SSE register holds a whole cell.
+//
+// Influence is presence spread out by INFLUENCE_BLUR_ITERATIONS separable box blurs. A
+// refresh is cut into row sized steps and advanceInfluenceRefresh does a fixed number of
+// them a tick, so a refresh finishes every INFLUENCE_REFRESH_TICKS ticks whatever happens
+// on the map. The last rows of a refresh also find each team's summary (home, the
+// strongest enemy cell, where to expand), so decisions are a handful of lookups.
+// Queries read the last finished refresh and are O(1).
+//
+// The value layer is the passable fraction of each coarse cell, until the map has
+// resources of its own.
+
+const int INFLUENCE_CELL_SIZE = 8;
+const int INFLUENCE_TEAMS = 4; //one SSE lane per team
+const int INFLUENCE_RADIUS = 3;
+const int INFLUENCE_BLUR_ITERATIONS = 2;
+const int INFLUENCE_REFRESH_TICKS = 8;
+const int INFLUENCE_NOT_STAMPED = -1;
+
+//below this a cell counts as nobody's
+const float INFLUENCE_UNCLAIMED = 0.05f;
+
+struct InfluenceLanes {
+	float team[INFLUENCE_TEAMS];
+};
+
+//what a team's decisions read, found while a refresh summarises its rows
+struct InfluenceSummary {
+	int homeCell{ -1 };        //strongest own influence
+	float homeOwn{ 0.0f };
+	float homeThreat{ 0.0f };  //enemy influence at homeCell
+	int enemyPeakCell{ -1 };   //strongest enemy influence
+	float enemyPeak{ 0.0f };
+	int expansionCell{ -1 };   //most valuable unclaimed cell, nearer home breaks ties
+	float expansionScore{ 0.0f };
+};
+
+struct InfluenceStats {
+	int unitsRestamped{ 0 };
+	int stepsLastTick{ 0 };
+	long long refreshes{ 0 };
+};
+
+struct InfluenceMaps {
+	int width{ 0 };
+	int height{ 0 };
+	int flowWidth{ 0 };
+
+	std::vector<InfluenceLanes> presence;  //live unit stamps
+	std::vector<float> value;
+	float teamStrength[INFLUENCE_TEAMS]{}; //total presence, kept with the stamps
+
+	//what each unit currently has stamped, indexed like game->tanks
+	std::vector<int> stampedCells;
+	std::vector<int> stampedTeams;
+	std::vector<float> stampedWeights;
+
+	//the refresh in progress blurs source into scratch and back
+	std::vector<InfluenceLanes> source;
+	std::vector<InfluenceLanes> scratch;
+	int refreshStep{ 0 };
+	InfluenceSummary pending[INFLUENCE_TEAMS]; //filled in by the summary rows
+
+	//the last finished refresh
+	std::vector<InfluenceLanes> influence;
+	InfluenceSummary summaries[INFLUENCE_TEAMS];
+
+	InfluenceStats stats;
+};
+
+void initInfluence(InfluenceMaps* maps, int flowWidth, int flowHeight) {
+	maps->flowWidth = flowWidth;
+	maps->width = (flowWidth + INFLUENCE_CELL_SIZE - 1) / INFLUENCE_CELL_SIZE;
+	maps->height = (flowHeight + INFLUENCE_CELL_SIZE - 1) / INFLUENCE_CELL_SIZE;
+
+	size_t cells = (size_t)maps->width * maps->height;
+	maps->presence.assign(cells, InfluenceLanes{});
+	maps->value.assign(cells, 1.0f);
+	maps->source.assign(cells, InfluenceLanes{});
+	maps->scratch.assign(cells, InfluenceLanes{});
+	maps->influence.assign(cells, InfluenceLanes{});
+	memset(maps->teamStrength, 0, sizeof(maps->teamStrength));
+
+	maps->stampedCells.clear();
+	maps->stampedTeams.clear();
+	maps->stampedWeights.clear();
+
+	maps->refreshStep = 0;
+	for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+		maps->summaries[t] = InfluenceSummary();
+	}
+}
+
+int influenceCellOfFlowCell(const InfluenceMaps* maps, int flowCellIndex) {
+	int x = flowCellIndex % maps->flowWidth;
+	int y = flowCellIndex / maps->flowWidth;
+	return (y / INFLUENCE_CELL_SIZE) * maps->width + x / INFLUENCE_CELL_SIZE;
+}
+
+//the flow cell in the middle of a coarse cell, clamped to the map
+int influenceCellCentre(const InfluenceMaps* maps, int cell, int flowHeight) {
+	int x = (cell % maps->width) * INFLUENCE_CELL_SIZE + INFLUENCE_CELL_SIZE / 2;
+	int y = (cell / maps->width) * INFLUENCE_CELL_SIZE + INFLUENCE_CELL_SIZE / 2;
+	x = x < maps->flowWidth ? x : maps->flowWidth - 1;
+	y = y < flowHeight ? y : flowHeight - 1;
+	return y * maps->flowWidth + x;
+}
+
+void setInfluenceValue(InfluenceMaps* maps, int cell, float value) {
+	maps->value[cell] = value;
+}
+
+//restamps a unit if it moved to another coarse cell (or team or weight), cell -1 removes it
+bool updateInfluenceUnit(InfluenceMaps* maps, int unit, int team, int cell, float weight) {
+	if (unit >= (int)maps->stampedCells.size()) {
+		maps->stampedCells.resize(unit + 1, INFLUENCE_NOT_STAMPED);
+		maps->stampedTeams.resize(unit + 1, 0);
+		maps->stampedWeights.resize(unit + 1, 0.0f);
+	}
+
+	if (team < 0 || team >= INFLUENCE_TEAMS) {
+		cell = INFLUENCE_NOT_STAMPED;
+	}
+	if (maps->stampedCells[unit] == cell && maps->stampedTeams[unit] == team && maps->stampedWeights[unit] == weight) {
+		return false;
+	}
+
+	if (maps->stampedCells[unit] != INFLUENCE_NOT_STAMPED) {
+		int oldTeam = maps->stampedTeams[unit];
+		maps->presence[maps->stampedCells[unit]].team[oldTeam] -= maps->stampedWeights[unit];
+		maps->teamStrength[oldTeam] -= maps->stampedWeights[unit];
+	}
+
+	if (cell != INFLUENCE_NOT_STAMPED) {
+		maps->presence[cell].team[team] += weight;
+		maps->teamStrength[team] += weight;
+	}
+
+	maps->stampedCells[unit] = cell;
+	maps->stampedTeams[unit] = team;
+	maps->stampedWeights[unit] = weight;
+	return true;
+}
+
+//sums 2 * INFLUENCE_RADIUS + 1 cells, step apart, around each of count cells along a line
+void blurInfluenceLine(const InfluenceLanes* in, InfluenceLanes* out, int count, int step, int position, int length) {
+	const float scale = 1.0f / (2 * INFLUENCE_RADIUS + 1);
+	int lo = position - INFLUENCE_RADIUS < 0 ? 0 : position - INFLUENCE_RADIUS;
+	int hi = position + INFLUENCE_RADIUS >= length ? length - 1 : position + INFLUENCE_RADIUS;
+
+	for (int i = 0; i < count; i++) {
+#ifdef RTS_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (int k = lo; k <= hi; k++) {
+			sum = _mm_add_ps(sum, _mm_loadu_ps(in[i + (k - position) * step].team));
+		}
+		_mm_storeu_ps(out[i].team, _mm_mul_ps(sum, _mm_set1_ps(scale)));
+#else
+		for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+			float sum = 0.0f;
+			for (int k = lo; k <= hi; k++) {
+				sum += in[i + (k - position) * step].team[t];
+			}
+			out[i].team[t] = sum * scale;
+		}
+#endif
+	}
+}
+
+void blurInfluenceRowHorizontal(InfluenceMaps* maps, int y) {
+	int w = maps->width;
+	const InfluenceLanes* in = &maps->source[(size_t)y * w];
+	InfluenceLanes* out = &maps->scratch[(size_t)y * w];
+	for (int x = 0; x < w; x++) {
+		blurInfluenceLine(in + x, out + x, 1, 1, x, w);
+	}
+}
+
+void blurInfluenceRowVertical(InfluenceMaps* maps, int y) {
+	int w = maps->width;
+	blurInfluenceLine(&maps->scratch[(size_t)y * w], &maps->source[(size_t)y * w], w, w, y, maps->height);
+}
+
+void summariseInfluenceRow(InfluenceMaps* maps, int y) {
+	float diagonal = sqrtf((float)(maps->width * maps->width + maps->height * maps->height));
+
+	for (int x = 0; x < maps->width; x++) {
+		int cell = y * maps->width + x;
+		const InfluenceLanes& lanes = maps->source[cell];
+		float total = lanes.team[0] + lanes.team[1] + lanes.team[2] + lanes.team[3];
+
+		for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+			InfluenceSummary& summary = maps->pending[t];
+			float own = lanes.team[t];
+			float threat = total - own;
+
+			if (own > summary.homeOwn) {
+				summary.homeCell = cell;
+				summary.homeOwn = own;
+				summary.homeThreat = threat;
+			}
+			if (threat > INFLUENCE_UNCLAIMED && threat > summary.enemyPeak) {
+				summary.enemyPeakCell = cell;
+				summary.enemyPeak = threat;
+			}
+
+			//home isn't known until every row is done, the last refresh's is close enough
+			if (total < INFLUENCE_UNCLAIMED) {
+				int home = maps->summaries[t].homeCell;
+				float distance = 0.0f;
+				if (home != -1) {
+					int dx = x - home % maps->width;
+					int dy = y - home / maps->width;
+					distance = sqrtf((float)(dx * dx + dy * dy)) / diagonal;
+				}
+				float score = maps->value[cell] - 0.5f * distance;
+				if (summary.expansionCell == -1 || score > summary.expansionScore) {
+					summary.expansionCell = cell;
+					summary.expansionScore = score;
+				}
+			}
+		}
+	}
+}
+
+//the row sized steps of one refresh: copy, the blur passes, summary rows, then publish
+int influenceRefreshSteps(const InfluenceMaps* maps) {
+	return 1 + INFLUENCE_BLUR_ITERATIONS * 2 * maps->height + maps->height + 1;
+}
+
+void runInfluenceRefreshStep(InfluenceMaps* maps, int step) {
+	int h = maps->height;
+
+	if (step == 0) {
+		maps->source = maps->presence;
+		for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+			maps->pending[t] = InfluenceSummary();
+		}
+		return;
+	}
+	step--;
+
+	if (step < INFLUENCE_BLUR_ITERATIONS * 2 * h) {
+		int pass = step / h;
+		int y = step % h;
+		if (pass % 2 == 0) {
+			blurInfluenceRowHorizontal(maps, y);
+		}
+		else {
+			blurInfluenceRowVertical(maps, y);
+		}
+		return;
+	}
+	step -= INFLUENCE_BLUR_ITERATIONS * 2 * h;
+
+	if (step < h) {
+		summariseInfluenceRow(maps, step);
+		return;
+	}
+
+	maps->influence.swap(maps->source);
+	for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+		maps->summaries[t] = maps->pending[t];
+	}
+	maps->stats.refreshes++;
+}
+
+//does this tick's share of the refresh in progress
+void advanceInfluenceRefresh(InfluenceMaps* maps) {
+	int steps = influenceRefreshSteps(maps);
+	int perTick = (steps + INFLUENCE_REFRESH_TICKS - 1) / INFLUENCE_REFRESH_TICKS;
+
+	for (int i = 0; i < perTick; i++) {
+		runInfluenceRefreshStep(maps, maps->refreshStep);
+		maps->refreshStep = (maps->refreshStep + 1) % steps;
+	}
+	maps->stats.stepsLastTick = perTick;
+}
+
+float influenceAt(const InfluenceMaps* maps, int team, int cell) {
+	return maps->influence[cell].team[team];
+}
+
+//everyone else's influence
+float threatAt(const InfluenceMaps* maps, int team, int cell) {
+	const InfluenceLanes& lanes = maps->influence[cell];
+	return lanes.team[0] + lanes.team[1] + lanes.team[2] + lanes.team[3] - lanes.team[team];
+}
+
+//1 held by team, -1 held by its enemies, 0 contested or empty
+float controlAt(const InfluenceMaps* maps, int team, int cell) {
+	float own = influenceAt(maps, team, cell);
+	float threat = threatAt(maps, team, cell);
+	return (own - threat) / (own + threat + INFLUENCE_UNCLAIMED);
+}
+
+float valueAt(const InfluenceMaps* maps, int cell) {
+	return maps->value[cell];
+}
+
+float enemyStrength(const InfluenceMaps* maps, int team) {
+	float total = 0.0f;
+	for (int t = 0; t < INFLUENCE_TEAMS; t++) {
+		total += t == team ? 0.0f : maps->teamStrength[t];
+	}
+	return total;
+}
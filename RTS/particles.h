@@ -0,0 +1,266 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+
+#include "simd.h"
+
+// Visual effect particles, one fixed capacity pool per emitter type.
+//
+// A pool stores its particles as structure of arrays, padded to a multiple of four so
+// the update kernel can work four particles at a time. Live particles are kept packed
+// at the front: a dead one is replaced by the pool's last. Each emitter type has a
+// capacity and a number of spawns allowed per tick, so however many units are emitting,
+// the update cost is bounded by the capacities and the spawn cost by the spawn budgets.
+// Anything past either is dropped and counted.
+//
+// Particles never affect the simulation and draw from their own random numbers, so
+// they don't disturb rand() for anything that has to be repeatable.
+
+enum ParticleType {
+	PARTICLE_DUST = 0,
+	PARTICLE_MUZZLE_FLASH,
+	PARTICLE_EXPLOSION,
+	PARTICLE_TYPE_COUNT
+};
+
+struct ParticleEmitterType {
+	int capacity;
+	int spawnsPerTick;
+	float lifetime;        //seconds
+	float lifetimeJitter;  //up to this much is taken off at random
+	float speed;           //outwards on x/z
+	float upSpeed;
+	float gravity;
+	float drag;            //velocity kept per tick
+	float startSize;
+	float growth;          //size per second
+	float colour[4];
+};
+
+const float PARTICLE_TICK_SECONDS = 1.0f / 60.0f;
+
+const ParticleEmitterType PARTICLE_EMITTERS[PARTICLE_TYPE_COUNT] = {
+	//capacity, spawns, lifetime, jitter, speed, up, gravity, drag, size, growth, colour
+	{ 32768, 256, 1.2f, 0.4f, 0.6f, 0.8f, 0.5f, 0.96f, 0.6f, 1.5f, { 0.55f, 0.47f, 0.36f, 0.5f } },
+	{ 4096, 64, 0.1f, 0.05f, 0.0f, 0.0f, 0.0f, 1.0f, 1.5f, 4.0f, { 1.0f, 0.85f, 0.4f, 1.0f } },
+	{ 16384, 1024, 1.0f, 0.5f, 8.0f, 6.0f, 9.8f, 0.94f, 0.8f, 0.5f, { 1.0f, 0.45f, 0.1f, 0.9f } },
+};
+
+struct ParticlePool {
+	int type;
+	int capacity{ 0 };
+	int count{ 0 };
+	int spawnsLeft{ 0 }; //this tick
+
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> vx;
+	std::vector<float> vy;
+	std::vector<float> vz;
+	std::vector<float> age;
+	std::vector<float> lifetime;
+	std::vector<float> size;
+};
+
+struct ParticleStats {
+	long long spawned{ 0 };
+	long long dropped{ 0 };   //over a spawn budget or a full pool
+	long long retired{ 0 };
+	int live{ 0 };
+	double lastUpdateMs{ 0.0 };
+};
+
+struct ParticleSystem {
+	ParticlePool pools[PARTICLE_TYPE_COUNT];
+	uint32_t random{ 0x9E3779B9 };
+	int dustCursor{ 0 };  //first tank to get a chance at the dust budget next tick
+	ParticleStats stats;
+};
+
+//one instance of the particle quad, what the renderer is handed
+struct ParticleInstance {
+	float position[3];
+	float size;
+	float fade; //0 when spawned, 1 when it dies
+};
+
+void initParticlePool(ParticlePool* pool, int type, int capacity) {
+	pool->type = type;
+	pool->capacity = capacity;
+	pool->count = 0;
+	pool->spawnsLeft = PARTICLE_EMITTERS[type].spawnsPerTick;
+
+	size_t padded = (size_t)(capacity + 3) / 4 * 4;
+	std::vector<float>* columns[] = { &pool->x, &pool->y, &pool->z, &pool->vx, &pool->vy, &pool->vz, &pool->age, &pool->lifetime, &pool->size };
+	for (std::vector<float>* column : columns) {
+		column->assign(padded, 0.0f);
+	}
+	//padding never dies, so the kernels can run over it without special cases
+	for (size_t i = capacity; i < padded; i++) {
+		pool->lifetime[i] = 1.0f;
+	}
+}
+
+void initParticles(ParticleSystem* particles) {
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++) {
+		initParticlePool(&particles->pools[t], t, PARTICLE_EMITTERS[t].capacity);
+	}
+	particles->stats = ParticleStats();
+}
+
+//xorshift, in [0, 1)
+float particleRandom(ParticleSystem* particles) {
+	uint32_t x = particles->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	particles->random = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+//spawns up to count particles of type at a point, returns how many fitted the budgets
+int emitParticles(ParticleSystem* particles, int type, float px, float py, float pz, int count) {
+	ParticlePool* pool = &particles->pools[type];
+	const ParticleEmitterType& emitter = PARTICLE_EMITTERS[type];
+
+	int spawn = count;
+	spawn = spawn < pool->spawnsLeft ? spawn : pool->spawnsLeft;
+	spawn = spawn < pool->capacity - pool->count ? spawn : pool->capacity - pool->count;
+	particles->stats.dropped += count - spawn;
+
+	for (int k = 0; k < spawn; k++) {
+		int i = pool->count++;
+		float angle = particleRandom(particles) * 6.2831853f;
+		float speed = emitter.speed * (0.5f + particleRandom(particles));
+		pool->x[i] = px;
+		pool->y[i] = py;
+		pool->z[i] = pz;
+		pool->vx[i] = cosf(angle) * speed;
+		pool->vy[i] = emitter.upSpeed * (0.5f + particleRandom(particles));
+		pool->vz[i] = sinf(angle) * speed;
+		pool->age[i] = 0.0f;
+		pool->lifetime[i] = emitter.lifetime - emitter.lifetimeJitter * particleRandom(particles);
+		pool->size[i] = emitter.startSize;
+	}
+
+	pool->spawnsLeft -= spawn;
+	particles->stats.spawned += spawn;
+	return spawn;
+}
+
+//moves every particle in the pool on by dt
+void updateParticlePool(ParticlePool* pool, float dt) {
+	const ParticleEmitterType& emitter = PARTICLE_EMITTERS[pool->type];
+	int i = 0;
+
+#ifdef RTS_SSE2
+	__m128 dts = _mm_set1_ps(dt);
+	__m128 drag = _mm_set1_ps(emitter.drag);
+	__m128 fall = _mm_set1_ps(emitter.gravity * dt);
+	__m128 grow = _mm_set1_ps(emitter.growth * dt);
+	for (; i < pool->count; i += 4) {
+		__m128 vx = _mm_mul_ps(_mm_loadu_ps(&pool->vx[i]), drag);
+		__m128 vy = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&pool->vy[i]), drag), fall);
+		__m128 vz = _mm_mul_ps(_mm_loadu_ps(&pool->vz[i]), drag);
+		_mm_storeu_ps(&pool->vx[i], vx);
+		_mm_storeu_ps(&pool->vy[i], vy);
+		_mm_storeu_ps(&pool->vz[i], vz);
+		_mm_storeu_ps(&pool->x[i], _mm_add_ps(_mm_loadu_ps(&pool->x[i]), _mm_mul_ps(vx, dts)));
+		_mm_storeu_ps(&pool->y[i], _mm_add_ps(_mm_loadu_ps(&pool->y[i]), _mm_mul_ps(vy, dts)));
+		_mm_storeu_ps(&pool->z[i], _mm_add_ps(_mm_loadu_ps(&pool->z[i]), _mm_mul_ps(vz, dts)));
+		_mm_storeu_ps(&pool->age[i], _mm_add_ps(_mm_loadu_ps(&pool->age[i]), dts));
+		_mm_storeu_ps(&pool->size[i], _mm_add_ps(_mm_loadu_ps(&pool->size[i]), grow));
+	}
+#else
+	for (; i < pool->count; i++) {
+		pool->vx[i] *= emitter.drag;
+		pool->vy[i] = pool->vy[i] * emitter.drag - emitter.gravity * dt;
+		pool->vz[i] *= emitter.drag;
+		pool->x[i] += pool->vx[i] * dt;
+		pool->y[i] += pool->vy[i] * dt;
+		pool->z[i] += pool->vz[i] * dt;
+		pool->age[i] += dt;
+		pool->size[i] += emitter.growth * dt;
+	}
+#endif
+}
+
+void moveParticle(ParticlePool* pool, int from, int to) {
+	pool->x[to] = pool->x[from];
+	pool->y[to] = pool->y[from];
+	pool->z[to] = pool->z[from];
+	pool->vx[to] = pool->vx[from];
+	pool->vy[to] = pool->vy[from];
+	pool->vz[to] = pool->vz[from];
+	pool->age[to] = pool->age[from];
+	pool->lifetime[to] = pool->lifetime[from];
+	pool->size[to] = pool->size[from];
+}
+
+//swap-removes dead particles, returns how many there were
+int compactParticlePool(ParticlePool* pool) {
+	int retired = 0;
+	int i = 0;
+	while (i < pool->count) {
+#ifdef RTS_SSE2
+		//skip four at a time while nobody in the group has died
+		if (i + 4 <= pool->count) {
+			__m128 dead = _mm_cmpge_ps(_mm_loadu_ps(&pool->age[i]), _mm_loadu_ps(&pool->lifetime[i]));
+			if (_mm_movemask_ps(dead) == 0) {
+				i += 4;
+				continue;
+			}
+		}
+#endif
+		if (pool->age[i] >= pool->lifetime[i]) {
+			//the last particle might be dead too, so look at slot i again
+			moveParticle(pool, pool->count - 1, i);
+			pool->count--;
+			retired++;
+		}
+		else {
+			i++;
+		}
+	}
+
+	//clear what was vacated so the kernels never run over stale dead particles
+	for (int k = pool->count; k < pool->count + retired && k < pool->capacity; k++) {
+		pool->age[k] = 0.0f;
+		pool->lifetime[k] = 1.0f;
+	}
+	return retired;
+}
+
+//updates every pool and opens this tick's spawn budgets
+void updateParticles(ParticleSystem* particles, float dt) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	int live = 0;
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++) {
+		ParticlePool* pool = &particles->pools[t];
+		updateParticlePool(pool, dt);
+		particles->stats.retired += compactParticlePool(pool);
+		pool->spawnsLeft = PARTICLE_EMITTERS[t].spawnsPerTick;
+		live += pool->count;
+	}
+
+	particles->stats.live = live;
+	particles->stats.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//interleaves a pool into the instances the renderer draws, reusing out's storage
+void gatherParticleInstances(const ParticlePool* pool, std::vector<ParticleInstance>* out) {
+	out->resize(pool->count);
+	for (int i = 0; i < pool->count; i++) {
+		ParticleInstance& instance = (*out)[i];
+		instance.position[0] = pool->x[i];
+		instance.position[1] = pool->y[i];
+		instance.position[2] = pool->z[i];
+		instance.size = pool->size[i];
+		instance.fade = pool->age[i] / pool->lifetime[i];
+	}
+}
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+
+#include "simd.h"
+
+// Grid A* over the flowCells, 8-connected, never cutting the corner of a blocked cell.
+//
+// The search is Jump Point Search, which only pushes the cells where a straight or
+// diagonal run has to turn. Each step costs PATH_STRAIGHT_COST or PATH_DIAGONAL_COST plus
+// the discomfort of the cell entered, so JPS only holds over ground that costs the same
+// throughout: runs only cross interior cells, whose walkable neighbours all share their
+// discomfort, and stop on the first cell where that changes. Those boundary cells are
+// expanded neighbour by neighbour as in plain A*, and whatever they open on the far side
+// jumps again. Slopes and patches of discomfort are mostly interior, so most of a search
+// still jumps however much of the map carries discomfort.
+//
+// With no discomfort anywhere every walkable cell is interior and the search is optimal.
+// Otherwise the heuristic is inflated by PATH_FALLBACK_WEIGHT (paths are at most that
+// much longer than the best one, in exchange for far fewer expansions).
+//
+// Straight runs are scanned 64 cells at a time from bitsets of the walkable and interior
+// cells, each laid out by rows and by columns, so long open runs cost a few word loads.
+//
+// All per-cell search state is kept between queries and stamped with the query's
+// generation, so a query never allocates or clears anything once the arrays have grown.
+// The open set is a bucket queue indexed by f, a singly linked LIFO list per bucket.
+
+const int PATH_STRAIGHT_COST = 10;
+const int PATH_DIAGONAL_COST = 14;
+const int PATH_DISCOMFORT_COST = 10;  //per point of discomfort on the cell being entered
+const uint8_t PATH_BLOCKED = 255;
+const float PATH_FALLBACK_WEIGHT = 1.5f;
+//f past this lands in the last bucket, which is popped in no particular order
+const int PATH_MAX_BUCKETS = 1 << 22;
+const int PATH_CANCEL_INTERVAL = 1024;
+
+struct PathGrid {
+	int width{ 0 };
+	int height{ 0 };
+	std::vector<uint8_t> costs;  //discomfort of each cell, PATH_BLOCKED if impassable
+	int weightedCells{ 0 };      //passable cells with discomfort, the heuristic is exact when there are none
+
+	//walkable cells, cell (x, y) is bit x + 64 of row y in rowBits and bit y + 64 of column x
+	//in columnBits; the padding word either side reads as blocked
+	std::vector<uint64_t> rowBits;
+	std::vector<uint64_t> columnBits;
+	//walkable cells whose walkable neighbours all have the same discomfort, laid out the same way
+	std::vector<uint64_t> rowInterior;
+	std::vector<uint64_t> columnInterior;
+	int rowWords{ 0 };
+	int columnWords{ 0 };
+};
+
+struct PathStats {
+	int expanded{ 0 };
+	int pushed{ 0 };
+	int cost{ 0 };
+	int jumped{ 0 };  //expansions that jumped rather than stepping to each neighbour
+};
+
+struct PathSearch {
+	std::vector<int> g;
+	std::vector<int> parent;
+	std::vector<uint32_t> openStamps;   //g and parent are only valid when this matches generation
+	std::vector<uint32_t> closedStamps;
+	uint32_t generation{ 0 };
+
+	std::vector<int> bucketHeads;
+	std::vector<uint32_t> bucketStamps; //a bucket is empty unless this matches generation
+	std::vector<int> entryCells;
+	std::vector<int> entryNext;
+	int minBucket{ 0 };
+	int queued{ 0 };
+
+	//polled every PATH_CANCEL_INTERVAL expansions, the search gives up when it is set
+	const std::atomic<bool>* cancel{ NULL };
+
+	PathStats stats;
+};
+
+void setPathBit(std::vector<uint64_t>& bits, int words, int line, int position, bool walkable) {
+	uint64_t& word = bits[line * words + ((position + 64) >> 6)];
+	uint64_t mask = 1ull << ((position + 64) & 63);
+	word = walkable ? (word | mask) : (word & ~mask);
+}
+
+inline bool pathBit(const std::vector<uint64_t>& bits, int words, int line, int position) {
+	return (bits[line * words + ((position + 64) >> 6)] >> ((position + 64) & 63)) & 1;
+}
+
+//64 walkable flags along line starting at position, anything off the grid is blocked
+inline uint64_t pathBits(const std::vector<uint64_t>& bits, int words, int lines, int line, int position) {
+	if (line < 0 || line >= lines) {
+		return 0;
+	}
+	const uint64_t* row = &bits[line * words];
+	int bit = position + 64;
+	int word = bit >> 6;
+	int offset = bit & 63;
+	uint64_t result = row[word] >> offset;
+	if (offset != 0) {
+		result |= row[word + 1] << (64 - offset);
+	}
+	return result;
+}
+
+void initPathGrid(PathGrid* grid, int width, int height) {
+	grid->width = width;
+	grid->height = height;
+	grid->costs.assign(width * height, 0);
+	grid->weightedCells = 0;
+
+	//a scan can run a word past the end of a line before it finds the edge
+	grid->rowWords = (width + 63) / 64 + 3;
+	grid->columnWords = (height + 63) / 64 + 3;
+	grid->rowBits.assign(height * grid->rowWords, 0);
+	grid->columnBits.assign(width * grid->columnWords, 0);
+	grid->rowInterior.assign(height * grid->rowWords, 0);
+	grid->columnInterior.assign(width * grid->columnWords, 0);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			setPathBit(grid->rowBits, grid->rowWords, y, x, true);
+			setPathBit(grid->columnBits, grid->columnWords, x, y, true);
+			setPathBit(grid->rowInterior, grid->rowWords, y, x, true);
+			setPathBit(grid->columnInterior, grid->columnWords, x, y, true);
+		}
+	}
+}
+
+bool pathCellInterior(const PathGrid* grid, int x, int y) {
+	uint8_t cost = grid->costs[y * grid->width + x];
+	if (cost == PATH_BLOCKED) {
+		return false;
+	}
+	for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, grid->height - 1); ny++) {
+		for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, grid->width - 1); nx++) {
+			uint8_t neighbour = grid->costs[ny * grid->width + nx];
+			if (neighbour != cost && neighbour != PATH_BLOCKED) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//brings the bits of (x, y), and the interior bits of its neighbours, up to date with its cost
+void refreshPathBits(PathGrid* grid, int x, int y) {
+	bool walkable = grid->costs[y * grid->width + x] != PATH_BLOCKED;
+	setPathBit(grid->rowBits, grid->rowWords, y, x, walkable);
+	setPathBit(grid->columnBits, grid->columnWords, x, y, walkable);
+
+	for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, grid->height - 1); ny++) {
+		for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, grid->width - 1); nx++) {
+			bool interior = pathCellInterior(grid, nx, ny);
+			setPathBit(grid->rowInterior, grid->rowWords, ny, nx, interior);
+			setPathBit(grid->columnInterior, grid->columnWords, nx, ny, interior);
+		}
+	}
+}
+
+void setPathCellDiscomfort(PathGrid* grid, int cell, int discomfort) {
+	uint8_t cost = discomfort >= IMPASSABLE_DISCOMFORT ? PATH_BLOCKED : (uint8_t)(discomfort > 0 ? discomfort : 0);
+	uint8_t previous = grid->costs[cell];
+	if (cost == previous) {
+		return;
+	}
+	grid->weightedCells += (cost != 0 && cost != PATH_BLOCKED) - (previous != 0 && previous != PATH_BLOCKED);
+	grid->costs[cell] = cost;
+	refreshPathBits(grid, cell % grid->width, cell / grid->width);
+}
+
+inline bool pathWalkable(const PathGrid* grid, int x, int y) {
+	return x >= 0 && y >= 0 && x < grid->width && y < grid->height && grid->costs[y * grid->width + x] != PATH_BLOCKED;
+}
+
+//cost of the cheapest unobstructed route between two cells, ignoring discomfort
+inline int octileDistance(int x0, int y0, int x1, int y1) {
+	int dx = abs(x1 - x0);
+	int dy = abs(y1 - y0);
+	int diagonal = dx < dy ? dx : dy;
+	int straight = dx + dy - 2 * diagonal;
+	return diagonal * PATH_DIAGONAL_COST + straight * PATH_STRAIGHT_COST;
+}
+
+//starts a query, growing the per-cell arrays if the grid got bigger
+void beginPathSearch(PathSearch* search, int cellCount) {
+	if (search->g.size() < cellCount) {
+		search->g.resize(cellCount);
+		search->parent.resize(cellCount);
+		search->openStamps.resize(cellCount, 0);
+		search->closedStamps.resize(cellCount, 0);
+	}
+
+	search->generation++;
+	if (search->generation == 0) {
+		//stamps wrapped around, anything left from 2^32 queries ago would look current
+		std::fill(search->openStamps.begin(), search->openStamps.end(), 0);
+		std::fill(search->closedStamps.begin(), search->closedStamps.end(), 0);
+		std::fill(search->bucketStamps.begin(), search->bucketStamps.end(), 0);
+		search->generation = 1;
+	}
+
+	search->entryCells.clear();
+	search->entryNext.clear();
+	search->minBucket = 0;
+	search->queued = 0;
+	search->stats = PathStats();
+}
+
+void pushPathEntry(PathSearch* search, int cell, int f) {
+	int bucket = f < PATH_MAX_BUCKETS ? f : PATH_MAX_BUCKETS - 1;
+	if (bucket >= search->bucketHeads.size()) {
+		int size = search->bucketHeads.size() ? (int)search->bucketHeads.size() : 1024;
+		while (size <= bucket) {
+			size *= 2;
+		}
+		search->bucketHeads.resize(size);
+		search->bucketStamps.resize(size, 0);
+	}
+
+	if (search->bucketStamps[bucket] != search->generation) {
+		search->bucketStamps[bucket] = search->generation;
+		search->bucketHeads[bucket] = -1;
+	}
+
+	search->entryCells.push_back(cell);
+	search->entryNext.push_back(search->bucketHeads[bucket]);
+	search->bucketHeads[bucket] = (int)search->entryCells.size() - 1;
+
+	//the inflated heuristic can put a successor below the bucket being popped
+	if (bucket < search->minBucket) {
+		search->minBucket = bucket;
+	}
+	search->queued++;
+	search->stats.pushed++;
+}
+
+//returns -1 when the queue is empty
+int popPathEntry(PathSearch* search) {
+	if (search->queued == 0) {
+		return -1;
+	}
+
+	while (search->bucketStamps[search->minBucket] != search->generation || search->bucketHeads[search->minBucket] == -1) {
+		search->minBucket++;
+	}
+
+	int entry = search->bucketHeads[search->minBucket];
+	search->bucketHeads[search->minBucket] = search->entryNext[entry];
+	search->queued--;
+	return search->entryCells[entry];
+}
+
+//opens cell with cost g through parent if that is better than what it has, returns true if it was
+bool relaxPathCell(PathSearch* search, int cell, int parent, int g, int h) {
+	if (search->closedStamps[cell] == search->generation) {
+		return false;
+	}
+	if (search->openStamps[cell] == search->generation && search->g[cell] <= g) {
+		return false;
+	}
+
+	//cells already queued with a worse g are left in their bucket and skipped when popped closed
+	search->openStamps[cell] = search->generation;
+	search->g[cell] = g;
+	search->parent[cell] = parent;
+	pushPathEntry(search, cell, g + h);
+	return true;
+}
+
+inline bool pathSearchCancelled(const PathSearch* search) {
+	return search->cancel != NULL && search->stats.expanded % PATH_CANCEL_INTERVAL == 0 && search->cancel->load(std::memory_order_relaxed);
+}
+
+//walks the parent chain back from goal, filling in the cells between jump points
+void reconstructPath(PathSearch* search, int width, int start, int goal, std::vector<int>* cellsOut) {
+	cellsOut->clear();
+	int cell = goal;
+	while (cell != start) {
+		int parent = search->parent[cell];
+		int x = cell % width;
+		int y = cell / width;
+		int dx = (parent % width > x) - (parent % width < x);
+		int dy = (parent / width > y) - (parent / width < y);
+		while (cell != parent) {
+			cellsOut->push_back(cell);
+			x += dx;
+			y += dy;
+			cell = y * width + x;
+		}
+	}
+	std::reverse(cellsOut->begin(), cellsOut->end());
+}
+
+//runs along line (a row of bits or a column of bits) from position in direction (+1 or -1),
+//returns the position of the first jump point or -1. A cell is a jump point when one of the
+//lines beside it opens up there, as the parent could not have reached that side directly,
+//or when it isn't interior, as the discomfort changes around it
+int scanJumpLine(const std::vector<uint64_t>& bits, const std::vector<uint64_t>& interior, int words, int lines, int line, int position, int direction, bool goalOnLine, int goalPosition) {
+	if (direction > 0) {
+		while (true) {
+			uint64_t inside = pathBits(interior, words, lines, line, position);
+			uint64_t before = pathBits(bits, words, lines, line - 1, position);
+			uint64_t beforeBehind = pathBits(bits, words, lines, line - 1, position - 1);
+			uint64_t after = pathBits(bits, words, lines, line + 1, position);
+			uint64_t afterBehind = pathBits(bits, words, lines, line + 1, position - 1);
+
+			uint64_t stops = ~inside | (before & ~beforeBehind) | (after & ~afterBehind);
+			if (goalOnLine && goalPosition >= position && goalPosition < position + 64) {
+				stops |= 1ull << (goalPosition - position);
+			}
+			if (stops) {
+				int i = lowestSetBit(stops);
+				return pathBit(bits, words, line, position + i) ? position + i : -1;
+			}
+			position += 64;
+		}
+	}
+
+	while (true) {
+		//bit 63 is position, bit 0 is 63 cells back
+		int first = position - 63;
+		uint64_t inside = pathBits(interior, words, lines, line, first);
+		uint64_t before = pathBits(bits, words, lines, line - 1, first);
+		uint64_t beforeBehind = pathBits(bits, words, lines, line - 1, first + 1);
+		uint64_t after = pathBits(bits, words, lines, line + 1, first);
+		uint64_t afterBehind = pathBits(bits, words, lines, line + 1, first + 1);
+
+		uint64_t stops = ~inside | (before & ~beforeBehind) | (after & ~afterBehind);
+		if (goalOnLine && goalPosition >= first && goalPosition <= position) {
+			stops |= 1ull << (goalPosition - first);
+		}
+		if (stops) {
+			int i = highestSetBit(stops);
+			return pathBit(bits, words, line, first + i) ? first + i : -1;
+		}
+		position -= 64;
+	}
+}
+
+//runs along a row or column from (x, y), returns the first jump point or -1
+int jumpStraight(const PathGrid* grid, int x, int y, int dx, int dy, int goal) {
+	int goalX = goal % grid->width;
+	int goalY = goal / grid->width;
+	if (dx != 0) {
+		int jx = scanJumpLine(grid->rowBits, grid->rowInterior, grid->rowWords, grid->height, y, x, dx, goalY == y, goalX);
+		return jx == -1 ? -1 : y * grid->width + jx;
+	}
+	int jy = scanJumpLine(grid->columnBits, grid->columnInterior, grid->columnWords, grid->width, x, y, dy, goalX == x, goalY);
+	return jy == -1 ? -1 : jy * grid->width + x;
+}
+
+//(x, y) is the first cell past the one being expanded
+int jump(const PathGrid* grid, int x, int y, int dx, int dy, int goal) {
+	if (dx == 0 || dy == 0) {
+		return jumpStraight(grid, x, y, dx, dy, goal);
+	}
+
+	while (true) {
+		if (!pathWalkable(grid, x, y)) {
+			return -1;
+		}
+		int cell = y * grid->width + x;
+		if (cell == goal || !pathBit(grid->rowInterior, grid->rowWords, y, x)) {
+			return cell;
+		}
+
+		//a diagonal cell is a jump point if either straight run out of it finds one
+		if (jumpStraight(grid, x + dx, y, dx, 0, goal) != -1 || jumpStraight(grid, x, y + dy, 0, dy, goal) != -1) {
+			return cell;
+		}
+
+		if (!pathWalkable(grid, x + dx, y) || !pathWalkable(grid, x, y + dy)) {
+			return -1;
+		}
+		x += dx;
+		y += dy;
+	}
+}
+
+//directions worth jumping in out of (x, y) having arrived moving (dx, dy), returns how many
+int prunedDirections(const PathGrid* grid, int x, int y, int dx, int dy, int* directionsOut) {
+	int count = 0;
+	if (dx == 0 && dy == 0) {
+		//the start, everything is a candidate
+		for (int ny = -1; ny <= 1; ny++) {
+			for (int nx = -1; nx <= 1; nx++) {
+				if ((nx != 0 || ny != 0) && pathWalkable(grid, x + nx, y + ny) &&
+					(nx == 0 || ny == 0 || (pathWalkable(grid, x + nx, y) && pathWalkable(grid, x, y + ny)))) {
+					directionsOut[2 * count] = nx;
+					directionsOut[2 * count + 1] = ny;
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+#define PATH_DIRECTION(nx, ny) { directionsOut[2 * count] = (nx); directionsOut[2 * count + 1] = (ny); count++; }
+	if (dx != 0 && dy != 0) {
+		bool walkX = pathWalkable(grid, x + dx, y);
+		bool walkY = pathWalkable(grid, x, y + dy);
+		if (walkY) PATH_DIRECTION(0, dy);
+		if (walkX) PATH_DIRECTION(dx, 0);
+		if (walkX && walkY) PATH_DIRECTION(dx, dy);
+	}
+	else if (dx != 0) {
+		bool walkNext = pathWalkable(grid, x + dx, y);
+		bool walkUp = pathWalkable(grid, x, y + 1);
+		bool walkDown = pathWalkable(grid, x, y - 1);
+		if (walkNext) {
+			PATH_DIRECTION(dx, 0);
+			if (walkUp) PATH_DIRECTION(dx, 1);
+			if (walkDown) PATH_DIRECTION(dx, -1);
+		}
+		if (walkUp) PATH_DIRECTION(0, 1);
+		if (walkDown) PATH_DIRECTION(0, -1);
+	}
+	else {
+		bool walkNext = pathWalkable(grid, x, y + dy);
+		bool walkRight = pathWalkable(grid, x + 1, y);
+		bool walkLeft = pathWalkable(grid, x - 1, y);
+		if (walkNext) {
+			PATH_DIRECTION(0, dy);
+			if (walkRight) PATH_DIRECTION(1, dy);
+			if (walkLeft) PATH_DIRECTION(-1, dy);
+		}
+		if (walkRight) PATH_DIRECTION(1, 0);
+		if (walkLeft) PATH_DIRECTION(-1, 0);
+	}
+#undef PATH_DIRECTION
+
+	return count;
+}
+
+//opens each neighbour of (x, y) the move to it doesn't cut a corner of
+void relaxPathNeighbours(PathSearch* search, const PathGrid* grid, int x, int y, int goalX, int goalY, float weight) {
+	int width = grid->width;
+	int cell = y * width + x;
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			int nx = x + dx;
+			int ny = y + dy;
+			if ((dx == 0 && dy == 0) || !pathWalkable(grid, nx, ny)) {
+				continue;
+			}
+			bool diagonal = dx != 0 && dy != 0;
+			if (diagonal && (!pathWalkable(grid, nx, y) || !pathWalkable(grid, x, ny))) {
+				continue;
+			}
+
+			int neighbour = ny * width + nx;
+			int step = (diagonal ? PATH_DIAGONAL_COST : PATH_STRAIGHT_COST) + grid->costs[neighbour] * PATH_DISCOMFORT_COST;
+			relaxPathCell(search, neighbour, cell, search->g[cell] + step, (int)(weight * octileDistance(nx, ny, goalX, goalY)));
+		}
+	}
+}
+
+bool findPathJumpPoints(PathSearch* search, const PathGrid* grid, int start, int goal, float weight, std::vector<int>* cellsOut) {
+	int width = grid->width;
+	int goalX = goal % width;
+	int goalY = goal / width;
+
+	beginPathSearch(search, width * grid->height);
+	relaxPathCell(search, start, start, 0, (int)(weight * octileDistance(start % width, start / width, goalX, goalY)));
+
+	int directions[16];
+	int cell;
+	while ((cell = popPathEntry(search)) != -1) {
+		if (search->closedStamps[cell] == search->generation) {
+			continue;
+		}
+		search->closedStamps[cell] = search->generation;
+		search->stats.expanded++;
+		if (pathSearchCancelled(search)) {
+			return false;
+		}
+
+		if (cell == goal) {
+			search->stats.cost = search->g[goal];
+			reconstructPath(search, width, start, goal, cellsOut);
+			return true;
+		}
+
+		int x = cell % width;
+		int y = cell / width;
+		//the discomfort changes around here (or it's a blocked start), so step rather than jump
+		if (!pathBit(grid->rowInterior, grid->rowWords, y, x)) {
+			relaxPathNeighbours(search, grid, x, y, goalX, goalY, weight);
+			continue;
+		}
+		search->stats.jumped++;
+
+		int parent = search->parent[cell];
+		int dx = (x > parent % width) - (x < parent % width);
+		int dy = (y > parent / width) - (y < parent / width);
+		//every cell a run crosses, and the jump point it ends on, costs what this one does
+		int discomfort = grid->costs[cell] * PATH_DISCOMFORT_COST;
+
+		int count = prunedDirections(grid, x, y, dx, dy, directions);
+		for (int i = 0; i < count; i++) {
+			int jumpPoint = jump(grid, x + directions[2 * i], y + directions[2 * i + 1], directions[2 * i], directions[2 * i + 1], goal);
+			if (jumpPoint == -1) {
+				continue;
+			}
+			int jx = jumpPoint % width;
+			int jy = jumpPoint / width;
+			int steps = std::max(abs(jx - x), abs(jy - y));
+			relaxPathCell(search, jumpPoint, cell, search->g[cell] + octileDistance(x, y, jx, jy) + steps * discomfort,
+				(int)(weight * octileDistance(jx, jy, goalX, goalY)));
+		}
+	}
+
+	return false;
+}
+
+//fills cellsOut with the cells to walk through after start, ending with goal;
+//start may be blocked (a unit pushed onto a wall), goal may not
+bool findPath(PathSearch* search, const PathGrid* grid, int start, int goal, std::vector<int>* cellsOut) {
+	cellsOut->clear();
+	int cellCount = grid->width * grid->height;
+	if (start < 0 || goal < 0 || start >= cellCount || goal >= cellCount || grid->costs[goal] == PATH_BLOCKED) {
+		return false;
+	}
+	if (start == goal) {
+		search->stats = PathStats();
+		return true;
+	}
+
+	return findPathJumpPoints(search, grid, start, goal, grid->weightedCells == 0 ? 1.0f : PATH_FALLBACK_WEIGHT, cellsOut);
+}
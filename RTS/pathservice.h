@@ -0,0 +1,335 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// Runs path searches on worker threads so a burst of move orders doesn't stall a tick.
+//
+// The simulation submits (start cell, goal cell) requests for units and collects whatever
+// has finished at the start of a later tick. Requests with the same start and goal share
+// one search. A unit has at most one request at a time: cancelling takes it off its
+// search, and a search nobody is waiting on any more is skipped, or stopped part way if a
+// worker already has it. Each request carries the unit's generation and a ticket so the
+// caller can drop results for units that were deleted, reused or re-ordered meanwhile.
+//
+// Workers search a read-only copy of the grid that is replaced whenever the simulation
+// publishes an edit, so a path can be a tick or two out of date; units re-plan when they
+// find the next cell on their path blocked. Copies are recycled: publishing takes a copy
+// no worker is searching any more and writes in just the cells edited since that copy
+// was last current, so an edit costs about what it touched rather than the whole map.
+// Only a new map, or a copy that has missed more than PATH_GRID_MAX_MISSED of it, is
+// copied in full.
+//
+// With no worker threads requests are solved as they are submitted, but are still only
+// handed back by collectPathResults.
+
+typedef std::chrono::steady_clock PathClock;
+
+const int PATH_GRID_MAX_MISSED = 16; //a copy missing more than 1/16 of the cells is copied whole
+
+struct PathWaiter {
+	int unit;
+	int generation;
+	uint32_t ticket;
+};
+
+struct PathJob {
+	int start;
+	int goal;
+	std::vector<PathWaiter> waiters;
+	std::atomic<bool> cancelled{ false };
+	PathClock::time_point submitted;
+
+	//written by the worker, only read once the job has been collected
+	bool found{ false };
+	std::vector<int> cells;
+};
+
+struct PathServiceStats {
+	long long submitted{ 0 };
+	long long deduplicated{ 0 };  //submitted requests that joined a search already queued or running
+	long long started{ 0 };
+	long long completed{ 0 };
+	long long cancelled{ 0 };     //searches dropped because nobody was waiting on them
+	double queueMs{ 0.0 };        //summed over started searches, from submission to a worker picking it up
+	double solveMs{ 0.0 };        //summed over started searches
+	int pending{ 0 };             //searches queued or running
+};
+
+//one of the recycled grid copies, see publishPathGrid
+struct PathGridBuffer {
+	std::shared_ptr<PathGrid> grid;
+	std::vector<int> missed;  //cells edited since this copy was last current
+	bool stale{ true };       //needs a full copy instead
+};
+
+struct PathService;
+void stopPathService(PathService* service);
+
+struct PathService {
+	bool started{ false };
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping{ false };
+	std::deque<std::shared_ptr<PathJob>> queue;
+	std::unordered_map<uint64_t, std::shared_ptr<PathJob>> jobs; //queued or running, by pathJobKey
+	std::vector<std::shared_ptr<PathJob>> finished;
+	std::shared_ptr<const PathGrid> grid;
+	PathServiceStats stats;
+	//copies of stats.pending and stats.completed that can be read without the lock, for telemetry
+	std::atomic<int> pendingRelaxed{ 0 };
+	std::atomic<long long> completedRelaxed{ 0 };
+
+	std::vector<PathGridBuffer> gridBuffers; //simulation thread only
+	long long gridCellsCopied{ 0 };          //simulation thread only
+
+	PathSearch inlineSearch;   //for running without workers
+	long long droppedResults{ 0 }; //counted by the caller while collecting, simulation thread only
+
+	~PathService() {
+		stopPathService(this);
+	}
+};
+
+inline uint64_t pathJobKey(int start, int goal) {
+	return ((uint64_t)(uint32_t)start << 32) | (uint32_t)goal;
+}
+
+double pathMillisecondsBetween(PathClock::time_point from, PathClock::time_point to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+//called with the lock held
+void setPathServicePending(PathService* service, int pending) {
+	service->stats.pending = pending;
+	service->pendingRelaxed.store(pending, std::memory_order_relaxed);
+}
+
+//called with the lock held, once a worker (or an inline solve) is done with a job
+void finishPathJob(PathService* service, const std::shared_ptr<PathJob>& job, double solveMs) {
+	service->stats.solveMs += solveMs;
+
+	auto it = service->jobs.find(pathJobKey(job->start, job->goal));
+	if (it != service->jobs.end() && it->second == job) {
+		service->jobs.erase(it);
+	}
+	setPathServicePending(service, (int)service->jobs.size());
+
+	//cancelled jobs were already counted and taken out of jobs when they were cancelled
+	if (!job->cancelled) {
+		service->stats.completed++;
+		service->completedRelaxed.store(service->stats.completed, std::memory_order_relaxed);
+		service->finished.push_back(job);
+	}
+}
+
+void pathWorker(PathService* service) {
+	PathSearch search;
+	std::unique_lock<std::mutex> lock(service->mutex);
+
+	while (true) {
+		service->wake.wait(lock, [service] { return service->stopping || !service->queue.empty(); });
+		if (service->stopping) {
+			return;
+		}
+
+		std::shared_ptr<PathJob> job = service->queue.front();
+		service->queue.pop_front();
+		if (job->cancelled) {
+			continue;
+		}
+
+		std::shared_ptr<const PathGrid> grid = service->grid;
+		auto started = PathClock::now();
+		service->stats.started++;
+		service->stats.queueMs += pathMillisecondsBetween(job->submitted, started);
+		lock.unlock();
+
+		search.cancel = &job->cancelled;
+		job->found = findPath(&search, grid.get(), job->start, job->goal, &job->cells);
+
+		lock.lock();
+		finishPathJob(service, job, pathMillisecondsBetween(started, PathClock::now()));
+	}
+}
+
+void startPathService(PathService* service, int workerCount) {
+	service->started = true;
+	service->stopping = false;
+	for (int i = 0; i < workerCount; i++) {
+		service->workers.push_back(std::thread(pathWorker, service));
+	}
+}
+
+//drops every queued and running search, and any results not collected yet
+void cancelAllPathRequests(PathService* service) {
+	std::lock_guard<std::mutex> lock(service->mutex);
+	for (auto& entry : service->jobs) {
+		entry.second->cancelled = true;
+		service->stats.cancelled++;
+	}
+	service->jobs.clear();
+	service->queue.clear();
+	service->finished.clear();
+	setPathServicePending(service, 0);
+}
+
+void stopPathService(PathService* service) {
+	cancelAllPathRequests(service);
+	{
+		std::lock_guard<std::mutex> lock(service->mutex);
+		service->stopping = true;
+	}
+	service->wake.notify_all();
+
+	for (size_t i = 0; i < service->workers.size(); i++) {
+		service->workers[i].join();
+	}
+	service->workers.clear();
+	service->started = false;
+}
+
+//brings to's cell up to date with from's
+void copyPathCell(PathGrid* to, const PathGrid& from, int cell) {
+	uint8_t cost = from.costs[cell];
+	int x = cell % from.width;
+	int y = cell / from.width;
+	to->costs[cell] = cost;
+	refreshPathBits(to, x, y);
+}
+
+//searches submitted from now on see a copy of grid. edited lists the cells changed since
+//the last publish, or is NULL when anything could have (a new map)
+void publishPathGrid(PathService* service, const PathGrid& grid, const std::vector<int>* edited) {
+	int cellCount = grid.width * grid.height;
+	PathGridBuffer* free = NULL;
+	for (PathGridBuffer& buffer : service->gridBuffers) {
+		if (edited == NULL || buffer.missed.size() + edited->size() > cellCount / PATH_GRID_MAX_MISSED) {
+			buffer.stale = true;
+			buffer.missed.clear();
+		}
+		else if (!buffer.stale) {
+			buffer.missed.insert(buffer.missed.end(), edited->begin(), edited->end());
+		}
+
+		//workers only pick up the current grid, so a copy that isn't current and that no
+		//worker still holds can't be picked up by one while it's rewritten
+		if (free == NULL && buffer.grid != service->grid && buffer.grid.use_count() == 1) {
+			free = &buffer;
+		}
+	}
+
+	if (free == NULL) {
+		service->gridBuffers.push_back(PathGridBuffer());
+		free = &service->gridBuffers.back();
+		free->grid = std::make_shared<PathGrid>();
+	}
+	//pairs with the release of the last worker's reference, so its reads are done
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	PathGrid* copy = free->grid.get();
+	if (free->stale || copy->width != grid.width || copy->height != grid.height) {
+		*copy = grid;
+		service->gridCellsCopied += cellCount;
+	}
+	else {
+		for (int cell : free->missed) {
+			copyPathCell(copy, grid, cell);
+		}
+		copy->weightedCells = grid.weightedCells;
+		service->gridCellsCopied += free->missed.size();
+	}
+	free->missed.clear();
+	free->stale = false;
+
+	std::lock_guard<std::mutex> lock(service->mutex);
+	service->grid = free->grid;
+}
+
+void submitPathRequest(PathService* service, PathWaiter waiter, int start, int goal) {
+	std::unique_lock<std::mutex> lock(service->mutex);
+	service->stats.submitted++;
+
+	uint64_t key = pathJobKey(start, goal);
+	auto it = service->jobs.find(key);
+	if (it != service->jobs.end()) {
+		it->second->waiters.push_back(waiter);
+		service->stats.deduplicated++;
+		return;
+	}
+
+	std::shared_ptr<PathJob> job = std::make_shared<PathJob>();
+	job->start = start;
+	job->goal = goal;
+	job->waiters.push_back(waiter);
+	job->submitted = PathClock::now();
+	service->jobs[key] = job;
+	setPathServicePending(service, (int)service->jobs.size());
+
+	if (!service->workers.empty()) {
+		service->queue.push_back(job);
+		lock.unlock();
+		service->wake.notify_one();
+		return;
+	}
+
+	//no workers, this thread is the only one that can touch the search or the grid
+	auto started = PathClock::now();
+	service->stats.started++;
+	service->stats.queueMs += pathMillisecondsBetween(job->submitted, started);
+	job->found = findPath(&service->inlineSearch, service->grid.get(), start, goal, &job->cells);
+	finishPathJob(service, job, pathMillisecondsBetween(started, PathClock::now()));
+}
+
+//takes unit off the search from start to goal, the search is dropped if that leaves it with nobody
+void cancelPathRequest(PathService* service, int unit, int start, int goal) {
+	std::lock_guard<std::mutex> lock(service->mutex);
+
+	auto it = service->jobs.find(pathJobKey(start, goal));
+	if (it == service->jobs.end()) {
+		return;
+	}
+
+	std::vector<PathWaiter>& waiters = it->second->waiters;
+	for (size_t i = 0; i < waiters.size(); i++) {
+		if (waiters[i].unit == unit) {
+			waiters.erase(waiters.begin() + i);
+			break;
+		}
+	}
+
+	if (waiters.empty()) {
+		it->second->cancelled = true;
+		service->jobs.erase(it);
+		service->stats.cancelled++;
+		setPathServicePending(service, (int)service->jobs.size());
+	}
+}
+
+//moves every search finished since the last call into out
+void collectPathResults(PathService* service, std::vector<std::shared_ptr<PathJob>>* out) {
+	out->clear();
+	std::lock_guard<std::mutex> lock(service->mutex);
+	out->swap(service->finished);
+}
+
+PathServiceStats pathServiceStats(PathService* service) {
+	std::lock_guard<std::mutex> lock(service->mutex);
+	return service->stats;
+}
+
+//the counts telemetry publishes every tick, read without taking the lock so the
+//simulation never waits on a worker for them. May be a search or two behind
+void pathServiceTelemetryCounts(const PathService* service, int* pending, long long* completed) {
+	*pending = service->pendingRelaxed.load(std::memory_order_relaxed);
+	*completed = service->completedRelaxed.load(std::memory_order_relaxed);
+}
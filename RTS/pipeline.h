@@ -0,0 +1,300 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+// Runs the simulation on its own thread so ticking and GL submission overlap.
+//
+// The simulation thread owns the Game. Each tick it copies what the renderer needs into
+// a RenderState and publishes it through a triple buffer: the simulation writes the
+// back slot, swaps it with the ready slot in one atomic exchange, and the main thread
+// swaps the ready slot with its front slot when a new one is available. Neither side
+// ever waits for the other. Input goes the other way through a single producer single
+// consumer queue. The main thread merges mouse motion so only the newest ray per frame
+// is sent (each one means a terrain pick on the simulation thread), and anything that
+// doesn't fit in the queue waits for the next frame rather than being dropped, so a
+// button release can't go missing and leave a drag stuck.
+
+typedef std::chrono::steady_clock PipelineClock;
+
+const int SIMULATION_TICK_RATE = 60;
+const int INPUT_QUEUE_CAPACITY = 1024;
+
+const char* QUICKSAVE_FILE = "quicksave.snapshot";
+
+enum InputCommandType {
+	INPUT_MOUSE_RAY,
+	INPUT_PRIMARY_DOWN,
+	INPUT_PRIMARY_UP,
+	INPUT_SECONDARY_CLICK,
+	INPUT_QUICKSAVE,
+	INPUT_QUICKLOAD
+};
+
+struct InputCommand {
+	InputCommandType type;
+	//for INPUT_MOUSE_RAY, picking against the terrain happens on the simulation thread
+	glm::vec3 rayOrigin;
+	glm::vec3 rayDirection;
+};
+
+//Capacity must be a power of two
+template<typename T, int Capacity>
+struct SpscQueue {
+	T items[Capacity];
+	std::atomic<uint32_t> head{ 0 }; //next to pop, written by the consumer
+	std::atomic<uint32_t> tail{ 0 }; //next to push, written by the producer
+};
+
+template<typename T, int Capacity>
+bool spscPush(SpscQueue<T, Capacity>* queue, const T& item) {
+	uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+	if (tail - queue->head.load(std::memory_order_acquire) == Capacity) {
+		return false;
+	}
+	queue->items[tail & (Capacity - 1)] = item;
+	queue->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T, int Capacity>
+bool spscPop(SpscQueue<T, Capacity>* queue, T* item) {
+	uint32_t head = queue->head.load(std::memory_order_relaxed);
+	if (head == queue->tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+	*item = queue->items[head & (Capacity - 1)];
+	queue->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+//main thread side of the input queue, see the top of this file
+struct InputSender {
+	std::deque<InputCommand> waiting; //in order, for the queue
+	InputCommand ray;                 //newest mouse ray not yet in waiting
+	bool hasRay{ false };
+};
+
+void queueMouseRay(InputSender* sender, const InputCommand& ray) {
+	sender->ray = ray;
+	sender->hasRay = true;
+}
+
+void flushMouseRay(InputSender* sender) {
+	if (!sender->hasRay) {
+		return;
+	}
+	//a ray still waiting from an earlier frame is out of date, replace it
+	if (!sender->waiting.empty() && sender->waiting.back().type == INPUT_MOUSE_RAY) {
+		sender->waiting.back() = sender->ray;
+	}
+	else {
+		sender->waiting.push_back(sender->ray);
+	}
+	sender->hasRay = false;
+}
+
+//buttons and keys, the ray goes first so they apply where the mouse was at the time
+void queueInput(InputSender* sender, const InputCommand& input) {
+	flushMouseRay(sender);
+	sender->waiting.push_back(input);
+}
+
+//once a frame, after polling events: pushes as much as fits, the rest waits for the next frame
+void sendInputs(InputSender* sender, SpscQueue<InputCommand, INPUT_QUEUE_CAPACITY>* queue) {
+	flushMouseRay(sender);
+	while (!sender->waiting.empty() && spscPush(queue, sender->waiting.front())) {
+		sender->waiting.pop_front();
+	}
+}
+
+//everything render() needs from a tick
+struct RenderState {
+	TanksData tanks; //only the tanks the player can see
+	GLfloat groundSelectionQuadVertices[12]{};
+	bool primaryButtonDown{ false };
+	glm::vec3 mouseGroundIntersection{ 0.0f };
+	std::vector<ParticleInstance> particles[PARTICLE_TYPE_COUNT];
+
+	uint64_t tick{ 0 };
+	PipelineClock::time_point tickStarted{ PipelineClock::now() };
+	double simulationMs{ 0.0 };
+};
+
+const int RENDER_STATE_NEW = 4;
+const int RENDER_STATE_INDEX = 3;
+
+struct RenderStateBuffers {
+	RenderState states[3];
+	int back{ 0 };                 //owned by the simulation
+	std::atomic<int> ready{ 1 };   //slot index, plus RENDER_STATE_NEW when not yet taken
+	int front{ 2 };                //owned by the renderer
+};
+
+RenderState* backRenderState(RenderStateBuffers* buffers) {
+	return &buffers->states[buffers->back];
+}
+
+void publishRenderState(RenderStateBuffers* buffers) {
+	int previous = buffers->ready.exchange(buffers->back | RENDER_STATE_NEW, std::memory_order_acq_rel);
+	buffers->back = previous & RENDER_STATE_INDEX;
+}
+
+//swaps in the newest published state if there is one, returns the state to draw
+const RenderState* acquireRenderState(RenderStateBuffers* buffers) {
+	if (buffers->ready.load(std::memory_order_relaxed) & RENDER_STATE_NEW) {
+		int previous = buffers->ready.exchange(buffers->front, std::memory_order_acq_rel);
+		buffers->front = previous & RENDER_STATE_INDEX;
+	}
+	return &buffers->states[buffers->front];
+}
+
+struct Simulation {
+	Game* game;
+	SpscQueue<InputCommand, INPUT_QUEUE_CAPACITY> inputs;
+	RenderStateBuffers renderStates;
+	std::atomic<bool> running{ false };
+	std::thread thread;
+	uint64_t ticks{ 0 };
+};
+
+void applyInput(Game* game, const InputCommand& input) {
+	switch (input.type) {
+	case INPUT_MOUSE_RAY:
+		//off the edge of the map there is no terrain, fall back to the y=0 plane
+		if (!rayTerrainIntersection(&game->terrain, input.rayDirection, input.rayOrigin, &game->currentMouseGroundIntersection)) {
+			rayGroundPlaneIntersection(input.rayDirection, input.rayOrigin, &game->currentMouseGroundIntersection);
+		}
+
+		if (game->primaryButtonDown) {
+			game->mouseDragData.drag = game->currentMouseGroundIntersection;
+		}
+		break;
+	case INPUT_PRIMARY_DOWN:
+		if (!game->primaryButtonDown) {
+			//start dragging here
+			game->primaryButtonDown = true;
+			game->mouseDragData.origin = game->currentMouseGroundIntersection;
+			game->mouseDragData.drag = game->currentMouseGroundIntersection;
+			resetSelectionQuadVertices(game);
+		}
+		break;
+	case INPUT_PRIMARY_UP:
+		//stop dragging here
+		game->primaryButtonDown = false;
+		break;
+	case INPUT_SECONDARY_CLICK:
+		game->secondaryButtonClicked = true;
+		break;
+	case INPUT_QUICKSAVE:
+		saveSnapshot(game, QUICKSAVE_FILE, false);
+		break;
+	case INPUT_QUICKLOAD:
+		loadSnapshot(game, QUICKSAVE_FILE);
+		break;
+	}
+}
+
+//drains input, ticks once and publishes the result
+void simulationStep(Simulation* sim) {
+	Game* game = sim->game;
+	auto tickStarted = PipelineClock::now();
+
+	InputCommand input;
+	while (spscPop(&sim->inputs, &input)) {
+		applyInput(game, input);
+	}
+
+	tick(game);
+	sim->ticks++;
+
+	RenderState* state = backRenderState(&sim->renderStates);
+	//enemy tanks under the fog of war are not handed to the renderer at all
+	gatherVisibleTanks(game, game->playerTeam, &state->tanks);
+	memcpy(state->groundSelectionQuadVertices, game->groundSelectionQuadVertices, sizeof(state->groundSelectionQuadVertices));
+	state->primaryButtonDown = game->primaryButtonDown;
+	for (int t = 0; t < PARTICLE_TYPE_COUNT; t++) {
+		gatherParticleInstances(&game->particles.pools[t], &state->particles[t]);
+	}
+
+	//uncomment these lines to snap the mouse pointer to grid lines
+	//float tempCoords[2];
+	//int tmpIdx = realCoordsToMapIndex(game, game->currentMouseGroundIntersection.x, game->currentMouseGroundIntersection.z);
+	//mapIndexToRealCorrds(game, tmpIdx, tempCoords);
+	//game->currentMouseGroundIntersection.x = tempCoords[0];
+	//game->currentMouseGroundIntersection.z = tempCoords[1];
+	state->mouseGroundIntersection = game->currentMouseGroundIntersection;
+
+	state->tick = sim->ticks;
+	state->tickStarted = tickStarted;
+	state->simulationMs = std::chrono::duration<double, std::milli>(PipelineClock::now() - tickStarted).count();
+
+	publishRenderState(&sim->renderStates);
+}
+
+void simulationThread(Simulation* sim) {
+	auto tickLength = std::chrono::duration_cast<PipelineClock::duration>(std::chrono::duration<double>(1.0 / SIMULATION_TICK_RATE));
+	auto nextTick = PipelineClock::now();
+
+	while (sim->running.load(std::memory_order_relaxed)) {
+		simulationStep(sim);
+
+		nextTick += tickLength;
+		auto now = PipelineClock::now();
+		if (now > nextTick + tickLength) {
+			//fell more than a tick behind, don't try to catch up in a burst
+			nextTick = now;
+		}
+		std::this_thread::sleep_until(nextTick);
+	}
+}
+
+void startSimulation(Simulation* sim, Game* game) {
+	sim->game = game;
+	sim->running = true;
+	sim->thread = std::thread(simulationThread, sim);
+}
+
+void stopSimulation(Simulation* sim) {
+	if (sim->running) {
+		sim->running = false;
+		sim->thread.join();
+	}
+}
+
+// Rolling frame timings, reported once per second.
+struct FrameStats {
+	PipelineClock::time_point windowStart{ PipelineClock::now() };
+	int frames{ 0 };
+	double simulationMs{ 0.0 };
+	double renderMs{ 0.0 };
+	double frameMs{ 0.0 };
+	double latencyMs{ 0.0 };  //start of the tick to the frame showing it being swapped
+};
+
+//returns true once a second, with the averages over that second in averagesOut
+bool recordFrame(FrameStats* stats, const RenderState* state, PipelineClock::time_point frameStart, PipelineClock::time_point renderStart, FrameStats* averagesOut) {
+	auto now = PipelineClock::now();
+	stats->frames++;
+	stats->simulationMs += state->simulationMs;
+	stats->renderMs += std::chrono::duration<double, std::milli>(now - renderStart).count();
+	stats->frameMs += std::chrono::duration<double, std::milli>(now - frameStart).count();
+	stats->latencyMs += std::chrono::duration<double, std::milli>(now - state->tickStarted).count();
+
+	if (now - stats->windowStart < std::chrono::seconds(1)) {
+		return false;
+	}
+
+	*averagesOut = *stats;
+	averagesOut->simulationMs /= stats->frames;
+	averagesOut->renderMs /= stats->frames;
+	averagesOut->frameMs /= stats->frames;
+	averagesOut->latencyMs /= stats->frames;
+
+	*stats = FrameStats();
+	stats->windowStart = now;
+	return true;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+in vec4 particleColour;
+in vec2 quadPos;
+
+out vec4 LFragment;
+
+void main() {
+	// soft round particle out of the square quad
+	float edge = 1.0f - smoothstep(0.3f, 0.5f, length(quadPos));
+	LFragment = vec4(particleColour.rgb, particleColour.a * edge);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#version 330 core
+
+#extension GL_ARB_explicit_uniform_location : enable
+
+layout (location=1) uniform mat4 model;
+layout (location=2) uniform mat4 view;
+layout (location=3) uniform mat4 projection;
+layout (location=4) uniform vec4 colour;
+
+layout (location=1) in vec2 corner; // of the unit quad, -0.5 to 0.5
+layout (location=2) in vec3 centre;
+layout (location=3) in float size;
+layout (location=4) in float fade; // 0 when spawned, 1 when it dies
+
+out vec4 particleColour;
+out vec2 quadPos;
+
+void main() {
+	// billboard: offset the corner in view space so the quad always faces the camera
+	vec4 viewPos = view * model * vec4(centre, 1.0f);
+	viewPos.xy += corner * size;
+
+	particleColour = vec4(colour.rgb, colour.a * (1.0f - fade));
+	quadPos = corner;
+	gl_Position = projection * viewPos;
+}
\ No newline at end of file
@@ -9,6 +9,9 @@ layout (location=2) in vec3 translation;
 layout (location=3) in vec3 normal;
 layout (location=4) in float heading;
 layout (location=5) in vec4 tint;
+layout (location=6) in vec2 tilt; // pitch, roll to sit on the terrain
+layout (location=7) in float part; // 0 for the hull, 1 for parts that turn with the turret
+layout (location=8) in float turretDirection; // relative to the hull
 
 layout (location=1) uniform mat4 model;
 layout (location=2) uniform mat4 view;
@@ -39,6 +42,17 @@ mat4 BuildRotateX(float t) {
 	return rotationMatrix;
 }
 
+mat4 BuildRotateZ(float t) {
+	mat4 rotationMatrix = mat4(
+		cos(t), sin(t), 0.0f, 0.0f,
+		-sin(t), cos(t), 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f
+	);
+
+	return rotationMatrix;
+}
+
 mat4 BuildRotateY(float t) {
 	mat4 rotationMatrix = mat4(
 		cos(t), 0.0f, sin(t), 0.0f,
@@ -54,11 +68,15 @@ void main() {
 	vec3 lightDir = vec3(0.0f, 0.0f, -1.0f);
 	mat4 translationMatrix = BuildTranslate(vec4(translation.xyz, 1.0));
 	mat4 rotationMatrix = BuildRotateY(heading);
+	if (part > 0.5f) {
+		rotationMatrix = rotationMatrix * BuildRotateY(turretDirection);
+	}
 
 	// Flip the model 180 around the Y axis, 
 	// because we assume that by default it's facing the wrong direction (-z)
 	mat4 modelCorrectionRotation = BuildRotateY(M_PI);
-	rotationMatrix = rotationMatrix * modelCorrectionRotation;
+	mat4 tiltMatrix = BuildRotateX(tilt.x) * BuildRotateZ(tilt.y);
+	rotationMatrix = rotationMatrix * tiltMatrix * modelCorrectionRotation;
 
 	intensity = dot(rotationMatrix * vec4(normal, 1.0f), vec4(lightDir, 1.0f));
 	tintColor = tint;
@@ -0,0 +1,28 @@
+#version 330 core
+
+// shader.vs with the per instance transforms worked out on the CPU (unittransforms.h):
+// each part of each instance comes with its clip from model matrix already built, and
+// the light direction already turned into its model space.
+
+layout (location=1) in vec3 pos; // model space vertex coordinate
+layout (location=3) in vec3 normal;
+layout (location=7) in float part; // 0 for the hull, 1 for parts that turn with the turret
+layout (location=2) in vec3 hullLight;
+layout (location=4) in vec3 turretLight;
+layout (location=5) in vec4 tint;
+layout (location=8) in mat4 hullTransform; // takes locations 8 to 11
+layout (location=12) in mat4 turretTransform; // takes locations 12 to 15
+
+out float intensity;
+out vec4 tintColor;
+
+void main() {
+	bool turret = part > 0.5f;
+	vec3 light = turret ? turretLight : hullLight;
+	mat4 transform = turret ? turretTransform : hullTransform;
+
+	// the same as shader.vs's dot with the rotated normal and w of 1
+	intensity = dot(normal, light) + 1.0f;
+	tintColor = tint;
+	gl_Position = transform * vec4(pos.xyz, 1);
+}
@@ -9,6 +9,12 @@ const std::string CAMERA_POS = "cameraPos";
 const std::string TANK_SPEED = "tankSpeed";
 const std::string WINDOW_SIZE = "windowSize";
 const std::string TANK_RADIUS = "tankRadius";
+const std::string TANK_SIGHT_RADIUS = "tankSightRadius";
+const std::string TERRAIN_AMPLITUDE = "terrainAmplitude";
+const std::string THREADED_SIMULATION = "threadedSimulation";
+const std::string PATH_WORKER_THREADS = "pathWorkerThreads";
+const std::string AI_TEAM = "aiTeam";
+const std::string PRECOMPUTED_TRANSFORMS = "precomputedTransforms";
 
 struct Settings {
 	glm::vec4 clearColor;
@@ -16,7 +22,13 @@ struct Settings {
 	float tankSpeed;
 	int windowWidth;
 	int windowHeight;
-	float tankRadius;
+	float tankRadius{ 2.0f };
+	float tankSightRadius{ 30.0f };
+	float terrainAmplitude{ 0.0f };
+	bool threadedSimulation{ true };
+	int pathWorkerThreads{ 2 };
+	int aiTeam{ -1 }; //-1 for no computer opponent
+	bool precomputedTransforms{ false }; //build unit transforms on the CPU, see unittransforms.h
 };
 
 void load_settings_file(Settings *settings, const char* filename) {
@@ -40,5 +52,23 @@ void load_settings_file(Settings *settings, const char* filename) {
 		else if (keyword == TANK_RADIUS) {
 			f >> settings->tankRadius;
 		}
+		else if (keyword == TANK_SIGHT_RADIUS) {
+			f >> settings->tankSightRadius;
+		}
+		else if (keyword == TERRAIN_AMPLITUDE) {
+			f >> settings->terrainAmplitude;
+		}
+		else if (keyword == THREADED_SIMULATION) {
+			f >> settings->threadedSimulation;
+		}
+		else if (keyword == PATH_WORKER_THREADS) {
+			f >> settings->pathWorkerThreads;
+		}
+		else if (keyword == AI_TEAM) {
+			f >> settings->aiTeam;
+		}
+		else if (keyword == PRECOMPUTED_TRANSFORMS) {
+			f >> settings->precomputedTransforms;
+		}
 	}
 }
@@ -12,6 +12,7 @@ using namespace std;
 
 string load_shader_file(const char* filename);
 GLuint create_shader_program(const char* vertex_shader, const char* fragment_shader);
+GLuint create_shader_program_from_source(const string& vertex_source, const string& fragment_source);
 void printShaderLog(GLuint shader);
 
 string load_shader_file(const char* filename) {
@@ -28,12 +29,16 @@ string load_shader_file(const char* filename) {
 }
 
 GLuint create_shader_program(const char* vertex_shader, const char* fragment_shader) {
+	return create_shader_program_from_source(load_shader_file(vertex_shader), load_shader_file(fragment_shader));
+}
+
+//for sources already read in, e.g. by a loading thread
+GLuint create_shader_program_from_source(const string& vertex_source, const string& fragment_source) {
 	GLuint programID = glCreateProgram();
 	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 
-	std::string vertexShaderString = load_shader_file(vertex_shader);
-	const char* vertexShaderSource = vertexShaderString.c_str();
+	const char* vertexShaderSource = vertex_source.c_str();
 
 
 	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
@@ -47,8 +52,7 @@ GLuint create_shader_program(const char* vertex_shader, const char* fragment_sha
 		printShaderLog(vertexShader);
 	}
 
-	std::string fragmentShaderString = load_shader_file(fragment_shader);
-	const char* fragmentShaderSource = fragmentShaderString.c_str();
+	const char* fragmentShaderSource = fragment_source.c_str();
 
 
 	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+// SSE2 is part of the x64 baseline and the MSVC x86 default (/arch:SSE2), so kernels
+// can rely on it there and keep a scalar path for anything else.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define RTS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//index of the lowest set bit, bits must not be zero
+inline int lowestSetBit(uint64_t bits) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return (int)index;
+#elif defined(__GNUC__)
+	return __builtin_ctzll(bits);
+#else
+	int index = 0;
+	while (!(bits & 1)) {
+		bits >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
+
+//index of the highest set bit, bits must not be zero
+inline int highestSetBit(uint64_t bits) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, bits);
+	return (int)index;
+#elif defined(__GNUC__)
+	return 63 - __builtin_clzll(bits);
+#else
+	int index = 63;
+	while (!(bits >> 63)) {
+		bits <<= 1;
+		index--;
+	}
+	return index;
+#endif
+}
+
+#ifdef RTS_SSE2
+//sine and cosine of four angles at once, good to a few ulp for angles within a few
+//thousand radians of zero
+inline void sinCos4(__m128 x, __m128* sinOut, __m128* cosOut) {
+	//reduce to r in [-pi/4, pi/4] and the quadrant x was in, pi/2 split in three so
+	//the first products are exact
+	__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134f)));
+	__m128 q = _mm_cvtepi32_ps(quadrant);
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(1.5703125f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(4.837512969970703125e-4f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(7.54978995489188216e-8f)));
+	__m128 r2 = _mm_mul_ps(r, r);
+
+	//minimax polynomials on [-pi/4, pi/4]
+	__m128 s = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(-1.9515295891e-4f)), _mm_set1_ps(8.3321608736e-3f));
+	s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666654611e-1f));
+	s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+	__m128 c = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(2.443315711809948e-5f)), _mm_set1_ps(-1.388731625493765e-3f));
+	c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.166664568298827e-2f));
+	c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, r2), r2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, _mm_set1_ps(0.5f))));
+
+	//odd quadrants swap sine and cosine, then the signs follow the quadrant
+	__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	__m128 sinValue = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+	__m128 cosValue = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+	__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+	__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+	*sinOut = _mm_xor_ps(sinValue, sinSign);
+	*cosOut = _mm_xor_ps(cosValue, cosSign);
+}
+#endif
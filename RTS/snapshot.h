@@ -0,0 +1,437 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Versioned binary snapshot of a Game.
+//
+// File layout:
+//   SnapshotHeader
+//   SnapshotSection[SNAPSHOT_SECTION_COUNT]
+//   section payloads, each starting on a SNAPSHOT_ALIGNMENT boundary
+//
+// Every payload is the raw bytes of one of the Game's vectors (tanks, the TanksData
+// columns, the flow grid, which cells are reserved by footprints), so saving and loading is one bulk copy per column and an
+// uncompressed file can be mapped and read in place. Sections can optionally be stored
+// as LZ4 blocks; a section whose storedSize equals its rawSize is stored uncompressed.
+
+const uint32_t SNAPSHOT_MAGIC = 0x53535452; // "RTSS"
+const uint32_t SNAPSHOT_VERSION = 4;
+const uint32_t SNAPSHOT_ALIGNMENT = 64;
+const uint32_t SNAPSHOT_FLAG_COMPRESSED = 1;
+
+enum SnapshotSectionId {
+	SNAPSHOT_TANKS = 0, // includes each tank's waypoint
+	SNAPSHOT_POSITIONS,
+	SNAPSHOT_HEADINGS,
+	SNAPSHOT_TURRET_DIRECTIONS,
+	SNAPSHOT_TINT,
+	SNAPSHOT_FLOW_CELLS,
+	SNAPSHOT_TILTS,
+	SNAPSHOT_TERRAIN_HEIGHTS,
+	SNAPSHOT_AREA_OCCUPANCY, // only AREA_RESERVED is read back, the rest is rebuilt from the flow cells
+	SNAPSHOT_SECTION_COUNT
+};
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t sectionCount;
+	uint32_t tankCount;
+	int32_t flowMapWidth;
+	int32_t flowMapHeight;
+	float flowCellSize;
+	//struct sizes at save time, so a layout change is rejected rather than misread
+	uint32_t tankStride;
+	uint32_t flowCellStride;
+};
+
+struct SnapshotSection {
+	uint64_t offset;
+	uint64_t rawSize;
+	uint64_t storedSize;
+};
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// single-pass greedy matcher. Good enough to shrink the mostly-constant flow grid
+// without putting the save on the critical path.
+const int LZ4_MIN_MATCH = 4;
+const int LZ4_HASH_LOG = 16;
+const int LZ4_LAST_LITERALS = 5;
+const int LZ4_MF_LIMIT = 12;
+const size_t LZ4_MAX_OFFSET = 65535;
+
+size_t lz4CompressBound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+uint32_t lz4Read32(const uint8_t* p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+uint32_t lz4Hash(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+uint8_t* lz4WriteLength(uint8_t* op, size_t length) {
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+uint8_t* lz4WriteSequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength) {
+	uint8_t* token = op++;
+	*token = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15) {
+		op = lz4WriteLength(op, literalLength - 15);
+	}
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+
+	//the last sequence of a block is literals only
+	if (offset == 0) {
+		return op;
+	}
+
+	*op++ = (uint8_t)(offset & 0xff);
+	*op++ = (uint8_t)(offset >> 8);
+
+	*token |= (uint8_t)(matchLength < 15 ? matchLength : 15);
+	if (matchLength >= 15) {
+		op = lz4WriteLength(op, matchLength - 15);
+	}
+	return op;
+}
+
+//dst must hold lz4CompressBound(srcSize) bytes, returns the compressed size
+size_t lz4CompressBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, std::vector<uint32_t>& hashTable) {
+	hashTable.assign(size_t(1) << LZ4_HASH_LOG, 0);
+
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + srcSize;
+	uint8_t* op = dst;
+
+	if (srcSize > (size_t)LZ4_MF_LIMIT) {
+		const uint8_t* matchLimit = end - LZ4_LAST_LITERALS;
+		const uint8_t* mfLimit = end - LZ4_MF_LIMIT;
+		ip++;
+
+		while (ip < mfLimit) {
+			uint32_t sequence = lz4Read32(ip);
+			uint32_t hash = lz4Hash(sequence);
+			const uint8_t* ref = src + hashTable[hash];
+			hashTable[hash] = (uint32_t)(ip - src);
+
+			if (ref >= ip || (size_t)(ip - ref) > LZ4_MAX_OFFSET || lz4Read32(ref) != sequence) {
+				//skip faster through data that isn't compressing
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+
+			const uint8_t* matchEnd = ip + LZ4_MIN_MATCH;
+			const uint8_t* refEnd = ref + LZ4_MIN_MATCH;
+			while (matchEnd < matchLimit && *matchEnd == *refEnd) {
+				matchEnd++;
+				refEnd++;
+			}
+
+			op = lz4WriteSequence(op, anchor, ip - anchor, ip - ref, matchEnd - ip - LZ4_MIN_MATCH);
+			ip = matchEnd;
+			anchor = ip;
+		}
+	}
+
+	op = lz4WriteSequence(op, anchor, end - anchor, 0, 0);
+	return op - dst;
+}
+
+bool lz4ReadLength(const uint8_t** ip, const uint8_t* iend, size_t* length) {
+	uint8_t b;
+	do {
+		if (*ip >= iend) {
+			return false;
+		}
+		b = *(*ip)++;
+		*length += b;
+	} while (b == 255);
+	return true;
+}
+
+bool lz4DecompressBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + srcSize;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + dstSize;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !lz4ReadLength(&ip, iend, &literalLength)) {
+			return false;
+		}
+		if (literalLength > (size_t)(iend - ip) || literalLength > (size_t)(oend - op)) {
+			return false;
+		}
+		memcpy(op, ip, literalLength);
+		op += literalLength;
+		ip += literalLength;
+
+		if (ip == iend) {
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return false;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst)) {
+			return false;
+		}
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !lz4ReadLength(&ip, iend, &matchLength)) {
+			return false;
+		}
+		matchLength += LZ4_MIN_MATCH;
+		if (matchLength > (size_t)(oend - op)) {
+			return false;
+		}
+
+		const uint8_t* match = op - offset;
+		if (offset >= matchLength) {
+			memcpy(op, match, matchLength);
+		} else {
+			//overlapping copy repeats the last offset bytes, copy them a period at a time
+			size_t copied = 0;
+			while (copied < matchLength) {
+				size_t n = matchLength - copied < offset ? matchLength - copied : offset;
+				memcpy(op + copied, match + copied, n);
+				copied += n;
+			}
+		}
+		op += matchLength;
+	}
+
+	return op == oend;
+}
+
+uint64_t alignSnapshotOffset(uint64_t offset) {
+	return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+void getSnapshotColumns(Game* game, uint8_t** columns, uint64_t* sizes) {
+	columns[SNAPSHOT_TANKS] = (uint8_t*)game->tanks.data();
+	sizes[SNAPSHOT_TANKS] = game->tanks.size() * sizeof(Tank);
+	columns[SNAPSHOT_POSITIONS] = (uint8_t*)game->tanksData.positions.data();
+	sizes[SNAPSHOT_POSITIONS] = game->tanksData.positions.size() * sizeof(GLfloat);
+	columns[SNAPSHOT_HEADINGS] = (uint8_t*)game->tanksData.headings.data();
+	sizes[SNAPSHOT_HEADINGS] = game->tanksData.headings.size() * sizeof(float);
+	columns[SNAPSHOT_TURRET_DIRECTIONS] = (uint8_t*)game->tanksData.turretDirections.data();
+	sizes[SNAPSHOT_TURRET_DIRECTIONS] = game->tanksData.turretDirections.size() * sizeof(float);
+	columns[SNAPSHOT_TINT] = (uint8_t*)game->tanksData.tint.data();
+	sizes[SNAPSHOT_TINT] = game->tanksData.tint.size() * sizeof(float);
+	columns[SNAPSHOT_FLOW_CELLS] = (uint8_t*)game->flowCells.data();
+	sizes[SNAPSHOT_FLOW_CELLS] = game->flowCells.size() * sizeof(flowCell);
+	columns[SNAPSHOT_TILTS] = (uint8_t*)game->tanksData.tilts.data();
+	sizes[SNAPSHOT_TILTS] = game->tanksData.tilts.size() * sizeof(float);
+	columns[SNAPSHOT_TERRAIN_HEIGHTS] = (uint8_t*)game->terrain.heights.data();
+	sizes[SNAPSHOT_TERRAIN_HEIGHTS] = game->terrain.heights.size() * sizeof(float);
+	columns[SNAPSHOT_AREA_OCCUPANCY] = (uint8_t*)game->areaTables.occupancy.data();
+	sizes[SNAPSHOT_AREA_OCCUPANCY] = game->areaTables.occupancy.size() * sizeof(uint8_t);
+}
+
+bool saveSnapshot(Game* game, const char* filename, bool compress) {
+	uint8_t* columns[SNAPSHOT_SECTION_COUNT];
+	uint64_t rawSizes[SNAPSHOT_SECTION_COUNT];
+	getSnapshotColumns(game, columns, rawSizes);
+
+	SnapshotHeader header;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.flags = compress ? SNAPSHOT_FLAG_COMPRESSED : 0;
+	header.sectionCount = SNAPSHOT_SECTION_COUNT;
+	header.tankCount = (uint32_t)game->tanks.size();
+	header.flowMapWidth = game->flowMapWidth;
+	header.flowMapHeight = game->flowMapHeight;
+	header.flowCellSize = game->flowCellSize;
+	header.tankStride = sizeof(Tank);
+	header.flowCellStride = sizeof(flowCell);
+
+	//compress up front so the section table can be written before the payloads
+	std::vector<uint8_t> compressed[SNAPSHOT_SECTION_COUNT];
+	std::vector<uint32_t> hashTable;
+	const uint8_t* payloads[SNAPSHOT_SECTION_COUNT];
+	SnapshotSection sections[SNAPSHOT_SECTION_COUNT];
+
+	uint64_t offset = alignSnapshotOffset(sizeof(SnapshotHeader) + sizeof(sections));
+	for (int i = 0; i < SNAPSHOT_SECTION_COUNT; i++) {
+		payloads[i] = columns[i];
+		sections[i].rawSize = rawSizes[i];
+		sections[i].storedSize = rawSizes[i];
+
+		if (compress && rawSizes[i] > 0) {
+			compressed[i].resize(lz4CompressBound(rawSizes[i]));
+			size_t compressedSize = lz4CompressBlock(columns[i], rawSizes[i], compressed[i].data(), hashTable);
+			if (compressedSize < rawSizes[i]) {
+				payloads[i] = compressed[i].data();
+				sections[i].storedSize = compressedSize;
+			}
+		}
+
+		sections[i].offset = offset;
+		offset = alignSnapshotOffset(offset + sections[i].storedSize);
+	}
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL) {
+		std::cout << "ERROR: could not open snapshot file for writing: " << filename << std::endl;
+		return false;
+	}
+
+	static const uint8_t padding[SNAPSHOT_ALIGNMENT] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(sections, sizeof(sections), 1, f) == 1;
+	uint64_t written = sizeof(header) + sizeof(sections);
+
+	for (int i = 0; ok && i < SNAPSHOT_SECTION_COUNT; i++) {
+		ok = fwrite(padding, 1, sections[i].offset - written, f) == sections[i].offset - written;
+		ok = ok && fwrite(payloads[i], 1, sections[i].storedSize, f) == sections[i].storedSize;
+		written = sections[i].offset + sections[i].storedSize;
+	}
+
+	ok = (fclose(f) == 0) && ok;
+	if (!ok) {
+		std::cout << "ERROR: failed writing snapshot file: " << filename << std::endl;
+	}
+	return ok;
+}
+
+//reads a section straight into its column, only compressed sections go through a staging buffer
+template<typename T>
+bool readSnapshotColumn(FILE* f, uint64_t fileSize, SnapshotSection section, std::vector<T>& out, std::vector<uint8_t>& staging) {
+	if (section.rawSize % sizeof(T) != 0 || section.storedSize > section.rawSize ||
+		section.offset > fileSize || section.storedSize > fileSize - section.offset) {
+		return false;
+	}
+
+	out.resize(section.rawSize / sizeof(T));
+	if (section.rawSize == 0) {
+		return true;
+	}
+
+	if (fseek(f, (long)section.offset, SEEK_SET) != 0) {
+		return false;
+	}
+
+	if (section.storedSize == section.rawSize) {
+		return fread(out.data(), 1, section.rawSize, f) == section.rawSize;
+	}
+
+	staging.resize(section.storedSize);
+	return fread(staging.data(), 1, staging.size(), f) == staging.size() &&
+		lz4DecompressBlock(staging.data(), staging.size(), (uint8_t*)out.data(), section.rawSize);
+}
+
+bool loadSnapshot(Game* game, const char* filename) {
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL) {
+		std::cout << "ERROR: could not open snapshot file: " << filename << std::endl;
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	SnapshotHeader header;
+	SnapshotSection sections[SNAPSHOT_SECTION_COUNT];
+	bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+		fread(sections, sizeof(sections), 1, f) == 1 &&
+		header.magic == SNAPSHOT_MAGIC &&
+		header.version == SNAPSHOT_VERSION &&
+		header.sectionCount == SNAPSHOT_SECTION_COUNT &&
+		header.tankStride == sizeof(Tank) &&
+		header.flowCellStride == sizeof(flowCell);
+
+	if (!ok) {
+		fclose(f);
+		std::cout << "ERROR: not a valid snapshot file: " << filename << std::endl;
+		return false;
+	}
+
+	Game loaded;
+	std::vector<uint8_t> staging;
+	ok = readSnapshotColumn(f, fileSize, sections[SNAPSHOT_TANKS], loaded.tanks, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_POSITIONS], loaded.tanksData.positions, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_HEADINGS], loaded.tanksData.headings, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_TURRET_DIRECTIONS], loaded.tanksData.turretDirections, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_TINT], loaded.tanksData.tint, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_FLOW_CELLS], loaded.flowCells, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_TILTS], loaded.tanksData.tilts, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_TERRAIN_HEIGHTS], loaded.terrain.heights, staging) &&
+		readSnapshotColumn(f, fileSize, sections[SNAPSHOT_AREA_OCCUPANCY], loaded.areaTables.occupancy, staging);
+	fclose(f);
+
+	ok = ok && loaded.tanks.size() == header.tankCount &&
+		loaded.tanksData.positions.size() == 3 * loaded.tanks.size() &&
+		loaded.tanksData.headings.size() == loaded.tanks.size() &&
+		loaded.tanksData.turretDirections.size() == loaded.tanks.size() &&
+		loaded.tanksData.tint.size() == 4 * loaded.tanks.size() &&
+		loaded.tanksData.tilts.size() == 2 * loaded.tanks.size() &&
+		loaded.flowCells.size() == (size_t)header.flowMapWidth * header.flowMapHeight &&
+		loaded.terrain.heights.size() == (size_t)(header.flowMapWidth + 1) * (header.flowMapHeight + 1) &&
+		loaded.areaTables.occupancy.size() == (size_t)header.flowMapWidth * header.flowMapHeight;
+
+	if (!ok) {
+		std::cout << "ERROR: corrupt snapshot file: " << filename << std::endl;
+		return false;
+	}
+
+	//only replace the running game's state once the whole file has been validated,
+	//input and settings are left as they are
+	game->tanks.swap(loaded.tanks);
+	game->tanksData.positions.swap(loaded.tanksData.positions);
+	game->tanksData.headings.swap(loaded.tanksData.headings);
+	game->tanksData.turretDirections.swap(loaded.tanksData.turretDirections);
+	game->tanksData.tint.swap(loaded.tanksData.tint);
+	game->tanksData.tilts.swap(loaded.tanksData.tilts);
+	game->flowCells.swap(loaded.flowCells);
+	game->flowMapWidth = header.flowMapWidth;
+	game->flowMapHeight = header.flowMapHeight;
+	game->flowCellSize = header.flowCellSize;
+
+	initRuntimeGrid(&game->grid, game->flowMapWidth, game->flowMapHeight, game->flowCellSize);
+	initTerrain(&game->terrain, game->flowMapWidth, game->flowMapHeight, game->flowCellSize);
+	initInfluence(&game->influence, game->flowMapWidth, game->flowMapHeight);
+	initAreaTables(&game->areaTables, game->flowMapWidth, game->flowMapHeight);
+	game->terrain.heights.swap(loaded.terrain.heights);
+	buildTerrainMipmaps(&game->terrain);
+
+	//reserved footprints come back with the occupancy, rebuildNavigation keeps AREA_RESERVED
+	game->areaTables.occupancy.swap(loaded.areaTables.occupancy);
+	rebuildNavigation(game);
+
+	//derived state is rebuilt from the loaded tanks on the next tick
+	initFog(&game->fog, game->flowMapWidth, game->flowMapHeight);
+	game->tankPaths.clear();
+	game->collision.order.clear();
+	cancelAllPathRequests(&game->pathService);
+	game->ai = AiOpponent();
+	return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <chrono>
+
+// Loading at startup, before the first frame.
+//
+// Anything that only needs the CPU (reading files, importing meshes, building the map)
+// runs as a job on its own thread, while the main thread brings up SDL, the window and
+// the GL context. Jobs leave their results in memory, and once every job has finished
+// main does all the GL uploads in one go, since only the thread holding the context can.
+//
+// A job that fails prints why and returns false; main gives up once every job is done.
+
+typedef std::chrono::steady_clock StartupClock;
+
+struct StartupJob {
+	const char* name;
+	std::function<bool()> work;
+	std::thread thread;
+	bool ok{ false };
+	double ms{ 0.0 };
+};
+
+struct StartupLoader {
+	StartupClock::time_point start{ StartupClock::now() };
+	std::vector<std::unique_ptr<StartupJob>> jobs;
+
+	~StartupLoader() {
+		//an early return from main mustn't leave threads running
+		for (std::unique_ptr<StartupJob>& job : jobs) {
+			if (job->thread.joinable()) {
+				job->thread.join();
+			}
+		}
+	}
+};
+
+double startupMsSince(StartupClock::time_point start) {
+	return std::chrono::duration<double, std::milli>(StartupClock::now() - start).count();
+}
+
+void runStartupJob(StartupJob* job) {
+	auto start = StartupClock::now();
+	job->ok = job->work();
+	job->ms = startupMsSince(start);
+}
+
+StartupJob* startStartupJob(StartupLoader* loader, const char* name, std::function<bool()> work) {
+	loader->jobs.push_back(std::unique_ptr<StartupJob>(new StartupJob()));
+	StartupJob* job = loader->jobs.back().get();
+	job->name = name;
+	job->work = work;
+	job->thread = std::thread(runStartupJob, job);
+	return job;
+}
+
+//blocks until the job is done, for the few things main needs before it can carry on
+bool waitForStartupJob(StartupJob* job) {
+	if (job->thread.joinable()) {
+		job->thread.join();
+	}
+	return job->ok;
+}
+
+//waits for every job, prints how long each took, false if any of them failed
+bool finishStartupJobs(StartupLoader* loader) {
+	bool ok = true;
+	for (std::unique_ptr<StartupJob>& job : loader->jobs) {
+		ok = waitForStartupJob(job.get()) && ok;
+	}
+
+	std::cout << "startup jobs done after " << startupMsSince(loader->start) << " ms:";
+	for (std::unique_ptr<StartupJob>& job : loader->jobs) {
+		std::cout << " " << job->name << " " << job->ms << " ms" << (job->ok ? "" : " (FAILED)");
+	}
+	std::cout << std::endl;
+	return ok;
+}
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+// Delta-compressed tank state for spectators and observers, who receive state rather
+// than the players' inputs.
+//
+// Every tick the server captures a quantised StreamFrame of all tank slots and encodes
+// it against the newest frame the client has acknowledged (its baseline). The client
+// applies the packet to its own copy of that baseline and ends up with a frame that is
+// bit for bit the one the server captured. Frames are numbered by sequence. Both sides
+// keep the last STREAM_HISTORY frames so that an ack can arrive a few ticks late. If
+// the acked frame has fallen out of the history, or nothing was acked yet, the frame
+// is encoded against an empty baseline.
+//
+// Packet layout, bit packed least significant bit first:
+//   sequence (32 bits), baseline sequence (32 bits, STREAM_NO_BASELINE for none)
+//   slot count (at most STREAM_MAX_UNITS), number of slots that differ from the baseline
+//   for each of those slots:
+//     gap since the previous such slot, then a STREAM_FIELD_* mask, then each masked field
+// Counts, gaps and deltas use the variable length codes of writeStreamValue. Each
+// field is sent as a difference from the baseline, so idle units cost nothing and
+// moving units cost a few bits per axis.
+//
+// Tints are not sent: they show the local player's selection, so a spectator colours
+// units by team itself.
+
+const uint32_t STREAM_NO_BASELINE = 0xFFFFFFFF;
+const int STREAM_HISTORY = 32;
+const uint32_t STREAM_MAX_UNITS = 1 << 20; //a packet claiming more slots is rejected before anything is allocated
+
+const float STREAM_POSITION_QUANTUM = 1.0f / 256.0f;
+const float STREAM_ANGLE_STEPS = 65536.0f;
+const float STREAM_TWO_PI = 6.28318530718f;
+
+enum StreamField {
+	STREAM_FIELD_LIFE = 1,      //generation, deleted and team
+	STREAM_FIELD_POSITION = 2,
+	STREAM_FIELD_HEADING = 4,
+	STREAM_FIELD_TURRET = 8,
+	STREAM_FIELD_TILT = 16,
+	STREAM_FIELD_HEALTH = 32,
+	STREAM_FIELD_BITS = 6
+};
+
+//one tank slot as the stream sees it, deleted slots are kept so indices line up
+struct StreamUnit {
+	int32_t position[3];
+	uint16_t heading;
+	uint16_t turretDirection;
+	uint16_t tilt[2];
+	int32_t health;
+	int32_t generation;
+	uint8_t deleted;
+	uint8_t team;
+	uint8_t padding[2];
+};
+
+struct StreamFrame {
+	uint32_t sequence{ STREAM_NO_BASELINE };
+	std::vector<StreamUnit> units;
+};
+
+struct StreamStats {
+	long long packets{ 0 };
+	long long bytes{ 0 };
+	long long unitsSent{ 0 };   //slots that differed from their baseline
+	long long fullFrames{ 0 };  //encoded against an empty baseline
+};
+
+struct StreamEncoder {
+	uint32_t nextSequence{ 0 };
+	uint32_t acked{ STREAM_NO_BASELINE };
+	StreamFrame history[STREAM_HISTORY];
+	StreamStats stats;
+	std::vector<uint32_t> masks; //scratch, per slot STREAM_FIELD_* changed since the baseline
+};
+
+struct StreamDecoder {
+	uint32_t latest{ STREAM_NO_BASELINE };
+	StreamFrame history[STREAM_HISTORY];
+};
+
+// Bit packing
+
+struct StreamBitWriter {
+	std::vector<uint8_t>* bytes;
+	uint64_t accumulator{ 0 };
+	int bits{ 0 };
+};
+
+struct StreamBitReader {
+	const uint8_t* data;
+	size_t size;
+	size_t position{ 0 };
+	uint64_t accumulator{ 0 };
+	int bits{ 0 };
+};
+
+void writeStreamBits(StreamBitWriter* writer, uint32_t value, int count) {
+	writer->accumulator |= (uint64_t)value << writer->bits;
+	writer->bits += count;
+	while (writer->bits >= 8) {
+		writer->bytes->push_back((uint8_t)writer->accumulator);
+		writer->accumulator >>= 8;
+		writer->bits -= 8;
+	}
+}
+
+void flushStreamBits(StreamBitWriter* writer) {
+	if (writer->bits > 0) {
+		writer->bytes->push_back((uint8_t)writer->accumulator);
+	}
+	writer->accumulator = 0;
+	writer->bits = 0;
+}
+
+bool readStreamBits(StreamBitReader* reader, int count, uint32_t* value) {
+	while (reader->bits < count) {
+		if (reader->position == reader->size) {
+			return false;
+		}
+		reader->accumulator |= (uint64_t)reader->data[reader->position++] << reader->bits;
+		reader->bits += 8;
+	}
+	*value = (uint32_t)(reader->accumulator & ((1ull << count) - 1));
+	reader->accumulator >>= count;
+	reader->bits -= count;
+	return true;
+}
+
+// Small values are by far the most common (a tank moves a few dozen quanta per tick),
+// so values get a unary size class followed by just enough bits:
+//   0 + 4 bits, 10 + 8 bits, 110 + 16 bits, 111 + 32 bits
+const int STREAM_VALUE_CLASSES = 4;
+const int STREAM_VALUE_CLASS_BITS[STREAM_VALUE_CLASSES] = { 4, 8, 16, 32 };
+
+void writeStreamValue(StreamBitWriter* writer, uint32_t value) {
+	for (int c = 0; c < STREAM_VALUE_CLASSES; c++) {
+		int bits = STREAM_VALUE_CLASS_BITS[c];
+		if (c == STREAM_VALUE_CLASSES - 1 || value < (1u << bits)) {
+			//c ones then a zero, the last class needs no terminating zero
+			writeStreamBits(writer, (1u << c) - 1, c);
+			if (c < STREAM_VALUE_CLASSES - 1) {
+				writeStreamBits(writer, 0, 1);
+			}
+			writeStreamBits(writer, value, bits);
+			return;
+		}
+	}
+}
+
+bool readStreamValue(StreamBitReader* reader, uint32_t* value) {
+	int c = 0;
+	uint32_t bit = 1;
+	while (c < STREAM_VALUE_CLASSES - 1) {
+		if (!readStreamBits(reader, 1, &bit)) {
+			return false;
+		}
+		if (bit == 0) {
+			break;
+		}
+		c++;
+	}
+	return readStreamBits(reader, STREAM_VALUE_CLASS_BITS[c], value);
+}
+
+//zigzag so small negative deltas stay small
+void writeStreamDelta(StreamBitWriter* writer, int32_t delta) {
+	writeStreamValue(writer, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+bool readStreamDelta(StreamBitReader* reader, int32_t* delta) {
+	uint32_t value;
+	if (!readStreamValue(reader, &value)) {
+		return false;
+	}
+	*delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	return true;
+}
+
+// Quantisation
+
+int32_t quantiseStreamPosition(float value) {
+	return (int32_t)floorf(value / STREAM_POSITION_QUANTUM + 0.5f);
+}
+
+float dequantiseStreamPosition(int32_t value) {
+	return value * STREAM_POSITION_QUANTUM;
+}
+
+//angles wrap, so any float angle maps onto the full 16 bit circle
+uint16_t quantiseStreamAngle(float radians) {
+	float turns = radians / STREAM_TWO_PI;
+	turns -= floorf(turns);
+	return (uint16_t)(int32_t)floorf(turns * STREAM_ANGLE_STEPS + 0.5f);
+}
+
+float dequantiseStreamAngle(uint16_t value) {
+	return value * (STREAM_TWO_PI / STREAM_ANGLE_STEPS);
+}
+
+//the shortest way round, so a heading crossing zero is a small delta
+int32_t streamAngleDelta(uint16_t from, uint16_t to) {
+	return (int16_t)(uint16_t)(to - from);
+}
+
+void captureStreamFrame(Game* game, StreamFrame* frame) {
+	frame->units.resize(game->tanks.size());
+	for (int i = 0; i < game->tanks.size(); i++) {
+		const Tank& tank = game->tanks[i];
+		StreamUnit& unit = frame->units[i];
+		memset(&unit, 0, sizeof(unit));
+
+		unit.generation = tank.index.generation;
+		unit.deleted = tank.index.deleted ? 1 : 0;
+		if (unit.deleted) {
+			continue;
+		}
+
+		unit.team = (uint8_t)tank.team;
+		unit.health = tank.health;
+		for (int axis = 0; axis < 3; axis++) {
+			unit.position[axis] = quantiseStreamPosition(game->tanksData.positions[3 * i + axis]);
+		}
+		unit.heading = quantiseStreamAngle(game->tanksData.headings[i]);
+		unit.turretDirection = quantiseStreamAngle(game->tanksData.turretDirections[i]);
+		unit.tilt[0] = quantiseStreamAngle(game->tanksData.tilts[2 * i]);
+		unit.tilt[1] = quantiseStreamAngle(game->tanksData.tilts[2 * i + 1]);
+	}
+}
+
+uint32_t streamFieldMask(const StreamUnit& from, const StreamUnit& to) {
+	uint32_t mask = 0;
+	if (from.generation != to.generation || from.deleted != to.deleted || from.team != to.team) {
+		mask |= STREAM_FIELD_LIFE;
+	}
+	if (memcmp(from.position, to.position, sizeof(from.position)) != 0) {
+		mask |= STREAM_FIELD_POSITION;
+	}
+	if (from.heading != to.heading) {
+		mask |= STREAM_FIELD_HEADING;
+	}
+	if (from.turretDirection != to.turretDirection) {
+		mask |= STREAM_FIELD_TURRET;
+	}
+	if (from.tilt[0] != to.tilt[0] || from.tilt[1] != to.tilt[1]) {
+		mask |= STREAM_FIELD_TILT;
+	}
+	if (from.health != to.health) {
+		mask |= STREAM_FIELD_HEALTH;
+	}
+	return mask;
+}
+
+const StreamFrame* findStreamFrame(const StreamFrame* history, uint32_t sequence) {
+	if (sequence == STREAM_NO_BASELINE) {
+		return NULL;
+	}
+	const StreamFrame* frame = &history[sequence % STREAM_HISTORY];
+	return frame->sequence == sequence ? frame : NULL;
+}
+
+const StreamUnit EMPTY_STREAM_UNIT{};
+
+//slots past the end of the baseline are diffed against an all-zero unit
+const StreamUnit& streamBaselineUnit(const StreamFrame* baseline, int slot) {
+	if (baseline == NULL || slot >= baseline->units.size()) {
+		return EMPTY_STREAM_UNIT;
+	}
+	return baseline->units[slot];
+}
+
+void writeStreamUnit(StreamBitWriter* writer, const StreamUnit& from, const StreamUnit& to, uint32_t mask) {
+	writeStreamBits(writer, mask, STREAM_FIELD_BITS);
+	if (mask & STREAM_FIELD_LIFE) {
+		writeStreamDelta(writer, to.generation - from.generation);
+		writeStreamBits(writer, to.deleted, 1);
+		writeStreamValue(writer, to.team);
+	}
+	if (mask & STREAM_FIELD_POSITION) {
+		for (int axis = 0; axis < 3; axis++) {
+			writeStreamDelta(writer, to.position[axis] - from.position[axis]);
+		}
+	}
+	if (mask & STREAM_FIELD_HEADING) {
+		writeStreamDelta(writer, streamAngleDelta(from.heading, to.heading));
+	}
+	if (mask & STREAM_FIELD_TURRET) {
+		writeStreamDelta(writer, streamAngleDelta(from.turretDirection, to.turretDirection));
+	}
+	if (mask & STREAM_FIELD_TILT) {
+		writeStreamDelta(writer, streamAngleDelta(from.tilt[0], to.tilt[0]));
+		writeStreamDelta(writer, streamAngleDelta(from.tilt[1], to.tilt[1]));
+	}
+	if (mask & STREAM_FIELD_HEALTH) {
+		writeStreamDelta(writer, to.health - from.health);
+	}
+}
+
+bool readStreamUnit(StreamBitReader* reader, StreamUnit* unit) {
+	uint32_t mask, value;
+	int32_t delta;
+	if (!readStreamBits(reader, STREAM_FIELD_BITS, &mask)) {
+		return false;
+	}
+	if (mask & STREAM_FIELD_LIFE) {
+		if (!readStreamDelta(reader, &delta) || !readStreamBits(reader, 1, &value)) {
+			return false;
+		}
+		unit->generation += delta;
+		unit->deleted = (uint8_t)value;
+		if (!readStreamValue(reader, &value)) {
+			return false;
+		}
+		unit->team = (uint8_t)value;
+	}
+	if (mask & STREAM_FIELD_POSITION) {
+		for (int axis = 0; axis < 3; axis++) {
+			if (!readStreamDelta(reader, &delta)) {
+				return false;
+			}
+			unit->position[axis] += delta;
+		}
+	}
+	if (mask & STREAM_FIELD_HEADING) {
+		if (!readStreamDelta(reader, &delta)) {
+			return false;
+		}
+		unit->heading = (uint16_t)(unit->heading + delta);
+	}
+	if (mask & STREAM_FIELD_TURRET) {
+		if (!readStreamDelta(reader, &delta)) {
+			return false;
+		}
+		unit->turretDirection = (uint16_t)(unit->turretDirection + delta);
+	}
+	if (mask & STREAM_FIELD_TILT) {
+		for (int i = 0; i < 2; i++) {
+			if (!readStreamDelta(reader, &delta)) {
+				return false;
+			}
+			unit->tilt[i] = (uint16_t)(unit->tilt[i] + delta);
+		}
+	}
+	if (mask & STREAM_FIELD_HEALTH) {
+		if (!readStreamDelta(reader, &delta)) {
+			return false;
+		}
+		unit->health += delta;
+	}
+	return true;
+}
+
+//captures the game's current state and encodes it against the client's last ack, returns the frame sent
+const StreamFrame* encodeStreamFrame(StreamEncoder* encoder, Game* game, std::vector<uint8_t>* packet) {
+	uint32_t sequence = encoder->nextSequence++;
+	StreamFrame* frame = &encoder->history[sequence % STREAM_HISTORY];
+	frame->sequence = sequence;
+	captureStreamFrame(game, frame);
+
+	const StreamFrame* baseline = findStreamFrame(encoder->history, encoder->acked);
+	if (baseline == frame) {
+		//the ack is so old its slot has been reused
+		baseline = NULL;
+	}
+
+	packet->clear();
+	StreamBitWriter writer;
+	writer.bytes = packet;
+	writeStreamBits(&writer, sequence, 32);
+	writeStreamBits(&writer, baseline != NULL ? baseline->sequence : STREAM_NO_BASELINE, 32);
+
+	uint32_t changed = 0;
+	encoder->masks.resize(frame->units.size());
+	for (int i = 0; i < frame->units.size(); i++) {
+		encoder->masks[i] = streamFieldMask(streamBaselineUnit(baseline, i), frame->units[i]);
+		changed += encoder->masks[i] != 0;
+	}
+	writeStreamValue(&writer, (uint32_t)frame->units.size());
+	writeStreamValue(&writer, changed);
+
+	int previous = -1;
+	for (int i = 0; i < frame->units.size(); i++) {
+		if (encoder->masks[i] == 0) {
+			continue;
+		}
+		writeStreamValue(&writer, i - previous - 1);
+		writeStreamUnit(&writer, streamBaselineUnit(baseline, i), frame->units[i], encoder->masks[i]);
+		previous = i;
+	}
+	flushStreamBits(&writer);
+	encoder->stats.unitsSent += changed;
+
+	encoder->stats.packets++;
+	encoder->stats.bytes += packet->size();
+	if (baseline == NULL) {
+		encoder->stats.fullFrames++;
+	}
+	return frame;
+}
+
+//acks only ever move forward, a late ack for an older frame is ignored
+void acknowledgeStreamFrame(StreamEncoder* encoder, uint32_t sequence) {
+	if (encoder->acked == STREAM_NO_BASELINE || (int32_t)(sequence - encoder->acked) > 0) {
+		encoder->acked = sequence;
+	}
+}
+
+//rebuilds a frame from a packet, returns NULL if it is malformed or its baseline is gone
+const StreamFrame* decodeStreamFrame(StreamDecoder* decoder, const uint8_t* data, size_t size) {
+	StreamBitReader reader;
+	reader.data = data;
+	reader.size = size;
+
+	uint32_t sequence, baselineSequence, unitCount, changed;
+	if (!readStreamBits(&reader, 32, &sequence) || !readStreamBits(&reader, 32, &baselineSequence) ||
+		!readStreamValue(&reader, &unitCount) || !readStreamValue(&reader, &changed) ||
+		sequence == STREAM_NO_BASELINE || unitCount > STREAM_MAX_UNITS || changed > unitCount) {
+		std::cout << "ERROR: malformed stream packet header" << std::endl;
+		return NULL;
+	}
+
+	const StreamFrame* baseline = findStreamFrame(decoder->history, baselineSequence);
+	if (baselineSequence != STREAM_NO_BASELINE && baseline == NULL) {
+		std::cout << "ERROR: stream packet " << sequence << " needs frame " << baselineSequence << " which is not held" << std::endl;
+		return NULL;
+	}
+
+	//decode into scratch space so a bad packet doesn't clobber a frame we might still need
+	StreamFrame decoded;
+	decoded.sequence = sequence;
+	decoded.units.resize(unitCount);
+	for (uint32_t i = 0; i < unitCount; i++) {
+		decoded.units[i] = streamBaselineUnit(baseline, i);
+	}
+
+	int64_t slot = -1;
+	uint32_t gap;
+	for (uint32_t i = 0; i < changed; i++) {
+		bool read = readStreamValue(&reader, &gap);
+		slot += (int64_t)gap + 1;
+		if (!read || slot >= unitCount || !readStreamUnit(&reader, &decoded.units[slot])) {
+			std::cout << "ERROR: malformed stream packet " << sequence << std::endl;
+			return NULL;
+		}
+	}
+
+	StreamFrame* frame = &decoder->history[sequence % STREAM_HISTORY];
+	frame->sequence = sequence;
+	frame->units.swap(decoded.units);
+	if (decoder->latest == STREAM_NO_BASELINE || (int32_t)(sequence - decoder->latest) > 0) {
+		decoder->latest = sequence;
+	}
+	return frame;
+}
+
+//true if the client rebuilt exactly the frame the server captured
+bool streamFramesEqual(const StreamFrame* sent, const StreamFrame* received) {
+	return sent->sequence == received->sequence && sent->units.size() == received->units.size() &&
+		(sent->units.empty() || memcmp(sent->units.data(), received->units.data(), sent->units.size() * sizeof(StreamUnit)) == 0);
+}
@@ -0,0 +1,542 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "simd.h"
+
+// Live stats in a named shared memory segment, for monitoring tools to read from
+// another process.
+//
+// The game creates one segment per process, named after its pid, and prints the name
+// at startup. The simulation thread and the render thread each own a section of it.
+// A section is guarded by a seqlock: the writer makes the sequence odd, stores its
+// fields with relaxed atomics, then makes it even again. A reader copies the section
+// and retries if the sequence was odd or moved while it copied. Writers never wait
+// and readers never block them, so a reader attached to a running game can't slow it
+// down.
+//
+// Durations go into histograms with power of two buckets: bucket b counts durations
+// from 2^(b-1) up to 2^b microseconds, and bucket 0 counts anything under 1us.
+//
+// Read it with:
+//   RTS.exe -telemetry pid [interval ms] [samples]
+
+const uint32_t TELEMETRY_MAGIC = 0x54535452; // "RTST"
+const uint32_t TELEMETRY_VERSION = 1;
+const int TELEMETRY_HISTOGRAM_BUCKETS = 24;
+const int TELEMETRY_READ_ATTEMPTS = 1000;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "telemetry atomics must be lock free to be shared between processes");
+
+typedef std::atomic<uint64_t> TelemetryCounter;
+
+struct TelemetryHistogram {
+	TelemetryCounter buckets[TELEMETRY_HISTOGRAM_BUCKETS];
+};
+
+struct alignas(64) TelemetrySimulationSection {
+	std::atomic<uint32_t> sequence;
+	TelemetryCounter ticks;
+	TelemetryCounter lastTickUs;
+	TelemetryCounter units;
+	TelemetryCounter pathQueueDepth;     //searches queued or running
+	TelemetryCounter pathSearchesCompleted;
+	TelemetryCounter particlesLive;
+	TelemetryCounter allocations;        //whole process, as of the last tick
+	TelemetryCounter frees;
+	TelemetryCounter bytesAllocated;
+	TelemetryHistogram tickTime;
+};
+
+struct alignas(64) TelemetryRenderSection {
+	std::atomic<uint32_t> sequence;
+	TelemetryCounter frames;
+	TelemetryCounter lastFrameUs;
+	TelemetryCounter bytesUploaded;      //total buffer data handed to GL
+	TelemetryHistogram frameTime;
+};
+
+struct TelemetrySegment {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t pid;
+	std::atomic<uint32_t> running;       //cleared when the game shuts down
+	TelemetrySimulationSection simulation;
+	TelemetryRenderSection render;
+};
+
+//plain copies of a section, what a reader ends up with
+struct TelemetrySimulationSample {
+	uint64_t ticks;
+	uint64_t lastTickUs;
+	uint64_t units;
+	uint64_t pathQueueDepth;
+	uint64_t pathSearchesCompleted;
+	uint64_t particlesLive;
+	uint64_t allocations;
+	uint64_t frees;
+	uint64_t bytesAllocated;
+	uint64_t tickTime[TELEMETRY_HISTOGRAM_BUCKETS];
+};
+
+struct TelemetryRenderSample {
+	uint64_t frames;
+	uint64_t lastFrameUs;
+	uint64_t bytesUploaded;
+	uint64_t frameTime[TELEMETRY_HISTOGRAM_BUCKETS];
+};
+
+struct TelemetryMapping {
+	TelemetrySegment* segment{ NULL };
+	bool owner{ false };
+	char name[64];
+#if defined(_WIN32)
+	HANDLE handle{ NULL };
+#endif
+};
+
+//the game's own segment, NULL segment until createTelemetrySegment so publishing is a no-op
+TelemetryMapping telemetry;
+
+//only touched by the render thread, published with each frame
+uint64_t telemetryUploadedBytes = 0;
+
+// Allocation counting, replaces the global operator new and delete for the whole program.
+// The std::align_val_t forms, used for over-aligned types, only exist from C++17, so
+// they're replaced when the compiler has them; without them over-aligned types go
+// through the plain forms and are counted there.
+std::atomic<uint64_t> telemetryAllocations{ 0 };
+std::atomic<uint64_t> telemetryFrees{ 0 };
+std::atomic<uint64_t> telemetryBytesAllocated{ 0 };
+
+#ifndef RTS_NO_ALLOCATION_COUNTING
+void* countedAllocate(size_t size) {
+	telemetryAllocations.fetch_add(1, std::memory_order_relaxed);
+	telemetryBytesAllocated.fetch_add(size, std::memory_order_relaxed);
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void countedFree(void* p) {
+	if (p != NULL) {
+		telemetryFrees.fetch_add(1, std::memory_order_relaxed);
+		free(p);
+	}
+}
+
+void* operator new(size_t size) {
+	return countedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+	return countedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+	countedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+	countedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	countedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	countedFree(p);
+}
+
+#ifdef __cpp_aligned_new
+void* countedAllocateAligned(size_t size, std::align_val_t alignment) {
+	telemetryAllocations.fetch_add(1, std::memory_order_relaxed);
+	telemetryBytesAllocated.fetch_add(size, std::memory_order_relaxed);
+	size_t align = (size_t)alignment < sizeof(void*) ? sizeof(void*) : (size_t)alignment;
+#if defined(_WIN32)
+	void* p = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, align, size == 0 ? 1 : size) != 0) {
+		p = NULL;
+	}
+#endif
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void countedFreeAligned(void* p) {
+	if (p != NULL) {
+		telemetryFrees.fetch_add(1, std::memory_order_relaxed);
+#if defined(_WIN32)
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	return countedAllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return countedAllocateAligned(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	countedFreeAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+	countedFreeAligned(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+	countedFreeAligned(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+	countedFreeAligned(p);
+}
+#endif
+#endif
+
+void telemetrySegmentName(int pid, char* out, size_t size) {
+#if defined(_WIN32)
+	snprintf(out, size, "Local\\RTS_Telemetry_%d", pid);
+#else
+	snprintf(out, size, "/rts_telemetry_%d", pid);
+#endif
+}
+
+int currentProcessId() {
+#if defined(_WIN32)
+	return (int)GetCurrentProcessId();
+#else
+	return (int)getpid();
+#endif
+}
+
+bool mapTelemetrySegment(TelemetryMapping* mapping, int pid, bool create) {
+	telemetrySegmentName(pid, mapping->name, sizeof(mapping->name));
+	size_t size = sizeof(TelemetrySegment);
+	void* memory = NULL;
+
+#if defined(_WIN32)
+	if (create) {
+		mapping->handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, mapping->name);
+	}
+	else {
+		mapping->handle = OpenFileMappingA(FILE_MAP_READ, FALSE, mapping->name);
+	}
+	if (mapping->handle == NULL) {
+		return false;
+	}
+	memory = MapViewOfFile(mapping->handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+	if (memory == NULL) {
+		CloseHandle(mapping->handle);
+		mapping->handle = NULL;
+		return false;
+	}
+#else
+	int fd = create ? shm_open(mapping->name, O_CREAT | O_RDWR | O_TRUNC, 0644) : shm_open(mapping->name, O_RDONLY, 0);
+	if (fd == -1) {
+		return false;
+	}
+	if (create && ftruncate(fd, size) != 0) {
+		close(fd);
+		shm_unlink(mapping->name);
+		return false;
+	}
+	memory = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED) {
+		if (create) {
+			shm_unlink(mapping->name);
+		}
+		return false;
+	}
+#endif
+
+	mapping->segment = (TelemetrySegment*)memory;
+	mapping->owner = create;
+	return true;
+}
+
+bool createTelemetrySegment(TelemetryMapping* mapping) {
+	int pid = currentProcessId();
+	if (!mapTelemetrySegment(mapping, pid, true)) {
+		std::cout << "ERROR: could not create telemetry segment for process " << pid << std::endl;
+		return false;
+	}
+
+	//fresh mappings are zeroed, which is a valid starting state for every atomic in there
+	TelemetrySegment* segment = mapping->segment;
+	segment->size = sizeof(TelemetrySegment);
+	segment->pid = (uint32_t)pid;
+	segment->version = TELEMETRY_VERSION;
+	segment->running.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	segment->magic = TELEMETRY_MAGIC;
+	return true;
+}
+
+//for readers, fails if there is no segment or it's from an incompatible build
+bool openTelemetrySegment(TelemetryMapping* mapping, int pid) {
+	if (!mapTelemetrySegment(mapping, pid, false)) {
+		std::cout << "ERROR: no telemetry segment for process " << pid << std::endl;
+		return false;
+	}
+
+	TelemetrySegment* segment = mapping->segment;
+	if (segment->magic != TELEMETRY_MAGIC || segment->version != TELEMETRY_VERSION || segment->size != sizeof(TelemetrySegment)) {
+		std::cout << "ERROR: telemetry segment " << mapping->name << " is version " << segment->version << ", expected " << TELEMETRY_VERSION << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void closeTelemetrySegment(TelemetryMapping* mapping) {
+	if (mapping->segment == NULL) {
+		return;
+	}
+	if (mapping->owner) {
+		mapping->segment->running.store(0, std::memory_order_release);
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(mapping->segment);
+	CloseHandle(mapping->handle);
+	mapping->handle = NULL;
+#else
+	munmap(mapping->segment, sizeof(TelemetrySegment));
+	if (mapping->owner) {
+		shm_unlink(mapping->name);
+	}
+#endif
+	mapping->segment = NULL;
+}
+
+// Writing
+
+void beginTelemetryWrite(std::atomic<uint32_t>* sequence) {
+	sequence->store(sequence->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void endTelemetryWrite(std::atomic<uint32_t>* sequence) {
+	sequence->store(sequence->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void setTelemetry(TelemetryCounter& counter, uint64_t value) {
+	counter.store(value, std::memory_order_relaxed);
+}
+
+void addTelemetry(TelemetryCounter& counter, uint64_t value) {
+	//single writer, so no read-modify-write instruction needed
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int telemetryBucket(uint64_t microseconds) {
+	if (microseconds == 0) {
+		return 0;
+	}
+	int bucket = highestSetBit(microseconds) + 1;
+	return bucket < TELEMETRY_HISTOGRAM_BUCKETS ? bucket : TELEMETRY_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t telemetryMicroseconds(std::chrono::high_resolution_clock::time_point start) {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+//called by the simulation thread once a tick
+void publishSimulationTelemetry(uint64_t tickUs, uint64_t units, uint64_t pathQueueDepth, uint64_t pathSearchesCompleted, uint64_t particlesLive) {
+	TelemetrySegment* segment = telemetry.segment;
+	if (segment == NULL) {
+		return;
+	}
+
+	TelemetrySimulationSection& section = segment->simulation;
+	beginTelemetryWrite(&section.sequence);
+	addTelemetry(section.ticks, 1);
+	setTelemetry(section.lastTickUs, tickUs);
+	setTelemetry(section.units, units);
+	setTelemetry(section.pathQueueDepth, pathQueueDepth);
+	setTelemetry(section.pathSearchesCompleted, pathSearchesCompleted);
+	setTelemetry(section.particlesLive, particlesLive);
+	setTelemetry(section.allocations, telemetryAllocations.load(std::memory_order_relaxed));
+	setTelemetry(section.frees, telemetryFrees.load(std::memory_order_relaxed));
+	setTelemetry(section.bytesAllocated, telemetryBytesAllocated.load(std::memory_order_relaxed));
+	addTelemetry(section.tickTime.buckets[telemetryBucket(tickUs)], 1);
+	endTelemetryWrite(&section.sequence);
+}
+
+//called by the render thread once a frame, after the swap
+void publishRenderTelemetry(uint64_t frameUs) {
+	TelemetrySegment* segment = telemetry.segment;
+	if (segment == NULL) {
+		return;
+	}
+
+	TelemetryRenderSection& section = segment->render;
+	beginTelemetryWrite(&section.sequence);
+	addTelemetry(section.frames, 1);
+	setTelemetry(section.lastFrameUs, frameUs);
+	setTelemetry(section.bytesUploaded, telemetryUploadedBytes);
+	addTelemetry(section.frameTime.buckets[telemetryBucket(frameUs)], 1);
+	endTelemetryWrite(&section.sequence);
+}
+
+// Reading
+
+//copies a section out from under its writer, false if the writer kept getting in the way
+template<typename Section, typename Copy>
+bool readTelemetrySection(const Section& section, Copy copy) {
+	for (int attempt = 0; attempt < TELEMETRY_READ_ATTEMPTS; attempt++) {
+		uint32_t before = section.sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		copy();
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (section.sequence.load(std::memory_order_relaxed) == before) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool readSimulationTelemetry(const TelemetrySegment* segment, TelemetrySimulationSample* out) {
+	const TelemetrySimulationSection& s = segment->simulation;
+	return readTelemetrySection(s, [&]() {
+		out->ticks = s.ticks.load(std::memory_order_relaxed);
+		out->lastTickUs = s.lastTickUs.load(std::memory_order_relaxed);
+		out->units = s.units.load(std::memory_order_relaxed);
+		out->pathQueueDepth = s.pathQueueDepth.load(std::memory_order_relaxed);
+		out->pathSearchesCompleted = s.pathSearchesCompleted.load(std::memory_order_relaxed);
+		out->particlesLive = s.particlesLive.load(std::memory_order_relaxed);
+		out->allocations = s.allocations.load(std::memory_order_relaxed);
+		out->frees = s.frees.load(std::memory_order_relaxed);
+		out->bytesAllocated = s.bytesAllocated.load(std::memory_order_relaxed);
+		for (int b = 0; b < TELEMETRY_HISTOGRAM_BUCKETS; b++) {
+			out->tickTime[b] = s.tickTime.buckets[b].load(std::memory_order_relaxed);
+		}
+	});
+}
+
+bool readRenderTelemetry(const TelemetrySegment* segment, TelemetryRenderSample* out) {
+	const TelemetryRenderSection& s = segment->render;
+	return readTelemetrySection(s, [&]() {
+		out->frames = s.frames.load(std::memory_order_relaxed);
+		out->lastFrameUs = s.lastFrameUs.load(std::memory_order_relaxed);
+		out->bytesUploaded = s.bytesUploaded.load(std::memory_order_relaxed);
+		for (int b = 0; b < TELEMETRY_HISTOGRAM_BUCKETS; b++) {
+			out->frameTime[b] = s.frameTime.buckets[b].load(std::memory_order_relaxed);
+		}
+	});
+}
+
+//upper edge in microseconds of the bucket the given fraction of samples fall under
+uint64_t telemetryPercentile(const uint64_t* now, const uint64_t* before, double fraction) {
+	uint64_t total = 0;
+	for (int b = 0; b < TELEMETRY_HISTOGRAM_BUCKETS; b++) {
+		total += now[b] - before[b];
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t seen = 0;
+	for (int b = 0; b < TELEMETRY_HISTOGRAM_BUCKETS; b++) {
+		seen += now[b] - before[b];
+		if (seen >= total * fraction) {
+			return (uint64_t)1 << b;
+		}
+	}
+	return (uint64_t)1 << (TELEMETRY_HISTOGRAM_BUCKETS - 1);
+}
+
+//samples another process's segment every interval and prints what changed in between
+int runTelemetryReader(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cout << "usage: RTS.exe -telemetry pid [interval ms] [samples]" << std::endl;
+		return -1;
+	}
+	int pid = atoi(argv[2]);
+	int intervalMs = argc > 3 ? atoi(argv[3]) : 1000;
+	int samples = argc > 4 ? atoi(argv[4]) : -1;
+
+	TelemetryMapping mapping;
+	if (!openTelemetrySegment(&mapping, pid)) {
+		return -1;
+	}
+
+	TelemetrySimulationSample lastSimulation{};
+	TelemetryRenderSample lastRender{};
+	readSimulationTelemetry(mapping.segment, &lastSimulation);
+	readRenderTelemetry(mapping.segment, &lastRender);
+
+	for (int i = 0; samples < 0 || i < samples; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+		if (!mapping.segment->running.load(std::memory_order_acquire)) {
+			std::cout << "process " << pid << " has shut down" << std::endl;
+			break;
+		}
+
+		TelemetrySimulationSample simulation;
+		TelemetryRenderSample render;
+		if (!readSimulationTelemetry(mapping.segment, &simulation) || !readRenderTelemetry(mapping.segment, &render)) {
+			std::cout << "telemetry busy, skipped a sample" << std::endl;
+			continue;
+		}
+
+		double seconds = intervalMs / 1000.0;
+		std::cout << "ticks/s " << (simulation.ticks - lastSimulation.ticks) / seconds
+			<< " tick us last " << simulation.lastTickUs
+			<< " p50<" << telemetryPercentile(simulation.tickTime, lastSimulation.tickTime, 0.5)
+			<< " p99<" << telemetryPercentile(simulation.tickTime, lastSimulation.tickTime, 0.99)
+			<< " | units " << simulation.units
+			<< " path queue " << simulation.pathQueueDepth
+			<< " paths/s " << (simulation.pathSearchesCompleted - lastSimulation.pathSearchesCompleted) / seconds
+			<< " particles " << simulation.particlesLive
+			<< " | allocs/s " << (simulation.allocations - lastSimulation.allocations) / seconds
+			<< " live allocs " << (int64_t)(simulation.allocations - simulation.frees)
+			<< " | frames/s " << (render.frames - lastRender.frames) / seconds
+			<< " frame us p50<" << telemetryPercentile(render.frameTime, lastRender.frameTime, 0.5)
+			<< " p99<" << telemetryPercentile(render.frameTime, lastRender.frameTime, 0.99)
+			<< " uploaded KB/s " << (render.bytesUploaded - lastRender.bytesUploaded) / 1024.0 / seconds
+			<< std::endl;
+
+		lastSimulation = simulation;
+		lastRender = render;
+	}
+
+	closeTelemetrySegment(&mapping);
+	return 0;
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <glm.hpp>
+
+// Heightfield terrain on the flowCells grid.
+//
+// Heights are sampled at cell corners, so the map has (width + 1) * (height + 1) samples
+// and each cell is two triangles. For picking, levels[0] holds the min/max height of
+// every cell and each level above halves the resolution (a maximum mipmap), so a ray
+// only descends into the quadtree nodes whose bounding boxes it actually passes through.
+
+const float TERRAIN_SLOPE_DISCOMFORT = 10.0f;
+
+struct TerrainLevel {
+	int width;
+	int height;
+	std::vector<float> minHeights;
+	std::vector<float> maxHeights;
+};
+
+struct Terrain {
+	int width{ 0 };
+	int height{ 0 };
+	float cellSize{ 1.0f };
+	//world x/z of the corner of cell (0, 0), the map is centred on the origin
+	float originX{ 0.0f };
+	float originZ{ 0.0f };
+	std::vector<float> heights;
+	std::vector<TerrainLevel> levels;
+};
+
+float terrainCorner(const Terrain* terrain, int x, int y) {
+	return terrain->heights[(size_t)y * (terrain->width + 1) + x];
+}
+
+void buildTerrainMipmaps(Terrain* terrain) {
+	terrain->levels.clear();
+
+	TerrainLevel base;
+	base.width = terrain->width;
+	base.height = terrain->height;
+	base.minHeights.resize((size_t)base.width * base.height);
+	base.maxHeights.resize((size_t)base.width * base.height);
+
+	for (int y = 0; y < base.height; y++) {
+		for (int x = 0; x < base.width; x++) {
+			float a = terrainCorner(terrain, x, y);
+			float b = terrainCorner(terrain, x + 1, y);
+			float c = terrainCorner(terrain, x, y + 1);
+			float d = terrainCorner(terrain, x + 1, y + 1);
+			base.minHeights[(size_t)y * base.width + x] = fmin(fmin(a, b), fmin(c, d));
+			base.maxHeights[(size_t)y * base.width + x] = fmax(fmax(a, b), fmax(c, d));
+		}
+	}
+	terrain->levels.push_back(base);
+
+	while (terrain->levels.back().width > 1 || terrain->levels.back().height > 1) {
+		const TerrainLevel& below = terrain->levels.back();
+		TerrainLevel level;
+		level.width = (below.width + 1) / 2;
+		level.height = (below.height + 1) / 2;
+		level.minHeights.resize((size_t)level.width * level.height);
+		level.maxHeights.resize((size_t)level.width * level.height);
+
+		for (int y = 0; y < level.height; y++) {
+			for (int x = 0; x < level.width; x++) {
+				float lo = INFINITY;
+				float hi = -INFINITY;
+				for (int cy = 2 * y; cy < 2 * y + 2 && cy < below.height; cy++) {
+					for (int cx = 2 * x; cx < 2 * x + 2 && cx < below.width; cx++) {
+						lo = fmin(lo, below.minHeights[(size_t)cy * below.width + cx]);
+						hi = fmax(hi, below.maxHeights[(size_t)cy * below.width + cx]);
+					}
+				}
+				level.minHeights[(size_t)y * level.width + x] = lo;
+				level.maxHeights[(size_t)y * level.width + x] = hi;
+			}
+		}
+		terrain->levels.push_back(level);
+	}
+}
+
+void initTerrain(Terrain* terrain, int width, int height, float cellSize) {
+	terrain->width = width;
+	terrain->height = height;
+	terrain->cellSize = cellSize;
+	terrain->originX = -cellSize * width / 2.0f;
+	terrain->originZ = -cellSize * height / 2.0f;
+	terrain->heights.assign((size_t)(width + 1) * (height + 1), 0.0f);
+	buildTerrainMipmaps(terrain);
+}
+
+float terrainLatticeNoise(int x, int y, uint32_t seed) {
+	uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h = h ^ (h >> 16);
+	return h / 4294967295.0f;
+}
+
+float terrainValueNoise(float x, float y, uint32_t seed) {
+	int ix = (int)floor(x);
+	int iy = (int)floor(y);
+	float fx = x - ix;
+	float fy = y - iy;
+	fx = fx * fx * (3.0f - 2.0f * fx);
+	fy = fy * fy * (3.0f - 2.0f * fy);
+
+	float a = terrainLatticeNoise(ix, iy, seed);
+	float b = terrainLatticeNoise(ix + 1, iy, seed);
+	float c = terrainLatticeNoise(ix, iy + 1, seed);
+	float d = terrainLatticeNoise(ix + 1, iy + 1, seed);
+	return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+//rolling hills, amplitude is the peak to trough height in world units
+void generateTerrain(Terrain* terrain, float amplitude, uint32_t seed) {
+	for (int y = 0; y <= terrain->height; y++) {
+		for (int x = 0; x <= terrain->width; x++) {
+			float h = 0.0f;
+			float frequency = 1.0f / 32.0f;
+			float weight = 0.5f;
+			for (int octave = 0; octave < 4; octave++) {
+				h += weight * terrainValueNoise(x * frequency, y * frequency, seed + octave);
+				frequency *= 2.0f;
+				weight *= 0.5f;
+			}
+			terrain->heights[(size_t)y * (terrain->width + 1) + x] = h * amplitude;
+		}
+	}
+	buildTerrainMipmaps(terrain);
+}
+
+//bilinear height and its gradient at a world x/z, clamped to the map edge
+float sampleTerrain(const Terrain* terrain, float x, float z, float* gradientX, float* gradientZ) {
+	float invCellSize = 1.0f / terrain->cellSize;
+	float fx = (x - terrain->originX) * invCellSize;
+	float fz = (z - terrain->originZ) * invCellSize;
+	fx = fx < 0.0f ? 0.0f : (fx > terrain->width ? (float)terrain->width : fx);
+	fz = fz < 0.0f ? 0.0f : (fz > terrain->height ? (float)terrain->height : fz);
+
+	int ix = (int)fx < terrain->width ? (int)fx : terrain->width - 1;
+	int iz = (int)fz < terrain->height ? (int)fz : terrain->height - 1;
+	float tx = fx - ix;
+	float tz = fz - iz;
+
+	const float* row0 = &terrain->heights[(size_t)iz * (terrain->width + 1) + ix];
+	const float* row1 = row0 + terrain->width + 1;
+	float a = row0[0], b = row0[1], c = row1[0], d = row1[1];
+
+	*gradientX = ((b - a) * (1.0f - tz) + (d - c) * tz) * invCellSize;
+	*gradientZ = ((c - a) * (1.0f - tx) + (d - b) * tx) * invCellSize;
+	return (a + (b - a) * tx) * (1.0f - tz) + (c + (d - c) * tx) * tz;
+}
+
+float terrainHeightAt(const Terrain* terrain, float x, float z) {
+	float gradientX, gradientZ;
+	return sampleTerrain(terrain, x, z, &gradientX, &gradientZ);
+}
+
+//one pass over all units: puts each on the ground and tilts it (pitch, roll) to the slope
+//along and across its heading
+void sampleTerrainBatch(const Terrain* terrain, float* positions, const float* headings, float* tilts, int count) {
+	for (int i = 0; i < count; i++) {
+		float gradientX, gradientZ;
+		positions[3 * i + 1] = sampleTerrain(terrain, positions[3 * i], positions[3 * i + 2], &gradientX, &gradientZ);
+
+		float s = sin(headings[i]);
+		float c = cos(headings[i]);
+		//forward is (-sin, 0, cos), right is (cos, 0, sin), matching the heading used to move
+		tilts[2 * i] = atan(-s * gradientX + c * gradientZ);
+		tilts[2 * i + 1] = atan(c * gradientX + s * gradientZ);
+	}
+}
+
+//movement cost of a cell from how steep it is
+int terrainSlopeDiscomfort(const Terrain* terrain, int cellIndex) {
+	const TerrainLevel& cells = terrain->levels[0];
+	float slope = (cells.maxHeights[cellIndex] - cells.minHeights[cellIndex]) / terrain->cellSize;
+	return (int)(slope * TERRAIN_SLOPE_DISCOMFORT);
+}
+
+bool rayTriangleIntersection(glm::vec3 origin, glm::vec3 direction, glm::vec3 a, glm::vec3 b, glm::vec3 c, float* t) {
+	glm::vec3 edge1 = b - a;
+	glm::vec3 edge2 = c - a;
+	glm::vec3 p = glm::cross(direction, edge2);
+	float det = glm::dot(edge1, p);
+	if (fabs(det) < 1e-8f) {
+		return false;
+	}
+
+	float invDet = 1.0f / det;
+	glm::vec3 s = origin - a;
+	float u = glm::dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+
+	*t = glm::dot(edge2, q) * invDet;
+	return *t >= 0.0f;
+}
+
+//slab test, returns the entry and exit distances along the ray
+bool rayBoxIntersection(glm::vec3 origin, glm::vec3 invDirection, glm::vec3 boxMin, glm::vec3 boxMax, float* tEnter, float* tExit) {
+	float t0 = 0.0f;
+	float t1 = INFINITY;
+	for (int axis = 0; axis < 3; axis++) {
+		float nearT = (boxMin[axis] - origin[axis]) * invDirection[axis];
+		float farT = (boxMax[axis] - origin[axis]) * invDirection[axis];
+		if (nearT > farT) {
+			float tmp = nearT;
+			nearT = farT;
+			farT = tmp;
+		}
+		//NaN from a zero direction component with the origin on the slab fails neither test
+		t0 = nearT > t0 ? nearT : t0;
+		t1 = farT < t1 ? farT : t1;
+		if (t0 > t1) {
+			return false;
+		}
+	}
+	*tEnter = t0;
+	*tExit = t1;
+	return true;
+}
+
+struct TerrainNode {
+	int level;
+	int x;
+	int y;
+	float tEnter;
+};
+
+//same argument order as rayGroundPlaneIntersection, so the two can be swapped for each other
+bool rayTerrainIntersection(const Terrain* terrain, glm::vec3 direction, glm::vec3 origin, glm::vec3* answer) {
+	if (terrain->levels.empty()) {
+		return false;
+	}
+
+	glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float bestT = INFINITY;
+
+	//depth first, nearest child first, so the stack stays at 3 entries per level
+	std::vector<TerrainNode> stack;
+	stack.reserve(4 * terrain->levels.size());
+	stack.push_back(TerrainNode{ (int)terrain->levels.size() - 1, 0, 0, 0.0f });
+
+	while (!stack.empty()) {
+		TerrainNode node = stack.back();
+		stack.pop_back();
+		if (node.tEnter > bestT) {
+			continue;
+		}
+
+		if (node.level == 0) {
+			float cs = terrain->cellSize;
+			float x0 = terrain->originX + node.x * cs;
+			float z0 = terrain->originZ + node.y * cs;
+			glm::vec3 a(x0, terrainCorner(terrain, node.x, node.y), z0);
+			glm::vec3 b(x0 + cs, terrainCorner(terrain, node.x + 1, node.y), z0);
+			glm::vec3 c(x0, terrainCorner(terrain, node.x, node.y + 1), z0 + cs);
+			glm::vec3 d(x0 + cs, terrainCorner(terrain, node.x + 1, node.y + 1), z0 + cs);
+
+			float t;
+			if (rayTriangleIntersection(origin, direction, a, b, d, &t) && t < bestT) {
+				bestT = t;
+			}
+			if (rayTriangleIntersection(origin, direction, a, d, c, &t) && t < bestT) {
+				bestT = t;
+			}
+			continue;
+		}
+
+		const TerrainLevel& children = terrain->levels[node.level - 1];
+		float childSize = terrain->cellSize * (1 << (node.level - 1));
+
+		TerrainNode hits[4];
+		int hitCount = 0;
+		for (int cy = 2 * node.y; cy < 2 * node.y + 2 && cy < children.height; cy++) {
+			for (int cx = 2 * node.x; cx < 2 * node.x + 2 && cx < children.width; cx++) {
+				size_t child = (size_t)cy * children.width + cx;
+				glm::vec3 boxMin(terrain->originX + cx * childSize, children.minHeights[child], terrain->originZ + cy * childSize);
+				glm::vec3 boxMax(boxMin.x + childSize, children.maxHeights[child], boxMin.z + childSize);
+
+				float tEnter, tExit;
+				if (rayBoxIntersection(origin, invDirection, boxMin, boxMax, &tEnter, &tExit) && tEnter <= bestT) {
+					hits[hitCount++] = TerrainNode{ node.level - 1, cx, cy, tEnter };
+				}
+			}
+		}
+
+		//push the furthest first so the nearest is visited next
+		for (int i = 1; i < hitCount; i++) {
+			for (int j = i; j > 0 && hits[j].tEnter > hits[j - 1].tEnter; j--) {
+				TerrainNode tmp = hits[j];
+				hits[j] = hits[j - 1];
+				hits[j - 1] = tmp;
+			}
+		}
+		for (int i = 0; i < hitCount; i++) {
+			stack.push_back(hits[i]);
+		}
+	}
+
+	if (bestT == INFINITY) {
+		return false;
+	}
+
+	*answer = origin + direction * bestT;
+	return true;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+
+#include "simd.h"
+
+// Per instance transforms for unit models, worked out on the CPU once per frame so the
+// vertex shader (res/shaders/transformed/shader.vs) only does one matrix-vector product
+// per vertex instead of building and multiplying five matrices.
+//
+// shader.vs turns a unit's vertices by heading (plus the turret direction for turret
+// parts), then tilt, then 180 degrees to face the right way. Since turning by the heading
+// and then the turret direction is one turn by their sum, each part's rotation is
+// Ry(angle) * C with C = Rx(pitch) * Rz(roll) * Ry(pi) shared by both parts. The
+// view-projection is folded in too, so each part gets a single clip-from-model matrix.
+//
+// The shader's lighting takes the z of the rotated normal, which is the dot product of
+// the normal with the rotation's third row, so that row (negated) goes along as the
+// light direction in model space and the shader needs no rotation at all for normals.
+
+struct UnitTransform {
+	float hull[16];      //clip from model for the hull, column major
+	float turret[16];    //the same for the parts that turn with the turret
+	float hullLight[4];  //light direction in the hull's model space, w unused
+	float turretLight[4];
+	float tint[4];
+};
+
+//viewProjection is column major, like glm and GL
+void computeUnitTransform(const TanksData& tanks, int i, const float* viewProjection, UnitTransform* out) {
+	const float* vp = viewProjection;
+	float pitch = tanks.tilts[2 * i];
+	float roll = tanks.tilts[2 * i + 1];
+	float sp = sinf(pitch), cp = cosf(pitch);
+	float sr = sinf(roll), cr = cosf(roll);
+
+	//C = Rx(pitch) * Rz(roll) * Ry(pi), by rows
+	float c0[3] = { -cr, -sr, 0.0f };
+	float c1[3] = { -cp * sr, cp * cr, -sp };
+	float c2[3] = { sp * sr, -sp * cr, -cp };
+
+	const float* t = &tanks.positions[3 * i];
+	float angles[2] = { tanks.headings[i], tanks.headings[i] + tanks.turretDirections[i] };
+	float* matrices[2] = { out->hull, out->turret };
+	float* lights[2] = { out->hullLight, out->turretLight };
+
+	for (int part = 0; part < 2; part++) {
+		float s = sinf(angles[part]), c = cosf(angles[part]);
+
+		//R = Ry(angle) * C, by rows
+		float r[3][3];
+		for (int j = 0; j < 3; j++) {
+			r[0][j] = c * c0[j] - s * c2[j];
+			r[1][j] = c1[j];
+			r[2][j] = s * c0[j] + c * c2[j];
+		}
+
+		//viewProjection * [R t], vp[k * 4 + row] is row, column k
+		float* m = matrices[part];
+		for (int row = 0; row < 4; row++) {
+			for (int j = 0; j < 3; j++) {
+				m[j * 4 + row] = vp[row] * r[0][j] + vp[4 + row] * r[1][j] + vp[8 + row] * r[2][j];
+			}
+			m[12 + row] = vp[row] * t[0] + vp[4 + row] * t[1] + vp[8 + row] * t[2] + vp[12 + row];
+		}
+
+		lights[part][0] = -r[2][0];
+		lights[part][1] = -r[2][1];
+		lights[part][2] = -r[2][2];
+		lights[part][3] = 0.0f;
+	}
+
+	memcpy(out->tint, &tanks.tint[4 * i], sizeof(out->tint));
+}
+
+#ifdef RTS_SSE2
+//writes one column (or light) for four instances, given as one vector per row with an instance per lane
+inline void storeUnitTransformColumns(__m128 a, __m128 b, __m128 c, __m128 d, UnitTransform* out, size_t offset) {
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+	_mm_storeu_ps((float*)((char*)&out[0] + offset), a);
+	_mm_storeu_ps((float*)((char*)&out[1] + offset), b);
+	_mm_storeu_ps((float*)((char*)&out[2] + offset), c);
+	_mm_storeu_ps((float*)((char*)&out[3] + offset), d);
+}
+
+//one part's matrix and light for four instances at once
+inline void computeUnitPartTransforms4(__m128 angle, const __m128* c0, const __m128* c1, const __m128* c2,
+	__m128 tx, __m128 ty, __m128 tz, const float* vp, UnitTransform* out, size_t matrixOffset, size_t lightOffset) {
+	__m128 s, c;
+	sinCos4(angle, &s, &c);
+
+	__m128 r0[3], r2[3];
+	for (int j = 0; j < 3; j++) {
+		r0[j] = _mm_sub_ps(_mm_mul_ps(c, c0[j]), _mm_mul_ps(s, c2[j]));
+		r2[j] = _mm_add_ps(_mm_mul_ps(s, c0[j]), _mm_mul_ps(c, c2[j]));
+	}
+
+	for (int j = 0; j < 4; j++) {
+		__m128 rows[4];
+		for (int row = 0; row < 4; row++) {
+			__m128 v0 = _mm_set1_ps(vp[row]);
+			__m128 v1 = _mm_set1_ps(vp[4 + row]);
+			__m128 v2 = _mm_set1_ps(vp[8 + row]);
+			if (j < 3) {
+				rows[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0, r0[j]), _mm_mul_ps(v1, c1[j])), _mm_mul_ps(v2, r2[j]));
+			}
+			else {
+				rows[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0, tx), _mm_mul_ps(v1, ty)), _mm_add_ps(_mm_mul_ps(v2, tz), _mm_set1_ps(vp[12 + row])));
+			}
+		}
+		storeUnitTransformColumns(rows[0], rows[1], rows[2], rows[3], out, matrixOffset + j * 4 * sizeof(float));
+	}
+
+	__m128 zero = _mm_setzero_ps();
+	storeUnitTransformColumns(_mm_sub_ps(zero, r2[0]), _mm_sub_ps(zero, r2[1]), _mm_sub_ps(zero, r2[2]), zero, out, lightOffset);
+}
+#endif
+
+//fills out (resized to fit) with every tank's transforms, four tanks at a time where SSE2 is there
+void computeUnitTransforms(const TanksData& tanks, const float* viewProjection, std::vector<UnitTransform>* out) {
+	int count = tanks.headings.size();
+	out->resize(count);
+	UnitTransform* transforms = out->data();
+	int i = 0;
+
+#ifdef RTS_SSE2
+	const float* vp = viewProjection;
+	for (; i + 4 <= count; i += 4) {
+		const float* p = &tanks.positions[3 * i];
+		const float* tilt = &tanks.tilts[2 * i];
+		__m128 tx = _mm_setr_ps(p[0], p[3], p[6], p[9]);
+		__m128 ty = _mm_setr_ps(p[1], p[4], p[7], p[10]);
+		__m128 tz = _mm_setr_ps(p[2], p[5], p[8], p[11]);
+		__m128 pitch = _mm_setr_ps(tilt[0], tilt[2], tilt[4], tilt[6]);
+		__m128 roll = _mm_setr_ps(tilt[1], tilt[3], tilt[5], tilt[7]);
+		__m128 heading = _mm_loadu_ps(&tanks.headings[i]);
+		__m128 turret = _mm_add_ps(heading, _mm_loadu_ps(&tanks.turretDirections[i]));
+
+		__m128 sp, cp, sr, cr;
+		sinCos4(pitch, &sp, &cp);
+		sinCos4(roll, &sr, &cr);
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 c0[3] = { _mm_sub_ps(zero, cr), _mm_sub_ps(zero, sr), zero };
+		__m128 c1[3] = { _mm_sub_ps(zero, _mm_mul_ps(cp, sr)), _mm_mul_ps(cp, cr), _mm_sub_ps(zero, sp) };
+		__m128 c2[3] = { _mm_mul_ps(sp, sr), _mm_sub_ps(zero, _mm_mul_ps(sp, cr)), _mm_sub_ps(zero, cp) };
+
+		computeUnitPartTransforms4(heading, c0, c1, c2, tx, ty, tz, vp, &transforms[i], offsetof(UnitTransform, hull), offsetof(UnitTransform, hullLight));
+		computeUnitPartTransforms4(turret, c0, c1, c2, tx, ty, tz, vp, &transforms[i], offsetof(UnitTransform, turret), offsetof(UnitTransform, turretLight));
+
+		for (int k = 0; k < 4; k++) {
+			memcpy(transforms[i + k].tint, &tanks.tint[4 * (i + k)], sizeof(transforms[i + k].tint));
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		computeUnitTransform(tanks, i, viewProjection, &transforms[i]);
+	}
+}